@@ -28,15 +28,17 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <boost/ptr_container/ptr_list.hpp>
 #include <boost/type_traits/remove_pointer.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <unistd.h>
 #include "src/alignmentrecord.hh"
 #include "src/alignmentsfilter.hh"
+#include "src/compression.hh"
 
 
 
 using namespace std;
 
 template< typename AlignmentsFilterListType >
-void parseAndFilter( AlignmentsFilterListType& filters, bool mask = true ) {
+void parseAndFilter( AlignmentsFilterListType& filters, std::istream& input, std::ostream& output, bool mask = true ) {
 
     // some type tricks
     typedef typename boost::remove_pointer< typename AlignmentsFilterListType::value_type >::type AlignmentsFilterType; //expect stdcontainer
@@ -45,7 +47,7 @@ void parseAndFilter( AlignmentsFilterListType& filters, bool mask = true ) {
 
     typename AlignmentsFilterListType::iterator filter_it;
     AlignmentRecordFactory< AlignmentRecordType > recfac;
-    FileParser< AlignmentRecordFactory< AlignmentRecordType > > parser(cin, recfac);
+    FileParser< AlignmentRecordFactory< AlignmentRecordType > > parser(input, recfac);
     RecordSetGeneratorUnsorted< AlignmentRecordType, AlignmentRecordSetType, false > recgen( parser ); // Eik geaendert
 
     AlignmentRecordSetType recordset;
@@ -67,7 +69,7 @@ void parseAndFilter( AlignmentsFilterListType& filters, bool mask = true ) {
         while( rec_it != recordset.end() ) {
             record = *rec_it;
             if( ( record->isFiltered() && mask ) || ! record->isFiltered() ) {
-                cout << *record;
+                output << *record;
             }
             ++rec_it;
             recfac.destroy( record ); //clear memory again
@@ -81,9 +83,9 @@ int main( int argc, char** argv ) {
 
     float minscore, toppercent, minpid;
     double maxevalue;
-    unsigned int numbestscore, minsupport;
+    unsigned int numbestscore, minsupport, compression_threads;
 
-    std::string tax_map1_filename, tax_map2_filename;
+    std::string tax_map1_filename, tax_map2_filename, output_compression_name;
 
     namespace po = boost::program_options;
     po::options_description desc("Allowed options");
@@ -100,7 +102,9 @@ int main( int argc, char** argv ) {
     ( "remove-ref-from-query-taxon,r", "remove alignments for labeled data to test different degrees of taxonomic distance" )
     ( "taxon-mapping-sample,x", po::value< std::string >( &tax_map1_filename ), "map sample identifier to taxon" )
     ( "taxon-mapping-reference,y", po::value< std::string >( &tax_map2_filename ), "map reference identifier to taxon" )
-    ( "mask-by-star,z", "instead of suppressing filtered alignments mask them by prefixing a star at the line start" );
+    ( "mask-by-star,z", "instead of suppressing filtered alignments mask them by prefixing a star at the line start" )
+    ( "output-compression", po::value< std::string >( &output_compression_name )->default_value( "none" ), "compress the output with gzip, bgzf or zstd, compressed input is detected" )
+    ( "compression-threads", po::value< unsigned int >( &compression_threads )->default_value( 1 ), "number of threads which decompress the input and compress BGZF and zstd output" );
 
     po::variables_map vm;
     po::store(po::command_line_parser( argc, argv ).options( desc ).run(), vm);
@@ -116,6 +120,12 @@ int main( int argc, char** argv ) {
     bool mask_by_star = vm.count( "mask-by-star" );
     bool remove_same_taxon = vm.count( "remove-ref-from-query-taxon" );
 
+    CompressionFormat output_compression;
+    if( ! parseCompressionFormat( output_compression_name, output_compression ) ) {
+        cout << "The output compression must be none, gzip, bgzf or zstd (if supported by this build)" << endl;
+        return EXIT_FAILURE;
+    }
+
     typedef list< AlignmentRecord* > RecordSetType;
     boost::ptr_list< AlignmentsFilter< RecordSetType > > filters; //takes care of object destruction by itself
 
@@ -157,7 +167,11 @@ int main( int argc, char** argv ) {
         filters.push_back( new MinSupportFilter< RecordSetType >( minsupport ) );
     }
 
-    parseAndFilter( filters, mask_by_star );
+    CompressedInputStream input( cin, compression_threads );
+    boost::scoped_ptr< CompressedOutputStream > compressed_output;
+    if( output_compression != uncompressed ) compressed_output.reset( new CompressedOutputStream( STDOUT_FILENO, output_compression, compression_threads ) );
+    parseAndFilter( filters, input, compressed_output ? *compressed_output : cout, mask_by_star );
+    if( compressed_output ) compressed_output->close();
 
     // delete filters (boost pointer list magic)
     filters.clear();
@@ -0,0 +1,118 @@
+/*
+taxator-tk predicts the taxon for DNA sequences based on sequence alignment.
+
+Copyright (C) 2010 Johannes Dröge
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Compares the stream-based FileParser with the in-place MemoryParser on a
+// memory-mapped alignments file. Prints one tab-separated line per run.
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/exception/diagnostic_information.hpp>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <list>
+#include "../src/alignmentrecord.hh"
+#include "../src/fileparser.hh"
+#include "../src/mappedfile.hh"
+
+typedef AlignmentRecordFactory< AlignmentRecord > FactoryType;
+typedef std::list< AlignmentRecord* > RecordSetType;
+
+
+
+// parse all records and group them into record sets like taxator does
+template< typename ParserType >
+large_unsigned_int consume( ParserType& parser, bool split_alignments ) {
+    boost::scoped_ptr< RecordSetGenerator< AlignmentRecord, RecordSetType > > recgen( newRecordSetGenerator< AlignmentRecord, RecordSetType >( parser, split_alignments, false ) );
+    RecordSetType rset;
+    large_unsigned_int records = 0;
+    while ( recgen->notEmpty() ) {
+        recgen->getNext( rset );
+        records += rset.size();
+        deleteRecords( rset );
+    }
+    return records;
+}
+
+
+
+void report( const std::string& parser, unsigned int run, large_unsigned_int records, std::size_t bytes, std::chrono::steady_clock::time_point start ) {
+    const double seconds = std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+    std::cout << parser << '\t' << run << '\t' << records << '\t' << bytes << '\t' << seconds << '\t' << bytes/seconds/(1024.*1024.) << std::endl;
+}
+
+
+
+// lexical_cast wraps negative numbers around for unsigned types
+unsigned int parseCount( const char* arg ) {
+    if ( *arg == '-' ) throw boost::bad_lexical_cast();
+    return boost::lexical_cast< unsigned int >( arg );
+}
+
+
+int main( int argc, char** argv ) {
+    unsigned int runs = 0;
+    bool split_alignments = true;
+    try {
+        runs = argc > 2 ? parseCount( argv[2] ) : 3;
+        split_alignments = argc > 3 ? boost::lexical_cast< bool >( argv[3] ) : true;
+    } catch ( boost::bad_lexical_cast& ) {
+        runs = 0;  // print usage
+    }
+    if ( argc < 2 || argc > 4 || *argv[1] == '-' || ! runs ) {  // also catches -h and --help
+        std::cerr << "usage: " << argv[0] << " ALIGNMENTS-FILE [RUNS >= 1] [SPLIT 0|1]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::string filename( argv[1] );
+    if ( ! boost::filesystem::is_regular_file( filename ) ) {  // the stream parser would just read nothing
+        std::cerr << "\"" << filename << "\" is not a regular file" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    try {
+        FactoryType fac;
+        std::cout << "parser\trun\trecords\tbytes\tseconds\tMiB/s" << std::endl;
+        for ( unsigned int run = 1; run <= runs; ++run ) {
+            {
+                const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                std::ifstream strm( filename.c_str() );
+                FileParser< FactoryType > parser( strm, fac );
+                const large_unsigned_int records = consume( parser, split_alignments );
+                strm.clear();
+                report( "FileParser", run, records, strm.seekg( 0, std::ios::end ).tellg(), start );
+            }
+            {
+                const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                MappedFile file( filename );
+                MemoryParser< FactoryType > parser( file, fac );
+                const large_unsigned_int records = consume( parser, split_alignments );
+                report( "MemoryParser", run, records, file.size(), start );
+            }
+        }
+    } catch ( Exception& e ) {
+        std::cerr << "An unrecoverable error occurred: " << e.what() << std::endl << boost::diagnostic_information( e ) << std::endl;
+        return EXIT_FAILURE;
+    } catch ( boost::filesystem::filesystem_error& e ) {
+        std::cerr << "An unrecoverable error occurred: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,120 @@
+/*
+taxator-tk predicts the taxon for DNA sequences based on sequence alignment.
+
+Copyright (C) 2010 Johannes Dröge
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Aligns random mutated copies of a random DNA sequence against the original as
+// in an RPA pass, once pair by pair with seqan's Myers bit-vector algorithm and
+// once with each available batch kernel, with and without an upper bound on the
+// distance. Prints one tab-separated line per method and fails if any edit distance
+// differs.
+// usage: benchmark-editdistance [sequence length >= 2] [number of sequences] [rounds] [bound]
+
+#include <algorithm>
+#include <boost/lexical_cast.hpp>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <seqan/align.h>
+#include "../src/editdistance.hh"
+
+
+
+seqan::Dna5String mutate( const seqan::Dna5String& seq, double rate, std::mt19937& rng ) {
+    std::uniform_real_distribution< double > uniform( 0., 1. );
+    std::uniform_int_distribution< int > base( 0, 4 );
+    seqan::Dna5String mutated;
+    for ( std::size_t i = 0; i < seqan::length( seq ); ++i ) {
+        const double r = uniform( rng );
+        if ( r < rate/3 ) continue;  // deletion
+        if ( r < 2*rate/3 ) seqan::appendValue( mutated, seqan::Dna5( base( rng ) ) );  // insertion
+        seqan::appendValue( mutated, r < rate && r >= 2*rate/3 ? seqan::Dna5( base( rng ) ) : seq[i] );  // substitution
+    }
+    return mutated;
+}
+
+
+
+// lexical_cast wraps negative numbers around for unsigned types
+std::size_t parseCount( const char* arg ) {
+    if ( *arg == '-' ) throw boost::bad_lexical_cast();
+    return boost::lexical_cast< std::size_t >( arg );
+}
+
+
+int main( int argc, char** argv ) {
+    std::size_t length = 0, number = 0, rounds = 0;
+    int bound = 0;
+    try {
+        length = argc > 1 ? parseCount( argv[1] ) : 1000;
+        number = argc > 2 ? parseCount( argv[2] ) : 100;
+        rounds = argc > 3 ? parseCount( argv[3] ) : 100;
+        bound = argc > 4 ? boost::lexical_cast< int >( argv[4] ) : length/20;
+    } catch ( boost::bad_lexical_cast& ) {
+        length = 0;  // print usage
+    }
+    if ( argc > 5 || length < 2 || ! number || ! rounds || bound < 0 ) {  // seqan needs sequences of at least two characters
+        std::cerr << "usage: " << argv[0] << " [LENGTH >= 2] [SEQUENCES >= 1] [ROUNDS >= 1] [BOUND >= 0]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    std::mt19937 rng( 42 );
+    std::uniform_int_distribution< int > base( 0, 3 );
+    std::uniform_real_distribution< double > rate( 0., .3 );
+    seqan::Dna5String anchor;
+    for ( std::size_t i = 0; i < length; ++i ) seqan::appendValue( anchor, seqan::Dna5( base( rng ) ) );
+    std::vector< seqan::Dna5String > segments( number );
+    for ( std::size_t i = 0; i < number; ++i ) segments[i] = mutate( anchor, rate( rng ), rng );
+
+    std::cout << "method\tlength\tsequences\trounds\tseconds\talignments/s" << std::endl;
+    std::vector< int > expected( number );
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for ( std::size_t r = 0; r < rounds; ++r ) {
+        for ( std::size_t i = 0; i < number; ++i ) expected[i] = -seqan::globalAlignmentScore( segments[i], anchor, seqan::MyersBitVector() );
+    }
+    double seconds = std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+    std::cout << "seqan\t" << length << '\t' << number << '\t' << rounds << '\t' << seconds << '\t' << number*rounds/seconds << std::endl;
+
+    std::vector< int > expected_bounded( number );
+    for ( std::size_t i = 0; i < number; ++i ) expected_bounded[i] = std::min( expected[i], bound + 1 );
+
+    bool differ = false;
+    const std::vector< EditDistanceKernel >& kernels = availableEditDistanceKernels();
+    for ( std::vector< EditDistanceKernel >::const_iterator kernel = kernels.begin(); kernel != kernels.end(); ++kernel ) {
+        for ( int b = -1; b <= bound; b += bound + 1 ) {
+            BatchEditDistance batch( *kernel );
+            std::vector< int > distances;
+            start = std::chrono::steady_clock::now();
+            for ( std::size_t r = 0; r < rounds; ++r ) {
+                batch.setText( anchor );
+                for ( std::size_t i = 0; i < number; ++i ) batch.addPattern( segments[i], b );
+                batch.compute( distances );
+            }
+            seconds = std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+            const std::string method = b < 0 ? std::string( kernel->name ) : std::string( kernel->name ) + "-bound" + boost::lexical_cast< std::string >( b );
+            std::cout << method << '\t' << length << '\t' << number << '\t' << rounds << '\t' << seconds << '\t' << number*rounds/seconds << std::endl;
+            if ( distances != ( b < 0 ? expected : expected_bounded ) ) {
+                std::cerr << "edit distances of kernel " << method << " differ from seqan" << std::endl;
+                differ = true;
+            }
+        }
+    }
+    return differ ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,100 @@
+/*
+taxator-tk predicts the taxon for DNA sequences based on sequence alignment.
+
+Copyright (C) 2010 Johannes Dröge
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Measures TaxonomyInterface::getLCA calls per second on random node pairs of the
+// taxonomy given by TAXATORTK_TAXONOMY_NCBI, once with the LCA index and once
+// walking up the tree. Prints one tab-separated line per method.
+
+#include <boost/lexical_cast.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/exception/diagnostic_information.hpp>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+#include "../src/ncbidata.hh"
+#include "../src/taxonomyinterface.hh"
+#include "../src/exception.hh"
+
+
+
+double measure( const TaxonomyInterface& taxinter, const std::vector< const TaxonNode* >& pairs, std::vector< const TaxonNode* >& results ) {
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for ( std::size_t i = 0; i < results.size(); ++i ) results[i] = taxinter.getLCA( pairs[2*i], pairs[2*i + 1] );
+    return std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+}
+
+
+
+// lexical_cast wraps negative numbers around for unsigned types
+std::size_t parseCount( const char* arg ) {
+    if ( *arg == '-' ) throw boost::bad_lexical_cast();
+    return boost::lexical_cast< std::size_t >( arg );
+}
+
+
+int main( int argc, char** argv ) {
+    std::size_t queries = 0;
+    bool delete_unmarked = false;
+    try {
+        queries = argc > 1 ? parseCount( argv[1] ) : 10000000;
+        delete_unmarked = argc > 2 ? boost::lexical_cast< bool >( argv[2] ) : false;
+    } catch ( boost::bad_lexical_cast& ) {
+        queries = 0;  // print usage
+    }
+    if ( argc > 3 || ! queries ) {  // also catches -h and --help
+        std::cerr << "usage: " << argv[0] << " [QUERIES >= 1] [DELETE-UNMARKED 0|1]" << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    try {
+        std::vector< std::string > ranks = { "superkingdom", "phylum", "class", "order", "family", "genus", "species" };
+        boost::scoped_ptr< Taxonomy > tax( loadTaxonomyFromEnvironment( &ranks ) );
+        if ( ! tax ) return EXIT_FAILURE;
+        if ( delete_unmarked ) tax->deleteUnmarkedNodes();
+        TaxonomyInterface taxinter( tax.get() );
+
+        std::vector< const TaxonNode* > nodes;
+        for ( Taxonomy::iterator it = tax->begin(); it != tax->end(); ++it ) nodes.push_back( it.node );
+
+        std::mt19937 rng( 42 );
+        std::uniform_int_distribution< std::size_t > pick( 0, nodes.size() - 1 );
+        std::vector< const TaxonNode* > pairs( 2*queries );
+        for ( std::size_t i = 0; i < pairs.size(); ++i ) pairs[i] = nodes[ pick( rng ) ];
+
+        std::vector< const TaxonNode* > indexed( queries ), walked( queries );
+        std::cout << "method\tnodes\tqueries\tseconds\tcalls/s" << std::endl;
+        double seconds = measure( taxinter, pairs, indexed );
+        std::cout << "index\t" << nodes.size() << '\t' << queries << '\t' << seconds << '\t' << queries/seconds << std::endl;
+
+        tax->clearLCAIndex();
+        seconds = measure( taxinter, pairs, walked );
+        std::cout << "walk\t" << nodes.size() << '\t' << queries << '\t' << seconds << '\t' << queries/seconds << std::endl;
+
+        if ( indexed != walked ) {
+            std::cerr << "results differ between the methods" << std::endl;
+            return EXIT_FAILURE;
+        }
+    } catch ( Exception& e ) {
+        std::cerr << "An unrecoverable error occurred: " << e.what() << std::endl << boost::diagnostic_information( e ) << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,168 @@
+/*
+taxator-tk predicts the taxon for DNA sequences based on sequence alignment.
+
+Copyright (C) 2010 Johannes Dröge
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Measures the prediction steps on a workload directory written by
+// benchmark-workload with the taxonomy given by TAXATORTK_TAXONOMY_NCBI: parsing
+// the alignments into record sets with taxa, RPAPredictionModel::predict with and
+// without score cache, MeganLCAPredictionModel::predict and combinePredictionRanges
+// on the RPA predictions of queries with several segments as in binner. All
+// predictions run on one thread. Prints one tab-separated line per step and run.
+// usage: benchmark-prediction WORKLOAD-DIR [runs]
+
+#include <boost/lexical_cast.hpp>
+#include <boost/ptr_container/ptr_list.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/exception/diagnostic_information.hpp>
+#include <chrono>
+#include <iostream>
+#include <list>
+#include <sstream>
+#include <vector>
+#include "../src/alignmentrecord.hh"
+#include "../src/alignmentscorecache.hh"
+#include "../src/fileparser.hh"
+#include "../src/mappedfile.hh"
+#include "../src/ncbidata.hh"
+#include "../src/predictionranges.hh"
+#include "../src/predictionrecordbinning.hh"
+#include "../src/sequencestorage.hh"
+#include "../src/taxonpredictionmodel.hh"
+#include "../src/taxonpredictionmodelsequence.hh"
+#include "../src/exception.hh"
+
+typedef std::list< AlignmentRecordTaxonomy* > RecordSetType;
+typedef AlignmentRecordFactory< AlignmentRecordTaxonomy > FactoryType;
+typedef seqan::String< seqan::Dna5 > StringType;
+typedef RandomSeqStoreROInterface< StringType > StorageType;
+
+
+
+double secondsSince( std::chrono::steady_clock::time_point start ) {
+    return std::chrono::duration< double >( std::chrono::steady_clock::now() - start ).count();
+}
+
+
+
+void report( const std::string& step, unsigned int run, std::size_t items, double seconds ) {
+    std::cout << step << '\t' << run << '\t' << items << '\t' << seconds << '\t' << items/seconds << std::endl;
+}
+
+
+
+// all record sets of the alignments file as in taxator
+std::size_t parseRecordSets( const std::string& filename, StrIDConverter& seqid2taxid, const Taxonomy* tax, std::vector< RecordSetType >& rsets ) {
+    FactoryType fac( seqid2taxid, tax );
+    MappedFile file( filename );
+    MemoryParser< FactoryType > parser( file, fac );
+    boost::scoped_ptr< RecordSetGenerator< AlignmentRecordTaxonomy, RecordSetType > > recgen( newRecordSetGenerator< AlignmentRecordTaxonomy, RecordSetType >( parser, true, false ) );
+    std::size_t records = 0;
+    while ( recgen->notEmpty() ) {
+        rsets.push_back( RecordSetType() );
+        recgen->getNext( rsets.back() );
+        records += rsets.back().size();
+    }
+    return records;
+}
+
+
+
+// predicts all record sets and writes the predictions to output
+double predictAll( TaxonPredictionModel< RecordSetType >& predictor, std::vector< RecordSetType >& rsets, const Taxonomy* tax, std::ostream& output ) {
+    std::ostream null_sink( NULL );
+    PredictionRecord prec( tax );
+    double seconds = 0.;
+    for ( std::vector< RecordSetType >::iterator it = rsets.begin(); it != rsets.end(); ++it ) {
+        const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        predictor.predict( *it, prec, null_sink );
+        seconds += secondsSince( start );
+        output << prec;
+    }
+    return seconds;
+}
+
+
+
+int main( int argc, char** argv ) {
+    if ( argc < 2 ) {
+        std::cerr << "usage: " << argv[0] << " WORKLOAD-DIR [RUNS]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::string directory( argv[1] );
+    const unsigned int runs = argc > 2 ? boost::lexical_cast< unsigned int >( argv[2] ) : 3;
+
+    try {
+        std::vector< std::string > ranks = { "superkingdom", "phylum", "class", "order", "family", "genus", "species" };
+        boost::scoped_ptr< Taxonomy > tax( loadTaxonomyFromEnvironment( &ranks ) );
+        if ( ! tax ) return EXIT_FAILURE;
+        boost::scoped_ptr< StrIDConverter > seqid2taxid( loadStrIDConverterFromFile( directory + "/map.tax", 1000 ) );
+        RandomInmemorySeqStoreRO< StringType > query_storage( directory + "/query.fna" );
+        RandomInmemorySeqStoreRO< StringType > db_storage( directory + "/ref.fna" );
+
+        std::cout << "step\trun\titems\tseconds\titems/s" << std::endl;
+        for ( unsigned int run = 1; run <= runs; ++run ) {
+            std::vector< RecordSetType > rsets;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            const std::size_t records = parseRecordSets( directory + "/aln.tab", *seqid2taxid, tax.get(), rsets );
+            report( "parse", run, records, secondsSince( start ) );
+
+            // the MEGAN filters mark alignments in the record sets, so it runs last
+            std::ostringstream predictions;
+            {
+                RPAPredictionModel< RecordSetType, StorageType, StorageType > predictor( tax.get(), query_storage, db_storage, .5, .05, NULL, NULL, 0, DecisionLog::off );
+                report( "rpa", run, rsets.size(), predictAll( predictor, rsets, tax.get(), predictions ) );
+            }
+            {
+                AlignmentScoreCache score_cache( 100000 );
+                RPAPredictionModel< RecordSetType, StorageType, StorageType > predictor( tax.get(), query_storage, db_storage, .5, .05, &score_cache, NULL, 0, DecisionLog::off );
+                std::ostringstream cached_predictions;
+                report( "rpa-cache", run, rsets.size(), predictAll( predictor, rsets, tax.get(), cached_predictions ) );
+            }
+            {
+                MeganLCAPredictionModel< RecordSetType > predictor( tax.get(), false, .05, 0., 1, 1000. );
+                std::ostringstream megan_predictions;
+                report( "megan-lca", run, rsets.size(), predictAll( predictor, rsets, tax.get(), megan_predictions ) );
+            }
+            for ( std::vector< RecordSetType >::iterator it = rsets.begin(); it != rsets.end(); ++it ) deleteRecords( *it );
+
+            // segments of the same query are consecutive
+            std::istringstream input( predictions.str() );
+            PredictionFileParser< PredictionRecordBinning > parser( input, tax.get() );
+            boost::ptr_vector< boost::ptr_list< PredictionRecordBinning > > predictions_per_query;
+            for ( PredictionRecordBinning* rec = parser.next(); rec; rec = parser.next() ) {
+                if ( predictions_per_query.empty() || predictions_per_query.back().front().getQueryIdentifier() != rec->getQueryIdentifier() ) predictions_per_query.push_back( new boost::ptr_list< PredictionRecordBinning >() );
+                predictions_per_query.back().push_back( rec );
+            }
+            std::ostream null_sink( NULL );
+            std::size_t combined = 0;
+            start = std::chrono::steady_clock::now();
+            for ( boost::ptr_vector< boost::ptr_list< PredictionRecordBinning > >::iterator it = predictions_per_query.begin(); it != predictions_per_query.end(); ++it ) {
+                if ( it->size() < 2 ) continue;
+                boost::scoped_ptr< PredictionRecordBinning > prec( combinePredictionRanges( *it, tax.get(), .7, 50, null_sink ) );
+                ++combined;
+            }
+            report( "combine", run, combined, secondsSince( start ) );
+        }
+    } catch ( Exception& e ) {
+        std::cerr << "An unrecoverable error occurred: " << e.what() << std::endl << boost::diagnostic_information( e ) << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
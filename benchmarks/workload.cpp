@@ -0,0 +1,271 @@
+/*
+taxator-tk predicts the taxon for DNA sequences based on sequence alignment.
+
+Copyright (C) 2010 Johannes Dröge
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Generates a synthetic workload in a directory: a taxonomy with the seven major
+// ranks, a fanout of children per node and some intermediate nodes without rank
+// (tax/nodes.dmp, tax/names.dmp), one or two reference sequences per species which
+// evolve along the tree (ref.fna, map.tax) and query sequences sampled from the
+// references with alignments against up to the given number of references each
+// (query.fna, aln.tab). Some queries are aligned in two local segments. The output
+// only depends on the arguments. Prints one tab-separated line with the counts.
+// usage: benchmark-workload OUTDIR [queries] [hits per query] [fanout] [seed]
+
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/exception/diagnostic_information.hpp>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "../src/exception.hh"
+
+const char* const ranks[] = { "superkingdom", "phylum", "class", "order", "family", "genus", "species" };
+const std::size_t number_ranks = sizeof( ranks )/sizeof( ranks[0] );
+const std::size_t reference_length = 2000;
+const char bases[] = "ACGT";
+
+
+
+// the distributions of <random> differ between standard libraries, the engine does not
+std::size_t uniform( std::mt19937& rng, std::size_t n ) {
+    return rng() % n;
+}
+
+
+
+double uniform( std::mt19937& rng ) {
+    return rng()/4294967296.;
+}
+
+
+
+std::string mutate( const std::string& seq, double rate, std::mt19937& rng ) {
+    std::string mutated( seq );
+    for ( std::size_t i = 0; i < mutated.size(); ++i ) {
+        if ( uniform( rng ) < rate ) mutated[i] = bases[ uniform( rng, 4 ) ];
+    }
+    return mutated;
+}
+
+
+
+struct Reference {
+    std::string identifier;
+    std::size_t taxid;
+    std::string sequence;
+};
+
+
+
+class WorkloadGenerator {
+public:
+    WorkloadGenerator( const std::string& directory, std::size_t fanout, unsigned int seed ) :
+        directory_( directory ),
+        fanout_( fanout ),
+        rng_( seed ),
+        next_taxid_( 2 ),
+        number_alignments_( 0 )
+    {}
+
+    void generateTaxonomy() {
+        boost::filesystem::create_directories( directory_ + "/tax" );
+        open( nodes_, directory_ + "/tax/nodes.dmp" );
+        open( names_, directory_ + "/tax/names.dmp" );
+        std::ofstream references, mapping;
+        open( references, directory_ + "/ref.fna" );
+        open( mapping, directory_ + "/map.tax" );
+
+        writeNode( 1, 1, "no rank", "root" );
+        std::string ancestor( reference_length, 'A' );
+        for ( std::size_t i = 0; i < ancestor.size(); ++i ) ancestor[i] = bases[ uniform( rng_, 4 ) ];
+        grow( 1, 0, ancestor );
+
+        for ( std::vector< Reference >::const_iterator it = references_.begin(); it != references_.end(); ++it ) {
+            references << '>' << it->identifier << '\n';
+            for ( std::size_t i = 0; i < it->sequence.size(); i += 70 ) references << it->sequence.substr( i, 70 ) << '\n';
+            mapping << it->identifier << '\t' << it->taxid << '\n';
+        }
+        check( references, directory_ + "/ref.fna" );
+        check( mapping, directory_ + "/map.tax" );
+        check( nodes_, directory_ + "/tax/nodes.dmp" );
+        check( names_, directory_ + "/tax/names.dmp" );
+    }
+
+    // each query aligns against 1 to max_hits references including its source
+    void generateQueries( std::size_t number_queries, std::size_t max_hits ) {
+        std::ofstream queries, alignments;
+        open( queries, directory_ + "/query.fna" );
+        open( alignments, directory_ + "/aln.tab" );
+
+        std::vector< std::size_t > order( references_.size() );
+        for ( std::size_t i = 0; i < order.size(); ++i ) order[i] = i;
+        std::vector< std::string > lines;
+        char buffer[ 64 ];
+        for ( std::size_t q = 0; q < number_queries; ++q ) {
+            const Reference& source = references_[ uniform( rng_, references_.size() ) ];
+            const std::size_t length = 200 + uniform( rng_, 701 );
+            const std::size_t start = uniform( rng_, reference_length - length + 1 );
+            const std::string query = mutate( source.sequence.substr( start, length ), .03, rng_ );
+            std::snprintf( buffer, sizeof( buffer ), "q%07lu", static_cast< unsigned long >( q ) );
+            const std::string identifier( buffer );
+            queries << '>' << identifier << '\n' << query << '\n';
+
+            // partial shuffle, the first hits are a sample without replacement
+            const std::size_t hits = std::min( 1 + uniform( rng_, max_hits ), order.size() );
+            bool source_hit = false;
+            for ( std::size_t i = 0; i < hits; ++i ) {
+                std::swap( order[i], order[ i + uniform( rng_, order.size() - i ) ] );
+                source_hit |= &references_[ order[i] ] == &source;
+            }
+
+            const bool split = uniform( rng_ ) < .3;
+            lines.clear();
+            for ( std::size_t h = 0; h < hits; ++h ) {
+                const Reference& reference = h + 1 == hits && ! source_hit ? source : references_[ order[h] ];
+                for ( int segment = 0; segment < ( split ? 2 : 1 ); ++segment ) {
+                    std::size_t begin = split && segment ? length/2 + 10 : 0;
+                    std::size_t end = split && ! segment ? length/2 - 20 : length;
+                    begin += uniform( rng_, 11 );
+                    end -= uniform( rng_, 11 );
+                    std::size_t identities = 0;
+                    for ( std::size_t i = begin; i < end; ++i ) identities += query[i] == reference.sequence[ start + i ];
+                    const std::size_t span = end - begin;
+                    std::snprintf( buffer, sizeof( buffer ), "%.1f", identities*2. - span*.5 );
+                    lines.push_back( identifier + '\t' + boost::lexical_cast< std::string >( begin + 1 ) + '\t' + boost::lexical_cast< std::string >( end ) + '\t' + boost::lexical_cast< std::string >( length ) + '\t' + reference.identifier + '\t' + boost::lexical_cast< std::string >( start + begin + 1 ) + '\t' + boost::lexical_cast< std::string >( start + end ) + '\t' + buffer + "\t1e-30\t" + boost::lexical_cast< std::string >( identities ) + '\t' + boost::lexical_cast< std::string >( span ) + '\t' + boost::lexical_cast< std::string >( span ) + 'M' );
+                }
+            }
+
+            // alignments of a query are consecutive but not sorted
+            for ( std::size_t i = lines.size(); i > 1; --i ) std::swap( lines[ i - 1 ], lines[ uniform( rng_, i ) ] );
+            for ( std::vector< std::string >::const_iterator it = lines.begin(); it != lines.end(); ++it ) alignments << *it << '\n';
+            number_alignments_ += lines.size();
+        }
+        check( queries, directory_ + "/query.fna" );
+        check( alignments, directory_ + "/aln.tab" );
+    }
+
+    std::size_t numberTaxa() const {
+        return next_taxid_ - 1;
+    }
+
+    std::size_t numberReferences() const {
+        return references_.size();
+    }
+
+    std::size_t numberAlignments() const {
+        return number_alignments_;
+    }
+
+private:
+    void grow( std::size_t parent, std::size_t depth, const std::string& sequence ) {
+        for ( std::size_t i = 0; i < fanout_; ++i ) {
+            std::size_t node_parent = parent;
+            if ( depth && uniform( rng_ ) < .15 ) {
+                node_parent = next_taxid_++;
+                writeNode( node_parent, parent, "no rank", "norank " + boost::lexical_cast< std::string >( node_parent ) );
+            }
+            const std::size_t taxid = next_taxid_++;
+            writeNode( taxid, node_parent, ranks[ depth ], std::string( ranks[ depth ] ) + ' ' + boost::lexical_cast< std::string >( taxid ) );
+
+            const std::string evolved = mutate( sequence, .04, rng_ );
+            if ( depth + 1 < number_ranks ) grow( taxid, depth + 1, evolved );
+            else {
+                const std::size_t strains = 1 + uniform( rng_, 2 );
+                for ( std::size_t s = 0; s < strains; ++s ) {
+                    Reference reference;
+                    reference.identifier = "ref_" + boost::lexical_cast< std::string >( taxid ) + '_' + boost::lexical_cast< std::string >( s );
+                    reference.taxid = taxid;
+                    reference.sequence = mutate( evolved, .01, rng_ );
+                    references_.push_back( reference );
+                }
+            }
+        }
+    }
+
+    void writeNode( std::size_t taxid, std::size_t parent, const std::string& rank, const std::string& name ) {
+        nodes_ << taxid << "\t|\t" << parent << "\t|\t" << rank << "\t|\t\t|\n";
+        names_ << taxid << "\t|\t" << name << "\t|\t\t|\tscientific name\t|\n";
+        names_ << taxid << "\t|\tsynonym of " << taxid << "\t|\t\t|\tsynonym\t|\n";
+    }
+
+    static void open( std::ofstream& file, const std::string& filename ) {
+        file.open( filename.c_str() );
+        check( file, filename );
+    }
+
+    static void check( std::ofstream& file, const std::string& filename ) {
+        if ( file.is_open() ) file.flush();
+        if ( ! file ) BOOST_THROW_EXCEPTION( FileError {} << general_info {"could not write workload file"} << file_info { filename } );
+    }
+
+    const std::string directory_;
+    const std::size_t fanout_;
+    std::mt19937 rng_;
+    std::size_t next_taxid_;
+    std::size_t number_alignments_;
+    std::ofstream nodes_, names_;
+    std::vector< Reference > references_;
+};
+
+
+
+// lexical_cast wraps negative numbers around for unsigned types
+template< typename T >
+T parseCount( const char* arg ) {
+    if ( *arg == '-' ) throw boost::bad_lexical_cast();
+    return boost::lexical_cast< T >( arg );
+}
+
+
+int main( int argc, char** argv ) {
+    std::size_t queries = 0, hits = 0, fanout = 0;
+    unsigned int seed = 0;
+    try {
+        queries = argc > 2 ? parseCount< std::size_t >( argv[2] ) : 1000;
+        hits = argc > 3 ? parseCount< std::size_t >( argv[3] ) : 20;
+        fanout = argc > 4 ? parseCount< std::size_t >( argv[4] ) : 3;
+        seed = argc > 5 ? parseCount< unsigned int >( argv[5] ) : 42;
+    } catch ( boost::bad_lexical_cast& ) {
+        hits = 0;  // print usage
+    }
+    if ( argc < 2 || argc > 6 || *argv[1] == '-' || ! hits || ! fanout ) {  // also catches -h and --help
+        std::cerr << "usage: " << argv[0] << " OUTDIR [QUERIES] [HITS >= 1] [FANOUT >= 1] [SEED]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const std::string directory( argv[1] );
+
+    try {
+        WorkloadGenerator generator( directory, fanout, seed );
+        generator.generateTaxonomy();
+        generator.generateQueries( queries, hits );
+        std::cout << "taxa\treferences\tqueries\talignments" << std::endl;
+        std::cout << generator.numberTaxa() << '\t' << generator.numberReferences() << '\t' << queries << '\t' << generator.numberAlignments() << std::endl;
+    } catch ( Exception& e ) {
+        std::cerr << "An unrecoverable error occurred: " << e.what() << std::endl << boost::diagnostic_information( e ) << std::endl;
+        return EXIT_FAILURE;
+    } catch ( boost::filesystem::filesystem_error& e ) {
+        std::cerr << "An unrecoverable error occurred: " << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -18,7 +18,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 */
 
+#include <iomanip>
 #include <iostream>
+#include <set>
+#include <sstream>
 #include <stack>
 #include <boost/program_options/cmdline.hpp>
 #include <boost/program_options/options_description.hpp>
@@ -27,6 +30,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <boost/ptr_container/ptr_list.hpp>
 #include <boost/ptr_container/ptr_vector.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/bind.hpp>
 #include "boost/filesystem.hpp"
 #include "src/taxontree.hh"
 #include "src/ncbidata.hh"
@@ -37,17 +41,302 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "src/fastnodemap.hh"
 #include "src/exception.hh"
 #include "src/bioboxes.hh"
+#include "src/threadpool.hh"
+#include "src/compression.hh"
 
 using namespace std;
 
+
+
+// sample support of the taxa, a record supports the nodes on the path from its lower
+// node to the root with the maximum support at or below each node
+class SupportCounter {
+public:
+    // path adds the support of a record to each node on its path. subtree only adds
+    // the increases of the maximum support at the lower node and below the upper
+    // node, above which a record has no support, and sums them up for each subtree in
+    // aggregate(), so that the support of a node is the sum of these changes below it.
+    enum Method { path, subtree };
+
+    SupportCounter( TaxonomyInterface& taxinter, Method method = path ) :
+        taxinter_( taxinter ),
+        method_( method ),
+        root_node_( taxinter.getRoot() ),
+        support_( taxinter.getNumberNodes() ),
+        root_support_( support_[ root_node_ ] ),
+        minimum_support_found_( std::numeric_limits< large_unsigned_int >::max() )
+    {}
+
+    void add( const PredictionRecordBinning& prec ) {
+        if ( method_ == subtree ) addChanges( prec );
+        else addPath( prec );
+    }
+
+    // after all records were added and counters merged
+    void aggregate() {
+        if ( method_ == path ) return;
+        for ( large_unsigned_int i = taxinter_.getNumberNodes() - 1; i > 0; --i ) {  // children before parents
+            const TaxonNode* node = taxinter_.getNodeByPreorder( i );
+            const large_unsigned_int* value_found = support_.find( node );
+            if ( value_found ) support_[ node->parent ] += *value_found;
+        }
+    }
+
+    FastNodeMap< large_unsigned_int >& support() {
+        return support_;
+    }
+
+    large_unsigned_int rootSupport() const {
+        return root_support_;
+    }
+
+    large_unsigned_int minimumSupportFound() const {
+        return minimum_support_found_;
+    }
+
+    // adds the counts of other for the same taxonomy and method
+    void merge( const SupportCounter& other ) {
+        support_.add( other.support_ );
+        minimum_support_found_ = std::min( minimum_support_found_, other.minimum_support_found_ );
+    }
+
+private:
+    void addPath( const PredictionRecordBinning& prec ) {
+        Taxonomy::PathUpIterator pit = taxinter_.traverseUp( prec.getLowerNode() );
+
+        // process lowest node
+        large_unsigned_int total_node_support = prec.getSupportAt( &*pit );
+        minimum_support_found_ = std::min( minimum_support_found_, total_node_support );
+        large_unsigned_int* value_found = support_.find( &*pit );
+        if ( value_found ) *value_found += total_node_support;
+        else support_[ &*pit ] = total_node_support;
+
+        // process rest
+        if ( pit != root_node_ ) {
+            while ( ++pit != root_node_ ) {
+                total_node_support = std::max( total_node_support, prec.getSupportAt( &*pit ) );
+                large_unsigned_int* value_found = support_.find( &*pit );
+                if ( value_found ) *value_found += total_node_support;
+                else support_[ &*pit ] = total_node_support;
+            }
+            total_node_support = std::max( total_node_support, prec.getSupportAt( root_node_ ) );
+            root_support_ += total_node_support;
+        }
+    }
+
+    void addChanges( const PredictionRecordBinning& prec ) {
+        const TaxonNode* node = prec.getLowerNode();
+        large_unsigned_int total_node_support = prec.getSupportAt( node );
+        minimum_support_found_ = std::min( minimum_support_found_, total_node_support );
+        support_[ node ] += total_node_support;  // the lower node has a value even without support
+
+        const small_unsigned_int upper_depth = prec.getUpperNode()->data->root_pathlength;
+        while ( node != root_node_ && node->data->root_pathlength > upper_depth ) {
+            node = node->parent;
+            const large_unsigned_int node_support = prec.getSupportAt( node );
+            if ( node_support > total_node_support ) {
+                support_[ node ] += node_support - total_node_support;
+                total_node_support = node_support;
+            }
+        }
+    }
+
+    TaxonomyInterface& taxinter_;
+    const Method method_;
+    const TaxonNode* const root_node_;
+    FastNodeMap< large_unsigned_int > support_;
+    large_unsigned_int& root_support_;
+    large_unsigned_int minimum_support_found_;
+};
+
+
+
+// prunes and combines the ranges of single queries, the methods can be called by several threads
+class QueryBinner {
+public:
+    QueryBinner( const Taxonomy* tax, TaxonomyInterface& taxinter, float signal_majority_per_sequence, large_unsigned_int min_support_per_sequence, const map< const string*, float >& pid_per_rank ) :
+        tax_( tax ),
+        taxinter_( taxinter ),
+        signal_majority_per_sequence_( signal_majority_per_sequence ),
+        min_support_per_sequence_( min_support_per_sequence ),
+        pid_per_rank_( pid_per_rank ),
+        support_( NULL ),
+        min_support_in_sample_( 0 )
+    {}
+
+    // the sample support for pruning
+    void setSampleSupport( const FastNodeMap< large_unsigned_int >& support, large_unsigned_int min_support_in_sample ) {
+        support_ = &support;
+        min_support_in_sample_ = min_support_in_sample;
+    }
+
+    // shrinks the ranges of a query from the lower end to nodes with the minimum sample
+    // support, ranges without such a node are removed
+    void prune( boost::ptr_list< PredictionRecordBinning >& query, std::set< const TaxonNode* >& pruned_nodes ) const {
+        for ( boost::ptr_list< PredictionRecordBinning >::iterator prec_it = query.begin(); prec_it != query.end(); ) {
+            const TaxonNode* lower_node = prec_it->getLowerNode();
+            const TaxonNode* upper_node = prec_it->getUpperNode();
+
+            Taxonomy::PathUpIterator pit = taxinter_.traverseUp( lower_node );
+            while ( pit != upper_node && supportAt( &*pit ) < min_support_in_sample_ ) {
+                pruned_nodes.insert( &*pit );
+                ++pit;
+            }
+
+            if ( pit == upper_node && supportAt( &*pit ) < min_support_in_sample_ ) { //remove whole range
+                pruned_nodes.insert( &*pit );
+                prec_it = query.erase( prec_it ); //TODO: mask instead of delete
+                continue;
+            }
+
+            if ( pit != lower_node ) prec_it->pruneLowerNode( &*pit ); //prune
+            ++prec_it;
+        }
+    }
+
+    // combines the ranges of a query and writes the binning line
+    void bin( boost::ptr_list< PredictionRecordBinning >& query, std::ostream& binning_debug_output, BioboxesBinningFormat& binning_output ) const {
+        if( query.empty() ) return;
+        const TaxonNode* const root_node = taxinter_.getRoot();
+        std::vector<std::string> extra_cols(2);
+        boost::scoped_ptr< PredictionRecordBinning > prec_sptr;
+        const PredictionRecordBinning* prec;
+        if ( query.size() > 1 ) { //run combination algo for sequence segments
+            prec_sptr.reset( combinePredictionRanges( query, tax_, signal_majority_per_sequence_, min_support_per_sequence_, binning_debug_output ) );
+            prec = prec_sptr.get();
+        } else { // pass-through segment prediction for whole sequence
+            prec = &query.front();
+        }
+        // apply user-defined constrain
+        if ( prec->getUpperNode() != root_node && ! pid_per_rank_.empty() ) {
+            const double seqlen = static_cast< double >( prec->getQueryLength() );
+            float min_pid = 0.; //enforce consistency when walking down
+            map< const string*, float >::const_iterator find_it;
+            const TaxonNode* predict_node = root_node;
+            const TaxonNode* target_node = prec->getUpperNode();
+            const float rank_pid = prec->getSupportAt( target_node )/seqlen;
+            Taxonomy::CPathDownIterator pit = taxinter_.traverseDown<Taxonomy::CPathDownIterator>( target_node );
+            do {
+                pit++;
+                find_it = pid_per_rank_.find( &(pit->data->annotation->rank) );
+                if ( find_it != pid_per_rank_.end() ) min_pid = max( min_pid, find_it->second );
+                binning_debug_output << "constraint ctrl: " << rank_pid << " >= " << min_pid << " ?" << endl;
+                if ( rank_pid < min_pid ) break;
+                predict_node = &*pit;
+            } while ( pit != target_node );
+            extra_cols[0] = boost::lexical_cast<std::string>(prec->getSupportAt(predict_node));
+            extra_cols[1] = boost::lexical_cast<std::string>(prec->getQueryLength());
+            binning_output.writeBodyLine(prec->getQueryIdentifier(), boost::lexical_cast<std::string>(predict_node->data->taxid), extra_cols);
+        } else {
+            extra_cols[0] = boost::lexical_cast<std::string>(prec->getSupportAt(prec->getUpperNode()));
+            extra_cols[1] = boost::lexical_cast<std::string>(prec->getQueryLength());
+            binning_output.writeBodyLine(prec->getQueryIdentifier(), boost::lexical_cast<std::string>(prec->getUpperNode()->data->taxid), extra_cols);
+        }
+    }
+
+private:
+    large_unsigned_int supportAt( const TaxonNode* node ) const {
+        const large_unsigned_int* value_found = support_->find( node );
+        return value_found ? *value_found : 0;
+    }
+
+    const Taxonomy* tax_;
+    TaxonomyInterface& taxinter_;
+    const float signal_majority_per_sequence_;
+    const large_unsigned_int min_support_per_sequence_;
+    const map< const string*, float >& pid_per_rank_;
+    const FastNodeMap< large_unsigned_int >* support_;
+    large_unsigned_int min_support_in_sample_;
+};
+
+
+
+// counts the support of consecutive chunks of queries with one counter per chunk
+class ChunkCounting {
+public:
+    ChunkCounting( const boost::ptr_vector< boost::ptr_list< PredictionRecordBinning > >& predictions_per_query, boost::ptr_vector< SupportCounter >& counters ) :
+        predictions_per_query_( predictions_per_query ),
+        counters_( counters )
+    {}
+
+    void operator()( std::size_t chunk ) {
+        const std::size_t n = predictions_per_query_.size(), number_chunks = counters_.size();
+        for ( std::size_t i = chunk*n/number_chunks; i < ( chunk + 1 )*n/number_chunks; ++i ) {
+            const boost::ptr_list< PredictionRecordBinning >& query = predictions_per_query_[ i ];
+            for ( boost::ptr_list< PredictionRecordBinning >::const_iterator prec_it = query.begin(); prec_it != query.end(); ++prec_it ) counters_[ chunk ].add( *prec_it );
+        }
+    }
+
+private:
+    const boost::ptr_vector< boost::ptr_list< PredictionRecordBinning > >& predictions_per_query_;
+    boost::ptr_vector< SupportCounter >& counters_;
+};
+
+
+
+// prunes and bins batches of queries into separate output strings
+class BatchBinning {
+public:
+    BatchBinning( boost::ptr_vector< boost::ptr_list< PredictionRecordBinning > >& predictions_per_query, std::size_t first, std::size_t last, std::size_t batch_size, const QueryBinner& binner, bool prune ) :
+        predictions_per_query_( predictions_per_query ),
+        first_( first ),
+        last_( last ),
+        batch_size_( batch_size ),
+        binner_( binner ),
+        prune_( prune ),
+        output_( size() ),
+        debug_output_( size() ),
+        pruned_nodes_( size() )
+    {}
+
+    std::size_t size() const {
+        return ( last_ - first_ + batch_size_ - 1 )/batch_size_;
+    }
+
+    void operator()( std::size_t batch ) {
+        std::ostringstream output, debug_output;
+        debug_output << std::fixed << std::setprecision( 3 );
+        BioboxesBinningFormat binning_output( BioboxesBinningFormat::ColumnTags::taxid, output );
+        for ( std::size_t i = first_ + batch*batch_size_; i < std::min( first_ + ( batch + 1 )*batch_size_, last_ ); ++i ) {
+            if ( prune_ ) binner_.prune( predictions_per_query_[ i ], pruned_nodes_[ batch ] );
+            binner_.bin( predictions_per_query_[ i ], debug_output, binning_output );
+        }
+        output_[ batch ] = output.str();
+        debug_output_[ batch ] = debug_output.str();
+    }
+
+    // in input order
+    void write( std::ostream& output, std::ostream& debug_output, std::set< const TaxonNode* >& pruned_nodes ) const {
+        for ( std::size_t batch = 0; batch < size(); ++batch ) {
+            output << output_[ batch ];
+            debug_output << debug_output_[ batch ];
+            pruned_nodes.insert( pruned_nodes_[ batch ].begin(), pruned_nodes_[ batch ].end() );
+        }
+    }
+
+private:
+    boost::ptr_vector< boost::ptr_list< PredictionRecordBinning > >& predictions_per_query_;
+    const std::size_t first_;
+    const std::size_t last_;
+    const std::size_t batch_size_;
+    const QueryBinner& binner_;
+    const bool prune_;
+    std::vector< std::string > output_;
+    std::vector< std::string > debug_output_;
+    std::vector< std::set< const TaxonNode* > > pruned_nodes_;
+};
+
+
+
 int main ( int argc, char** argv ) {
 
     vector< string > ranks, files;
     bool delete_unmarked;
     large_unsigned_int min_support_in_sample( 0 );
     float signal_majority_per_sequence, min_support_in_sample_percentage( 0. );
-    string min_support_in_sample_str, log_filename, sample_identifier;
+    string min_support_in_sample_str, log_filename, sample_identifier, support_counting, output_compression_name;
     large_unsigned_int min_support_per_sequence;
+    uint number_threads, compression_threads;
     boost::ptr_vector< boost::ptr_list< PredictionRecordBinning > >::size_type num_queries_preallocation;
 
     namespace po = boost::program_options;
@@ -61,14 +350,19 @@ int main ( int argc, char** argv ) {
     ( "signal-majority,j", po::value< float >( &signal_majority_per_sequence )->default_value( .7 ), "minimum combined fraction of support for any single sequence (> 0.5 to be stable)" )
     ( "identity-constrain,i", po::value< vector< string > >(), "minimum required identity for this rank (e.g. -i species:0.8 -i genus:0.7)")
     ( "files,f", po::value< vector< string > >( &files )->multitoken(), "arbitrary number of prediction files (replaces standard input, use \"-\" to specify a combination of both)" )
-    ( "logfile,l", po::value< std::string >( &log_filename )->default_value( "binning.log" ), "specify name of file for logging (appending lines)" );
+    ( "logfile,l", po::value< std::string >( &log_filename )->default_value( "binning.log" ), "specify name of file for logging (appending lines)" )
+    ( "low-memory", "read a single prediction file twice instead of keeping all predictions in memory (predictions for the same sequence must be consecutive)" )
+    ( "processors,p", po::value< uint >( &number_threads )->default_value( 1 ), "number of threads for signal counting and binning without --low-memory, 0 uses all processors" )
+    ( "output-compression", po::value< std::string >( &output_compression_name )->default_value( "none" ), "compress the output with gzip, bgzf or zstd, compressed input is detected" )
+    ( "compression-threads", po::value< uint >( &compression_threads )->default_value( 1 ), "number of threads which decompress the input and compress BGZF and zstd output" );
 
     po::options_description hidden_options("Hidden options");
     hidden_options.add_options()
     ( "ranks,r", po::value< vector< string > >( &ranks )->multitoken(), "set ranks at which to do predictions" )
     ( "sample-min-support,m", po::value< std::string >( &min_support_in_sample_str )->default_value( "0" ), "minimum support in positions (>=1) or fraction of total support (<1) for any taxon" )
     ( "preallocate-num-queries", po::value< boost::ptr_vector< boost::ptr_list< PredictionRecordBinning > >::size_type >( & num_queries_preallocation )->default_value( 5000 ), "advanced parameter for better memory allocation, set to number of query sequences or similar (no need to be set)" )
-    ( "delete-notranks,d", po::value< bool >( &delete_unmarked )->default_value( true ), "delete all nodes that don't have any of the given ranks (make sure that input taxons are at those ranks)" );
+    ( "delete-notranks,d", po::value< bool >( &delete_unmarked )->default_value( true ), "delete all nodes that don't have any of the given ranks (make sure that input taxons are at those ranks)" )
+    ( "support-counting", po::value< std::string >( &support_counting )->default_value( "path" ), "count the sample support of taxa on the whole path of each prediction (path) or only where its support changes and sum up subtrees (subtree), both give the same values" );
 
     po::options_description all_options;
     all_options.add( visible_options ).add( hidden_options );
@@ -95,6 +389,24 @@ int main ( int argc, char** argv ) {
 
     if ( ! vm.count ( "ranks" ) ) ranks = default_ranks;
 
+    const bool low_memory = vm.count( "low-memory" );
+    if ( low_memory && ( files.size() != 1 || files.front() == "-" ) ) {
+        cerr << "The low-memory mode needs a single prediction file which can be read twice" << endl;
+        return EXIT_FAILURE;
+    }
+
+    if ( support_counting != "path" && support_counting != "subtree" ) {
+        cerr << "The support counting method must be path or subtree" << endl;
+        return EXIT_FAILURE;
+    }
+    const SupportCounter::Method counting_method = support_counting == "subtree" ? SupportCounter::subtree : SupportCounter::path;
+
+    CompressionFormat output_compression;
+    if ( ! parseCompressionFormat( output_compression_name, output_compression ) ) {
+        cerr << "The output compression must be none, gzip, bgzf or zstd (if supported by this build)" << endl;
+        return EXIT_FAILURE;
+    }
+
     // interpret given sample support
     if ( min_support_in_sample_str.find( '.' ) == std::string::npos ) min_support_in_sample = boost::lexical_cast< large_unsigned_int >( min_support_in_sample_str );
     else min_support_in_sample_percentage = boost::lexical_cast< float >( min_support_in_sample_str );
@@ -102,9 +414,8 @@ int main ( int argc, char** argv ) {
     set< string > additional_files;
 
     // create taxonomy
-    boost::scoped_ptr< Taxonomy > tax( loadTaxonomyFromEnvironment( &ranks ) );
+    boost::scoped_ptr< Taxonomy > tax( loadTaxonomyFromEnvironment( &ranks, ! ranks.empty() && delete_unmarked ) ); //collapse taxonomy to contain only specified ranks
     if( ! tax ) return EXIT_FAILURE;
-    if( ! ranks.empty() && delete_unmarked ) tax->deleteUnmarkedNodes(); //collapse taxonomy to contain only specified ranks
     TaxonomyInterface taxinter ( tax.get() );
 
     map< const string*, float > pid_per_rank;
@@ -127,232 +438,218 @@ int main ( int argc, char** argv ) {
         }
     }
 
+    if ( ! number_threads ) number_threads = std::max( boost::thread::hardware_concurrency(), 1u );
+
     try {
-        //STEP 0: PARSING INPUT
+        // the calling thread works as well
+        boost::scoped_ptr< ThreadPool > pool;
+        if ( number_threads > 1 && ! low_memory ) pool.reset( new ThreadPool( number_threads - 1 ) );
+
+        SupportCounter counter( taxinter, counting_method );
+        boost::ptr_vector< boost::ptr_list< PredictionRecordBinning > > predictions_per_query; //future owner of all dynamically allocated objects
 
-        // setup parser for primary input file (that determines the output order)
-        boost::scoped_ptr< PredictionFileParser< PredictionRecordBinning > > parse;
-        if ( files.empty() ) {
-            parse.reset( new PredictionFileParser< PredictionRecordBinning > ( std::cin, tax.get() ) );
+        if ( low_memory ) {
+            // PASS 1: only counting support of nodes
+            std::cerr << "analyzing sample composition by signal counting...";
+            PredictionFileParser< PredictionRecordBinning > parse( files.front(), tax.get(), compression_threads );
+            for ( PredictionRecordBinning* rec = parse.next(); rec; rec = parse.next() ) {
+                counter.add( *rec );
+                parse.destroyRecord( rec );
+            }
         } else {
-            vector< string >::iterator file_it = files.begin();
-            while( file_it != files.end() ) {
-                if( *file_it == "-" ) {
-                    parse.reset( new PredictionFileParser< PredictionRecordBinning > ( std::cin, tax.get() ) );
-                    ++file_it;
-                    break;
-                } else {
-                    if( boost::filesystem::exists( *file_it ) ) {
-                        parse.reset( new PredictionFileParser< PredictionRecordBinning > ( *file_it, tax.get() ) );
+            //STEP 0: PARSING INPUT
+
+            // setup parser for primary input file (that determines the output order)
+            boost::scoped_ptr< PredictionFileParser< PredictionRecordBinning > > parse;
+            if ( files.empty() ) {
+                parse.reset( new PredictionFileParser< PredictionRecordBinning > ( std::cin, tax.get(), compression_threads ) );
+            } else {
+                vector< string >::iterator file_it = files.begin();
+                while( file_it != files.end() ) {
+                    if( *file_it == "-" ) {
+                        parse.reset( new PredictionFileParser< PredictionRecordBinning > ( std::cin, tax.get(), compression_threads ) );
+                        ++file_it;
                         break;
                     } else {
-                        cerr << "Could not read file \"" << *file_it++ << "\"" << endl;
+                        if( boost::filesystem::exists( *file_it ) ) {
+                            parse.reset( new PredictionFileParser< PredictionRecordBinning > ( *file_it, tax.get(), compression_threads ) );
+                            break;
+                        } else {
+                            cerr << "Could not read file \"" << *file_it++ << "\"" << endl;
+                        }
                     }
                 }
-            }
-
-            if ( ! parse ) {
-                cerr << "There was no valid input file" << endl;
-                return EXIT_FAILURE;
-            }
 
-            // define additional input files
-            if ( file_it != files.end() ) {
-                const std::string& primary_file = *file_it;
-                do {
-                    if( boost::filesystem::exists( *file_it ) ) {
-                        additional_files.insert( *file_it );
-                    } else {
-                        cerr << "Could not read file \"" << *file_it << "\"" << endl;
-                    }
-                } while ( ++file_it != files.end() );
-                additional_files.erase( primary_file );
-            }
-        }
+                if ( ! parse ) {
+                    cerr << "There was no valid input file" << endl;
+                    return EXIT_FAILURE;
+                }
 
-        // parse primary input
-        // default output order corresponds to the first input file with additional records appended at the end
-        boost::ptr_vector< boost::ptr_list< PredictionRecordBinning > > predictions_per_query; //future owner of all dynamically allocated objects
-        predictions_per_query.reserve( num_queries_preallocation ); //avoid early re-allocation
-
-        {
-            if ( additional_files.empty() ) { //parse only primary file (predictions for same sequences must be consecutive!)
-                const std::string* prev_name = &empty_string;
-                boost::ptr_list< PredictionRecordBinning >* last_added_rec_list = NULL;
-                for ( PredictionRecordBinning* rec = parse->next(); rec; rec = parse->next() ) {
-                    if ( rec->getQueryIdentifier() != *prev_name ) {
-                        prev_name = &rec->getQueryIdentifier();
-                        // 					std::cerr << "new query: " << rec->getQueryIdentifier() << std::endl;
-                        // 					std::cerr << "entry output is: " << *rec;
-                        last_added_rec_list = new boost::ptr_list< PredictionRecordBinning >();
-                        predictions_per_query.push_back( last_added_rec_list );
-                    }
-                    last_added_rec_list->push_back( rec ); //will take ownership of the record
+                // define additional input files
+                if ( file_it != files.end() ) {
+                    const std::string& primary_file = *file_it;
+                    do {
+                        if( boost::filesystem::exists( *file_it ) ) {
+                            additional_files.insert( *file_it );
+                        } else {
+                            cerr << "Could not read file \"" << *file_it << "\"" << endl;
+                        }
+                    } while ( ++file_it != files.end() );
+                    additional_files.erase( primary_file );
                 }
-            } else { //parse additional
+            }
 
-                std::map< string, boost::ptr_list< PredictionRecordBinning >* > records_by_queryid; //TODO: use save mem trick
+            // parse primary input
+            // default output order corresponds to the first input file with additional records appended at the end
+            predictions_per_query.reserve( num_queries_preallocation ); //avoid early re-allocation
 
-                {   //parse primary in case of multiple files (with lookup!)
+            {
+                if ( additional_files.empty() ) { //parse only primary file (predictions for same sequences must be consecutive!)
                     const std::string* prev_name = &empty_string;
                     boost::ptr_list< PredictionRecordBinning >* last_added_rec_list = NULL;
                     for ( PredictionRecordBinning* rec = parse->next(); rec; rec = parse->next() ) {
-                        if ( rec->getQueryIdentifier() == *prev_name ) last_added_rec_list->push_back( rec ); //transfer ownership of record_container
-                        else {
+                        if ( rec->getQueryIdentifier() != *prev_name ) {
                             prev_name = &rec->getQueryIdentifier();
+                            // 					std::cerr << "new query: " << rec->getQueryIdentifier() << std::endl;
+                            // 					std::cerr << "entry output is: " << *rec;
+                            last_added_rec_list = new boost::ptr_list< PredictionRecordBinning >();
+                            predictions_per_query.push_back( last_added_rec_list );
+                        }
+                        last_added_rec_list->push_back( rec ); //will take ownership of the record
+                    }
+                } else { //parse additional
+
+                    std::map< string, boost::ptr_list< PredictionRecordBinning >* > records_by_queryid; //TODO: use save mem trick
+
+                    {   //parse primary in case of multiple files (with lookup!)
+                        const std::string* prev_name = &empty_string;
+                        boost::ptr_list< PredictionRecordBinning >* last_added_rec_list = NULL;
+                        for ( PredictionRecordBinning* rec = parse->next(); rec; rec = parse->next() ) {
+                            if ( rec->getQueryIdentifier() == *prev_name ) last_added_rec_list->push_back( rec ); //transfer ownership of record_container
+                            else {
+                                prev_name = &rec->getQueryIdentifier();
+                                std::map< string, boost::ptr_list< PredictionRecordBinning >* >::iterator find_it = records_by_queryid.find( rec->getQueryIdentifier() );
+                                if ( find_it != records_by_queryid.end() ) {
+                                    find_it->second->push_back( rec ); //transfer ownership
+                                } else {
+                                    last_added_rec_list = new boost::ptr_list< PredictionRecordBinning >();
+                                    predictions_per_query.push_back( last_added_rec_list ); //transfer ownership
+                                    records_by_queryid[ rec->getQueryIdentifier() ] = last_added_rec_list;
+                                    last_added_rec_list->push_back( rec ); //transfer ownership
+                                }
+                            }
+                        }
+                    }
+
+                    // parse additional files
+                    for (set< string >::const_iterator file_it = additional_files.begin(); file_it != additional_files.end(); ++file_it ) {
+                        PredictionFileParser< PredictionRecordBinning > parse( *file_it, tax.get(), compression_threads );
+                        boost::ptr_list< PredictionRecordBinning >* last_added_rec_list = NULL;
+                        for ( PredictionRecordBinning* rec = parse.next(); rec; rec = parse.next() ) {
                             std::map< string, boost::ptr_list< PredictionRecordBinning >* >::iterator find_it = records_by_queryid.find( rec->getQueryIdentifier() );
-                            if ( find_it != records_by_queryid.end() ) {
-                                find_it->second->push_back( rec ); //transfer ownership
-                            } else {
+                            if ( find_it == records_by_queryid.end() ) {
                                 last_added_rec_list = new boost::ptr_list< PredictionRecordBinning >();
                                 predictions_per_query.push_back( last_added_rec_list ); //transfer ownership
                                 records_by_queryid[ rec->getQueryIdentifier() ] = last_added_rec_list;
                                 last_added_rec_list->push_back( rec ); //transfer ownership
+                            } else {
+                                find_it->second->push_back( rec ); //transfer ownership
                             }
                         }
                     }
                 }
+            }
 
-                // parse additional files
-                for (set< string >::const_iterator file_it = additional_files.begin(); file_it != additional_files.end(); ++file_it ) {
-                    PredictionFileParser< PredictionRecordBinning > parse( *file_it, tax.get() );
-                    boost::ptr_list< PredictionRecordBinning >* last_added_rec_list = NULL;
-                    for ( PredictionRecordBinning* rec = parse.next(); rec; rec = parse.next() ) {
-                        std::map< string, boost::ptr_list< PredictionRecordBinning >* >::iterator find_it = records_by_queryid.find( rec->getQueryIdentifier() );
-                        if ( find_it == records_by_queryid.end() ) {
-                            last_added_rec_list = new boost::ptr_list< PredictionRecordBinning >();
-                            predictions_per_query.push_back( last_added_rec_list ); //transfer ownership
-                            records_by_queryid[ rec->getQueryIdentifier() ] = last_added_rec_list;
-                            last_added_rec_list->push_back( rec ); //transfer ownership
-                        } else {
-                            find_it->second->push_back( rec ); //transfer ownership
-                        }
-                    }
+            // STEP 1: RANGE PRUNING
+            // in this step the overall sample support for each node is recorded and each
+            // range is shrunk such that the remaining nodes have a minimum support (unit is bp)
+
+            //counting support of nodes
+            std::cerr << "analyzing sample composition by signal counting...";
+            if ( pool ) {  // one counter per chunk of queries, added up at the end
+                boost::ptr_vector< SupportCounter > counters;  // each with an array for all nodes
+                for ( std::size_t i = 0; i < number_threads; ++i ) counters.push_back( new SupportCounter( taxinter, counting_method ) );
+                ChunkCounting counting( predictions_per_query, counters );
+                pool->parallelFor( counters.size(), boost::ref( counting ) );
+                for ( boost::ptr_vector< SupportCounter >::const_iterator it = counters.begin(); it != counters.end(); ++it ) counter.merge( *it );
+            } else {
+                for ( boost::ptr_vector< boost::ptr_list< PredictionRecordBinning > >::iterator query_it = predictions_per_query.begin(); query_it != predictions_per_query.end(); ++query_it ) {
+                    for ( boost::ptr_list< PredictionRecordBinning >::iterator prec_it = query_it->begin(); prec_it != query_it->end(); ++prec_it ) counter.add( *prec_it );
                 }
             }
         }
+        counter.aggregate();
+        const FastNodeMap< large_unsigned_int >& support = counter.support();
+        std::cerr << " done: " << support.size() << " nested taxa with total support of " << counter.rootSupport() << " bp" << std::endl;
 
+        // if min_support_in_sample was given as fraction
+        if ( min_support_in_sample_percentage ) min_support_in_sample = counter.rootSupport()*min_support_in_sample_percentage;
+        const bool prune = counter.minimumSupportFound() < min_support_in_sample;
+        QueryBinner binner( tax.get(), taxinter, signal_majority_per_sequence, min_support_per_sequence, pid_per_rank );
+        binner.setSampleSupport( support, min_support_in_sample );
 
+        // STEP 2: BINNING
+        // in this step multiple ranges are combined into a single range by combining
+        // evidence for sub-ranges. This algorithm considers only support. Signal
+        // strength and interpolation values are ignored. This heuristic seems quite
+        // robust
+        std::ofstream binning_debug_output( log_filename.c_str() );
+        binning_debug_output << std::fixed << std::setprecision( 3 );  // same format for any part of the output
+        const std::vector<std::tuple<const std::string, const std::string>> custom_header_tags = {std::make_tuple("Version", program_version)};
+        const std::vector<std::string> custom_column_tags = {"Support", "Length"};
+        boost::scoped_ptr< CompressedOutputStream > compressed_output;
+        if ( output_compression != uncompressed ) compressed_output.reset( new CompressedOutputStream( STDOUT_FILENO, output_compression, compression_threads ) );
+        std::ostream& output = compressed_output ? *compressed_output : std::cout;
+        BioboxesBinningFormat binning_output(BioboxesBinningFormat::ColumnTags::taxid, sample_identifier, taxinter.getVersion(), output, "TaxatorTK", custom_header_tags, custom_column_tags);
+        std::set< const TaxonNode* > pruned_nodes;
 
-        // STEP 1: RANGE PRUNING
-        // in this step the overall sample support for each node is recorded and each
-        // range is shrunk such that the remaining nodes have a minimum support (unit is bp)
-
-        //counting support of nodes
-        std::cerr << "analyzing sample composition by signal counting...";
-        large_unsigned_int minimum_support_found = std::numeric_limits< large_unsigned_int >::max();
-        const TaxonNode* const root_node = taxinter.getRoot();
-        FastNodeMap< large_unsigned_int > support( taxinter.getMaxDepth() );
-        large_unsigned_int& root_support = support[ root_node ];
-        for ( boost::ptr_vector< boost::ptr_list< PredictionRecordBinning > >::iterator query_it = predictions_per_query.begin(); query_it != predictions_per_query.end(); ++query_it ) {
-            for ( boost::ptr_list< PredictionRecordBinning >::iterator prec_it = query_it->begin(); prec_it != query_it->end(); ++prec_it ) {
-                Taxonomy::PathUpIterator pit = taxinter.traverseUp( prec_it->getLowerNode() );
-
-                // process lowest node
-                large_unsigned_int total_node_support = prec_it->getSupportAt( &*pit );
-                minimum_support_found = std::min( minimum_support_found, total_node_support );
-                large_unsigned_int* value_found = support.find( &*pit );
-                if ( value_found ) *value_found += total_node_support;
-                else support[ &*pit ] = total_node_support;
-
-                // process rest
-                if ( pit != root_node ) {
-                    while ( ++pit != root_node ) {
-                        total_node_support = std::max( total_node_support, prec_it->getSupportAt( &*pit ) );
-                        large_unsigned_int* value_found = support.find( &*pit );
-                        if ( value_found ) *value_found += total_node_support;
-                        else support[ &*pit ] = total_node_support;
-                        // 				std::cerr << "after adding, node " << pit->data->annotation->name << " it has support " << support[ &*pit ] << std::endl;
-                    }
-                    total_node_support = std::max( total_node_support, prec_it->getSupportAt( root_node ) );
-                    root_support += total_node_support;
+        if ( low_memory ) {
+            // PASS 2: each query is pruned and binned when its predictions are complete
+            std::cerr << "noise removal and binning step...";
+            PredictionFileParser< PredictionRecordBinning > parse( files.front(), tax.get(), compression_threads );
+            boost::ptr_list< PredictionRecordBinning > query;
+            for ( PredictionRecordBinning* rec = parse.next(); ; rec = parse.next() ) {
+                if ( ! query.empty() && ( ! rec || rec->getQueryIdentifier() != query.front().getQueryIdentifier() ) ) {
+                    if ( prune ) binner.prune( query, pruned_nodes );
+                    binner.bin( query, binning_debug_output, binning_output );
+                    query.clear();
                 }
+                if ( ! rec ) break;
+                query.push_back( rec );
             }
+            std::cerr << " done: " << pruned_nodes.size() << " taxa were removed" << std::endl;
+            if ( compressed_output ) compressed_output->close();
+            return EXIT_SUCCESS;
         }
-        std::cerr << " done: " << support.size() << " nested taxa with total support of " << support[ root_node ] << " bp" << std::endl;
 
-        // if min_support_in_sample was given as fraction
-        if ( min_support_in_sample_percentage ) min_support_in_sample = support[ root_node ]*min_support_in_sample_percentage;
+        if ( pool ) {
+            // rounds of batches of queries are pruned and binned in parallel and written in input order
+            std::cerr << "noise removal and binning step...";
+            const std::size_t batch_size = 64, round_size = batch_size*16*number_threads;
+            for ( std::size_t first = 0; first < predictions_per_query.size(); first += round_size ) {
+                BatchBinning batches( predictions_per_query, first, std::min( first + round_size, predictions_per_query.size() ), batch_size, binner, prune );
+                pool->parallelFor( batches.size(), boost::ref( batches ) );
+                batches.write( output, binning_debug_output, pruned_nodes );
+            }
+            std::cerr << " done: " << pruned_nodes.size() << " taxa were removed" << std::endl;
+            if ( compressed_output ) compressed_output->close();
+            return EXIT_SUCCESS;
+        }
 
         // shrink ranges from lower end if support is smaller than the minimum required or if it does not comply with user-defined PID per rank.
         std::cerr << "noise removal...";
-        std::set< const TaxonNode* > pruned_nodes;
-        if ( minimum_support_found < min_support_in_sample ) {
-            for ( boost::ptr_vector< boost::ptr_list< PredictionRecordBinning > >::iterator query_it = predictions_per_query.begin(); query_it != predictions_per_query.end(); ++query_it ) {
-                for ( boost::ptr_list< PredictionRecordBinning >::iterator prec_it = query_it->begin(); prec_it != query_it->end(); ) {
-                    const TaxonNode* lower_node = prec_it->getLowerNode();
-                    const TaxonNode* upper_node = prec_it->getUpperNode();
-
-                    Taxonomy::PathUpIterator pit = taxinter.traverseUp( lower_node );
-                    while ( pit != upper_node && support[ &*pit ] < min_support_in_sample ) {
-                        pruned_nodes.insert( &*pit );
-                        ++pit;
-                    }
-
-                    if ( pit == upper_node && support[ &*pit ] < min_support_in_sample ) { //remove whole range
-                        pruned_nodes.insert( &*pit );
-                        prec_it = query_it->erase( prec_it ); //TODO: mask instead of delete
-                        continue;
-                    }
-
-                    if ( pit != lower_node ) prec_it->pruneLowerNode( &*pit ); //prune
-                    ++prec_it;
-                }
-            }
+        if ( prune ) {
+            for ( boost::ptr_vector< boost::ptr_list< PredictionRecordBinning > >::iterator query_it = predictions_per_query.begin(); query_it != predictions_per_query.end(); ++query_it ) binner.prune( *query_it, pruned_nodes );
         }
         std::cerr << " done: " << pruned_nodes.size() << " taxa were removed" << std::endl;
 
-        // STEP 2: BINNING
-        // in this step multiple ranges are combined into a single range by combining
-        // evidence for sub-ranges. This algorithm considers only support. Signal
-        // strength and interpolation values are ignored. This heuristic seems quite
-        // robust
-
         std::cerr << "binning step... ";
-        std::ofstream binning_debug_output( log_filename.c_str() );
-        const std::vector<std::tuple<const std::string, const std::string>> custom_header_tags = {std::make_tuple("Version", program_version)};
-        const std::vector<std::string> custom_column_tags = {"Support", "Length"};
-        std::vector<std::string> extra_cols(2);
-        BioboxesBinningFormat binning_output(BioboxesBinningFormat::ColumnTags::taxid, sample_identifier, taxinter.getVersion(), std::cout, "TaxatorTK", custom_header_tags, custom_column_tags);
-        
         for ( boost::ptr_vector< boost::ptr_list< PredictionRecordBinning > >::iterator it = predictions_per_query.begin(); it != predictions_per_query.end(); ++it ) {
-            if( it->empty() ) continue;
-            boost::scoped_ptr< PredictionRecordBinning > prec_sptr;
-            const PredictionRecordBinning* prec;
-            if ( it->size() > 1 ) { //run combination algo for sequence segments
-                prec_sptr.reset( combinePredictionRanges( *it, tax.get(), signal_majority_per_sequence, min_support_per_sequence, binning_debug_output ) );
-                prec = prec_sptr.get();
-            } else { // pass-through segment prediction for whole sequence
-                prec = &it->front();
-            }
-            // apply user-defined constrain
-            if ( prec->getUpperNode() != root_node && ! pid_per_rank.empty() ) {
-                const double seqlen = static_cast< double >( prec->getQueryLength() );
-                float min_pid = 0.; //enforce consistency when walking down
-                map< const string*, float >::const_iterator find_it;
-                const TaxonNode* predict_node = root_node;
-                const TaxonNode* target_node = prec->getUpperNode();
-                const float rank_pid = prec->getSupportAt( target_node )/seqlen;
-                Taxonomy::CPathDownIterator pit = taxinter.traverseDown<Taxonomy::CPathDownIterator>( target_node );
-                do {
-                    pit++;
-                    find_it = pid_per_rank.find( &(pit->data->annotation->rank) );
-                    if ( find_it != pid_per_rank.end() ) min_pid = max( min_pid, find_it->second );
-                    binning_debug_output << "constraint ctrl: " << rank_pid << " >= " << min_pid << " ?" << endl;
-                    if ( rank_pid < min_pid ) break;
-                    predict_node = &*pit;
-                } while ( pit != target_node );
-                extra_cols[0] = boost::lexical_cast<std::string>(prec->getSupportAt(predict_node));
-                extra_cols[1] = boost::lexical_cast<std::string>(prec->getQueryLength());
-                binning_output.writeBodyLine(prec->getQueryIdentifier(), predict_node->data->taxid, extra_cols);
-            } else {
-                extra_cols[0] = boost::lexical_cast<std::string>(prec->getSupportAt(prec->getUpperNode()));
-                extra_cols[1] = boost::lexical_cast<std::string>(prec->getQueryLength());
-                binning_output.writeBodyLine(prec->getQueryIdentifier(), prec->getUpperNode()->data->taxid, extra_cols);
-            }
+            binner.bin( *it, binning_debug_output, binning_output );
         }
         std::cerr << " done" << std::endl;
 
+        if ( compressed_output ) compressed_output->close();
         return EXIT_SUCCESS;
     } catch(Exception &e) {
         cerr << "An unrecoverable error occurred." << endl;
@@ -0,0 +1,84 @@
+/*
+taxator-tk predicts the taxon for DNA sequences based on sequence alignment.
+
+Copyright (C) 2010 Johannes Dröge
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <iostream>
+#include <string>
+#include <boost/program_options/cmdline.hpp>
+#include <boost/program_options/options_description.hpp>
+#include <boost/program_options/variables_map.hpp>
+#include <boost/program_options/parsers.hpp>
+#include "src/accessconv.hh"
+#include "src/packedsequencestore.hh"
+#include "src/queryblockindex.hh"
+#include "src/exception.hh"
+
+
+
+using namespace std;
+
+int main( int argc, char** argv ) {
+
+    string operation, input_filename, output_filename;
+
+    namespace po = boost::program_options;
+    po::options_description desc("Allowed options");
+    desc.add_options()
+    ( "help,h", "show help message")
+    ( "mode,m", po::value< string >( &operation )->default_value( "mapping" ), "choose mode:\n"
+                                          "\"mapping\": builds a hashed index of a seqid->taxid mapping file which can be used instead of the mapping file by all programs\n\n"
+                                          "\"sequences\": packs a FASTA file with 2 bits per nucleotide which can be used instead of the FASTA file by taxator\n\n"
+                                          "\"queries\": indexes the query blocks of an alignments file for taxator --shard (--shard-index)\n\n" )
+    ( "input,i", po::value< string >( &input_filename ), "input file name" )
+    ( "output,o", po::value< string >( &output_filename ), "output file name" );
+
+    po::variables_map vm;
+    po::store(po::command_line_parser( argc, argv ).options( desc ).run(), vm);
+    po::notify(vm);
+
+    if( vm.count( "help" ) ) {
+        cout << desc << endl;
+        return EXIT_SUCCESS;
+    }
+
+    if( input_filename.empty() || output_filename.empty() ) {
+        cerr << "Please specify input and output file names." << endl;
+        cout << desc << endl;
+        return EXIT_FAILURE;
+    }
+
+    try {
+        if( operation == "mapping" ) {
+            buildStrIDConverterIndex( input_filename, output_filename );
+        } else if( operation == "sequences" ) {
+            buildPackedSequenceFile( input_filename, output_filename );
+        } else if( operation == "queries" ) {
+            buildQueryBlockIndex( MappedFile( input_filename ), output_filename );
+        } else {
+            cerr << "unknown operation mode '" << operation << "' for --mode / -m" << endl;
+            return EXIT_FAILURE;
+        }
+    } catch( Exception &e ) {
+        cerr << "An unrecoverable error occurred: " << e.what() << endl;
+        cerr << endl << "Here is some debugging information to locate the problem:" << endl << boost::diagnostic_information(e) << endl;
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
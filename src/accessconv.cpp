@@ -1,5 +1,71 @@
 #include "accessconv.hh"
+#include <algorithm>
+#include <cstring>
 
 StrIDConverter* loadStrIDConverterFromFile( const std::string& filename, unsigned int cachesize ) { //TODO: remove depricated
+  if( boost::filesystem::exists( filename ) ) {
+    char magic[ sizeof( seqid_index_magic ) ] = {};
+    std::ifstream file( filename.c_str(), std::ios::binary );
+    file.read( magic, sizeof( magic ) );
+    if( file && ! std::memcmp( magic, seqid_index_magic, sizeof( magic ) ) ) return new StrIDConverterMappedIndex( filename );
+  }
   return loadAccessIDConverterFromFile< std::string >( filename, cachesize );
 }
+
+
+
+StrIDConverterMappedIndex::StrIDConverterMappedIndex( const std::string& index_filename ) : file_( index_filename, false ) {
+  boost::uint32_t header[2];  // format version and taxid encoding
+  if( file_.size() < sizeof( seqid_index_magic ) + sizeof( header ) || std::memcmp( file_.begin(), seqid_index_magic, sizeof( seqid_index_magic ) ) ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"not a sequence identifier index"} << file_info {index_filename} );
+  std::memcpy( header, file_.begin() + sizeof( seqid_index_magic ), sizeof( header ) );
+  if( header[0] != seqid_index_format_version ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"unsupported sequence identifier index version"} << file_info {index_filename} );
+  if( header[1] != seqid_index_taxid_encoding ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"sequence identifier index was built for another taxonomic ID type, rebuild it"} << file_info {index_filename} );
+  try {
+    index_.attach( file_.begin() + sizeof( seqid_index_magic ) + sizeof( header ), file_.end() );
+  } catch( ParsingError& e ) {
+    e << file_info {index_filename};
+    throw;
+  }
+}
+
+
+
+void buildStrIDConverterIndex( const std::string& flatfile_filename, const std::string& index_filename ) {
+  MappedFile flatfile( flatfile_filename );
+  HashIndexWriter writer;
+  std::string taxid_string;
+  TaxonID taxid = TaxonID();
+  uint line_number = 0;
+  for( const char* line = flatfile.begin(); line != flatfile.end(); ) {
+    const char* line_end = static_cast< const char* >( std::memchr( line, '\n', flatfile.end() - line ) );
+    if( ! line_end ) line_end = flatfile.end();
+    ++line_number;
+    const char* end = line_end != line && *( line_end - 1 ) == '\r' ? line_end - 1 : line_end;
+
+    if( line != end && *line != default_comment_symbol ) {
+      const char* sep = std::find( line, end, default_field_separator[0] );
+      const char* taxid_end = std::find( sep + ( sep != end ), end, default_field_separator[0] );
+      if( sep == end || sep + 1 == taxid_end ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"missing taxonomic ID"} << file_info {flatfile_filename} << line_info {line_number} );
+      taxid_string.assign( sep + 1, taxid_end );
+      if( ! parseTaxonID( taxid_string, taxid ) ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"bad taxonomic ID"} << file_info {flatfile_filename} << line_info {line_number} );
+#ifdef NUMERIC_TAXONID
+      writer.insert( line, sep - line, reinterpret_cast< const char* >( &taxid ), sizeof( taxid ) );
+#else
+      taxid_string.push_back( '\0' );
+      writer.insert( line, sep - line, taxid_string.data(), taxid_string.size() );
+#endif
+    }
+    line = line_end == flatfile.end() ? line_end : line_end + 1;
+  }
+
+  const std::string tmp_filename = index_filename + ".tmp";
+  {
+    std::ofstream out( tmp_filename.c_str(), std::ios::binary | std::ios::trunc );
+    const boost::uint32_t header[2] = { seqid_index_format_version, seqid_index_taxid_encoding };
+    out.write( seqid_index_magic, sizeof( seqid_index_magic ) );
+    out.write( reinterpret_cast< const char* >( header ), sizeof( header ) );
+    writer.write( out );
+    if( ! out ) BOOST_THROW_EXCEPTION( FileError {} << general_info {"could not write sequence identifier index"} << file_info {tmp_filename} );
+  }
+  boost::filesystem::rename( tmp_filename, index_filename );
+}
@@ -28,12 +28,26 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <list>
 #include <fstream>
 #include <boost/format.hpp>
+#include <cstring>
 #include <boost/lexical_cast.hpp>
 #include <boost/filesystem.hpp>
 #include "constants.hh"
 #include "types.hh"
 #include "utils.hh"
 #include "exception.hh"
+#include "hashindex.hh"
+#include "mappedfile.hh"
+
+
+
+// converts a taxonomic ID read from a file once at loading, false if it is not
+// valid in this build (numeric IDs must be unsigned numbers)
+inline bool parseTaxonID( const std::string& str, TaxonID& taxid ) {
+#ifdef NUMERIC_TAXONID
+    if( str.empty() || str[0] == '-' ) return false;  // lexical_cast wraps negative numbers
+#endif
+    return boost::conversion::try_lexical_convert( str, taxid );
+}
 
 
 
@@ -67,7 +81,10 @@ private:
         std::string line;
         std::ifstream flatfile( flatfile_filename.c_str() );
         TypeT acc;
+        TaxonID taxid = TaxonID();
+        uint line_number = 0;
         while( std::getline( flatfile, line ) ) {
+            ++line_number;
             if( ignoreLine( line ) ) {
                 continue;
             }
@@ -75,17 +92,11 @@ private:
             tokenizeSingleCharDelim( line, fields, default_field_separator, 2 );
             field_it = fields.begin();
 
-            try {
-                acc = boost::lexical_cast< TypeT >( *field_it );
-                ++field_it;
-                TaxonID taxid = boost::lexical_cast< TaxonID >( *field_it );
-                accessidconv[ acc ] = taxid;
-            } catch( boost::bad_lexical_cast &e ) {  // TODO: pass info via exception
-                std::cerr << "Could not parse line: " << line << ", skipping alignment." << std::endl;
-                std::cerr << "key:" << acc << std::endl;
-                std::cerr << "error parsing taxonomic ID: " << *field_it << std::endl;
-                throw e;
-            }
+            if( fields.size() < 2 ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"missing taxonomic ID"} << file_info {flatfile_filename} << line_info {line_number} );
+            if( ! boost::conversion::try_lexical_convert( *field_it, acc ) ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"bad identifier"} << file_info {flatfile_filename} << line_info {line_number} );
+            ++field_it;
+            if( ! parseTaxonID( *field_it, taxid ) ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"bad taxonomic ID"} << file_info {flatfile_filename} << line_info {line_number} );
+            accessidconv[ acc ] = taxid;
         }
         flatfile.close();
     };
@@ -110,7 +121,46 @@ typedef AccessIDConverter< std::string > StrIDConverter;
 typedef AccessIDConverterFlatfileMemory< std::string > StrIDConverterFlatfileMemory;
 
 
-// alias function (TODO: a function pointer might be better)
+
+// prebuilt hashed index of a mapping flatfile, the identifiers are looked up
+// directly in the mapped pages which are shared by all processes (thread-safe);
+// the taxonomic IDs are stored converted for the TaxonID type of the build
+const char seqid_index_magic[8] = { 'T', 'T', 'K', 'S', 'E', 'Q', 'I', 'D' };
+const boost::uint32_t seqid_index_format_version = 1;
+#ifdef NUMERIC_TAXONID
+const boost::uint32_t seqid_index_taxid_encoding = 1;  // native binary numbers
+#else
+const boost::uint32_t seqid_index_taxid_encoding = 0;  // zero-terminated strings
+#endif
+
+class StrIDConverterMappedIndex : public StrIDConverter {
+public:
+    StrIDConverterMappedIndex( const std::string& index_filename );
+
+    TaxonID operator[]( const std::string& acc ) {
+        const char* taxid = index_.find( acc );
+        if( ! taxid ) BOOST_THROW_EXCEPTION(TaxonMappingNotFound{} << seqid_info{acc} << file_info{file_.filename()});
+#ifdef NUMERIC_TAXONID
+        TaxonID id;
+        std::memcpy( &id, taxid, sizeof( id ) );
+        return id;
+#else
+        return TaxonID( taxid );
+#endif
+    }
+
+private:
+    MappedFile file_;
+    MappedHashIndex index_;
+};
+
+
+
+// writes the index for a mapping flatfile
+void buildStrIDConverterIndex( const std::string& flatfile_filename, const std::string& index_filename );
+
+
+// alias function (TODO: a function pointer might be better), detects index files by their magic bytes
 StrIDConverter* loadStrIDConverterFromFile( const std::string& filename, unsigned int cachesize = 0 );
 
 
@@ -26,6 +26,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <vector>
 #include <boost/tuple/tuple.hpp>
 #include <boost/tuple/tuple_comparison.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
 #include "types.hh"
 #include "utils.hh"
 #include "ncbidata.hh"
@@ -33,14 +35,32 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "taxonomyinterface.hh"
 #include "exception.hh"
 #include "fileparser.hh"
+#include "objectpool.hh"
+#include "stringinterner.hh"
+#include "profiling.hh"
 
 
 
+// Records are allocated from a pool and the identifier strings are shared: consecutive
+// records with the same query refer to a single copy of its identifier and the
+// reference identifiers are interned for the whole program run.
 class AlignmentRecord {
 public:
+    AlignmentRecord() : query_identifier_( emptyIdentifier() ), reference_identifier_( emptyIdentifier().get() ) {}
     virtual ~AlignmentRecord() {};
+
+    static void* operator new( std::size_t size ) {
+        if ( size != sizeof( AlignmentRecord ) ) return ::operator new( size );  // derived class
+        return ObjectPool< AlignmentRecord >::allocate();
+    }
+
+    static void operator delete( void* block, std::size_t size ) {
+        if ( size != sizeof( AlignmentRecord ) ) return ::operator delete( block );
+        ObjectPool< AlignmentRecord >::deallocate( block );
+    }
+
     inline const std::string& getQueryIdentifier() const {
-        return query_identifier_;
+        return *query_identifier_;
     };
     inline large_unsigned_int getQueryStart() const {
         return query_start_;
@@ -52,7 +72,7 @@ public:
         return query_length_;
     };
     inline const std::string& getReferenceIdentifier() const {
-        return reference_identifier_;
+        return *reference_identifier_;
     };
     inline large_unsigned_int getReferenceStart() const {
         return reference_start_;
@@ -93,66 +113,46 @@ public:
     }
 
     void parse( const std::string& line ) {
-        if (line.size() <= 1) BOOST_THROW_EXCEPTION(ParsingError {} << general_info {"alignment line too short"});
-        std::vector< std::string > fields;
-        if ( line[0] == '*' ) {
-            blacklist_this_ = true;
-            tokenizeSingleCharDelim( line.substr( 1 ), fields, default_field_separator, 12, false );
-        } else {
-            blacklist_this_ = false;
-            tokenizeSingleCharDelim( line, fields, default_field_separator, 12, false );
-        }
-        parse( fields );
+        parse( line.data(), line.data() + line.size() );
     }
 
-    virtual void parse( const std::vector< std::string >& fields ) {
-        if ( fields.size() >= 12 ) {
-            try {
-                query_start_ = boost::lexical_cast< large_unsigned_int >( fields[1] );
-                query_stop_ = boost::lexical_cast< large_unsigned_int >( fields[2] );
-
-                if( query_start_ > query_stop_ ) BOOST_THROW_EXCEPTION(ParsingError {} << general_info {"reverse query positions not allowed (only reference positions can be swapped to indicate the reverse complement, adjust input"});
-
-                query_length_ = boost::lexical_cast< large_unsigned_int >( fields[3] );
-
-                reference_start_ = boost::lexical_cast< large_unsigned_int >( fields[5] );
-                reference_stop_ = boost::lexical_cast< large_unsigned_int >( fields[6] );
-
-            } catch(boost::bad_lexical_cast&) {
-                BOOST_THROW_EXCEPTION(ParsingError {} << general_info {"bad position number or query length"});
-            }
-
-            try {
-                score_ = boost::lexical_cast< float >( fields[7] );
-            } catch(boost::bad_lexical_cast&) {
-                BOOST_THROW_EXCEPTION(ParsingError {} << general_info {"bad score"});
-            }
-
-            try {
-                evalue_ = boost::lexical_cast< double >( fields[8] );
-            } catch(boost::bad_lexical_cast&) {
-                BOOST_THROW_EXCEPTION(ParsingError {} << general_info {"bad E-value"});
-            }
-
-            try {
-                identities_ = boost::lexical_cast< large_unsigned_int >( fields[9] );
-            } catch(boost::bad_lexical_cast&) {
-                BOOST_THROW_EXCEPTION(ParsingError {} << general_info {"bad identity value"});
-            }
-
-            try {
-                alignment_length_ = boost::lexical_cast< large_unsigned_int >( fields[10] );
-            } catch(boost::bad_lexical_cast&) {
-                BOOST_THROW_EXCEPTION(ParsingError {} << general_info {"bad alignment length"});
+    // scans the fields in place, no allocation except for the identifier strings
+    virtual void parse( const char* begin, const char* end ) {
+        if ( end - begin <= 1 ) BOOST_THROW_EXCEPTION(ParsingError {} << general_info {"alignment line too short"});
+        if ( *begin == default_mask_symbol ) {
+            blacklist_this_ = true;
+            ++begin;
+        } else blacklist_this_ = false;
+
+        // field i is [field_begin[i], field_end[i]), text after a 12th TAB is ignored
+        const char* field_begin[12];
+        const char* field_end[12];
+        unsigned int num_fields = 0;
+        const char* pos = begin;
+        while ( num_fields < 12 ) {
+            const char* stop = static_cast< const char* >( std::memchr( pos, default_field_separator[0], end - pos ) );
+            field_begin[num_fields] = pos;
+            if ( ! stop ) {
+                field_end[num_fields++] = end;
+                break;
             }
+            field_end[num_fields++] = stop;
+            pos = stop + 1;
+        }
 
-            alignment_code_ = fields[11];
+        if ( num_fields < 12 ) BOOST_THROW_EXCEPTION(ParsingError {} << general_info {"bad number of fields in alignment line"});
 
-            // easy things that cannot go wrong
-            query_identifier_ = fields[0];
-            reference_identifier_ = fields[4];
+        if ( ! ( convertNumber( field_begin[1], field_end[1], query_start_ ) && convertNumber( field_begin[2], field_end[2], query_stop_ ) ) ) BOOST_THROW_EXCEPTION(ParsingError {} << general_info {"bad position number or query length"});
+        if( query_start_ > query_stop_ ) BOOST_THROW_EXCEPTION(ParsingError {} << general_info {"reverse query positions not allowed (only reference positions can be swapped to indicate the reverse complement, adjust input"});
+        if ( ! ( convertNumber( field_begin[3], field_end[3], query_length_ ) && convertNumber( field_begin[5], field_end[5], reference_start_ ) && convertNumber( field_begin[6], field_end[6], reference_stop_ ) ) ) BOOST_THROW_EXCEPTION(ParsingError {} << general_info {"bad position number or query length"});
+        if ( ! convertNumber( field_begin[7], field_end[7], score_ ) ) BOOST_THROW_EXCEPTION(ParsingError {} << general_info {"bad score"});
+        if ( ! convertNumber( field_begin[8], field_end[8], evalue_ ) ) BOOST_THROW_EXCEPTION(ParsingError {} << general_info {"bad E-value"});
+        if ( ! convertNumber( field_begin[9], field_end[9], identities_ ) ) BOOST_THROW_EXCEPTION(ParsingError {} << general_info {"bad identity value"});
+        if ( ! convertNumber( field_begin[10], field_end[10], alignment_length_ ) ) BOOST_THROW_EXCEPTION(ParsingError {} << general_info {"bad alignment length"});
 
-        } else BOOST_THROW_EXCEPTION(ParsingError {} << general_info {"bad number of fields in alignment line"});
+        alignment_code_.assign( field_begin[11], field_end[11] );
+        query_identifier_ = shareQueryIdentifier( field_begin[0], field_end[0] );
+        reference_identifier_ = &StringInterner::intern( field_begin[4], field_end[4] );
     }
 
     void print( std::ostream& strm = std::cout ) const {
@@ -160,11 +160,11 @@ public:
             strm << '*';
         }
 
-        strm << query_identifier_ << default_field_separator
+        strm << *query_identifier_ << default_field_separator
              << query_start_ << default_field_separator
              << query_stop_ << default_field_separator
              << query_length_ << default_field_separator
-             << reference_identifier_ << default_field_separator
+             << *reference_identifier_ << default_field_separator
              << reference_start_ << default_field_separator
              << reference_stop_ << default_field_separator
              << score_ << default_field_separator
@@ -176,8 +176,23 @@ public:
     }
 
 private:
-    std::string reference_identifier_;
-    std::string query_identifier_;
+    typedef boost::shared_ptr< const std::string > SharedString;
+
+    // reuse the identifier of the last record parsed by this thread if it is the same query
+    static SharedString shareQueryIdentifier( const char* begin, const char* end ) {
+        static thread_local SharedString last;
+        const std::size_t length = end - begin;
+        if ( ! last || last->size() != length || std::memcmp( last->data(), begin, length ) ) last = boost::make_shared< const std::string >( begin, end );
+        return last;
+    }
+
+    static const SharedString& emptyIdentifier() {
+        static const SharedString empty( boost::make_shared< const std::string >() );
+        return empty;
+    }
+
+    SharedString query_identifier_;
+    const std::string* reference_identifier_;
     large_unsigned_int query_start_;
     large_unsigned_int query_stop_;
     large_unsigned_int query_length_;
@@ -204,14 +219,27 @@ std::istream& operator>>( std::istream& strm, AlignmentRecord& rec );
 
 class AlignmentRecordTaxonomy : public AlignmentRecord {
 public:
-    AlignmentRecordTaxonomy( StrIDConverter& converter, const Taxonomy* tax ) : acc2taxid_( converter ), taxinter( tax ) {}
+    AlignmentRecordTaxonomy() : reference_node_( NULL ) {}
+
+    static void* operator new( std::size_t size ) {
+        if ( size != sizeof( AlignmentRecordTaxonomy ) ) return ::operator new( size );
+        return ObjectPool< AlignmentRecordTaxonomy >::allocate();
+    }
+
+    static void operator delete( void* block, std::size_t size ) {
+        if ( size != sizeof( AlignmentRecordTaxonomy ) ) return ::operator delete( block );
+        ObjectPool< AlignmentRecordTaxonomy >::deallocate( block );
+    }
 
-    void parse( const std::vector< std::string >& fields ) {
-        this->AlignmentRecord::parse( fields );
+    // the converter and taxonomy are passed by the factory to keep the records small
+    void parse( const char* begin, const char* end, StrIDConverter& acc2taxid, const TaxonomyInterface& taxinter ) {
+        this->AlignmentRecord::parse( begin, end );
 
+        ScopedStage measure_mapping( stage_mapping );
+        measure_mapping.addItems( 1 );
         TaxonID taxid;
         try {
-            taxid = acc2taxid_[getReferenceIdentifier()];
+            taxid = acc2taxid[getReferenceIdentifier()];
         }
         catch(Exception &e) {
             BOOST_THROW_EXCEPTION(e << general_info {"bad taxon mapping for alignment reference sequence"});
@@ -231,8 +259,6 @@ public:
 
 private:
     const TaxonNode* reference_node_;
-    StrIDConverter& acc2taxid_;
-    TaxonomyInterface taxinter;
 };
 
 
@@ -262,6 +288,17 @@ public:
         return rec;
     }
 
+    AlignmentRecord* create( const char* begin, const char* end ) {
+        AlignmentRecord* rec = new AlignmentRecord;
+        try {
+            rec->parse( begin, end );
+        } catch (Exception &e) {  // prevent memory leak
+            destroy(rec);
+            BOOST_THROW_EXCEPTION(e);
+        }
+        return rec;
+    }
+
     inline void destroy( const AlignmentRecord* rec ) { delete rec; }
 };
 
@@ -272,12 +309,16 @@ class AlignmentRecordFactory< AlignmentRecordTaxonomy > {
 public:
     typedef AlignmentRecordTaxonomy value_type;
     
-    AlignmentRecordFactory( StrIDConverter& acc2taxid, const Taxonomy* tax ) : acc2taxid_( acc2taxid ), tax_( tax ) {}
+    AlignmentRecordFactory( StrIDConverter& acc2taxid, const Taxonomy* tax ) : acc2taxid_( acc2taxid ), taxinter_( tax ) {}
     
     AlignmentRecordTaxonomy* create( const std::string& line ) {
-        AlignmentRecordTaxonomy* rec = new AlignmentRecordTaxonomy( acc2taxid_, tax_ );
+        return create( line.data(), line.data() + line.size() );
+    }
+
+    AlignmentRecordTaxonomy* create( const char* begin, const char* end ) {
+        AlignmentRecordTaxonomy* rec = new AlignmentRecordTaxonomy;
         try {
-            rec->AlignmentRecord::parse( line );
+            rec->parse( begin, end, acc2taxid_, taxinter_ );
         } catch (Exception &e) {  // prevent memory leak
             destroy(rec);
             BOOST_THROW_EXCEPTION(e);
@@ -288,7 +329,7 @@ public:
 private:
     inline void destroy( const AlignmentRecordTaxonomy* rec ) { delete rec; }
     StrIDConverter& acc2taxid_;
-    const Taxonomy* tax_;
+    const TaxonomyInterface taxinter_;
 };
 
 
@@ -302,6 +343,10 @@ public:
         return record_ ;
     };
 
+    // position in the input behind the query of the last record set (where the next
+    // query begins), 0 if the next record set belongs to the same query
+    virtual std::size_t queryEndOffset() const = 0;
+
 private:
     RecordType* record_;
 };
@@ -408,21 +453,23 @@ private:
 // };
 
 
-template<typename RecordType, typename RecordSetType, bool split_alignments>
+// the parser may be any type with the interface of FileParser, e.g. MemoryParser
+template<typename RecordType, typename RecordSetType, bool split_alignments, typename ParserType = FileParser< AlignmentRecordFactory< RecordType > > >
 class RecordSetGeneratorUnsorted;
 
 
-template<typename RecordType, typename RecordSetType>
-class RecordSetGeneratorUnsorted<RecordType, RecordSetType, true> : public RecordSetGenerator< RecordType, RecordSetType > {
+template<typename RecordType, typename RecordSetType, typename ParserType>
+class RecordSetGeneratorUnsorted<RecordType, RecordSetType, true, ParserType> : public RecordSetGenerator< RecordType, RecordSetType > {
 public:
-    typedef FileParser< AlignmentRecordFactory< RecordType> > ParserType;
     RecordSetGeneratorUnsorted(ParserType& parser);
     void getNext(RecordSetType& rset);
     bool notEmpty();
+    std::size_t queryEndOffset() const { return ranges.empty() ? record_offset_ : 0; }
 
 private:
     ParserType& parser_;
     RecordType* record_;
+    std::size_t record_offset_;  // position of record_ or the end
     const std::string* last_query_id_;
     typedef typename RecordSetType::value_type AlignmentRecordTypePtr;
     std::vector< boost::tuple< large_unsigned_int, large_unsigned_int, AlignmentRecordTypePtr > > ranges;
@@ -433,8 +480,9 @@ private:
 
 
 // specialization which splits the alignments
-template< typename RecordType, typename RecordSetType >
-RecordSetGeneratorUnsorted<RecordType, RecordSetType, true>::RecordSetGeneratorUnsorted(ParserType& parser) : parser_(parser) {
+template< typename RecordType, typename RecordSetType, typename ParserType >
+RecordSetGeneratorUnsorted<RecordType, RecordSetType, true, ParserType>::RecordSetGeneratorUnsorted(ParserType& parser) : parser_(parser) {
+        record_offset_ = parser_.offset();
         if (parser_.eof()) {
             record_ = NULL;
             last_query_id_ = NULL;
@@ -446,20 +494,21 @@ RecordSetGeneratorUnsorted<RecordType, RecordSetType, true>::RecordSetGeneratorU
 }
 
 
-template< typename RecordType, typename RecordSetType >
-bool RecordSetGeneratorUnsorted<RecordType, RecordSetType, true>::notEmpty() {
+template< typename RecordType, typename RecordSetType, typename ParserType >
+bool RecordSetGeneratorUnsorted<RecordType, RecordSetType, true, ParserType>::notEmpty() {
         return (record_ || (ranges.size() > tmpindex_));
 }
 
 
-template<typename RecordType, typename RecordSetType>
-void RecordSetGeneratorUnsorted<RecordType, RecordSetType, true>::getNext(RecordSetType& rset) {
+template< typename RecordType, typename RecordSetType, typename ParserType >
+void RecordSetGeneratorUnsorted<RecordType, RecordSetType, true, ParserType>::getNext(RecordSetType& rset) {
     if(ranges.empty()) {  // read new query
         if(record_) {  // always true unless called on empty input
             const std::string& query_id = *last_query_id_;
             ranges.push_back(boost::make_tuple(record_->getQueryStart(), record_->getQueryStop(), record_));
 
             while(true) {
+                record_offset_ = parser_.offset();
                 if(parser_.eof()) {
                     record_ = NULL;
                     break;
@@ -503,24 +552,26 @@ void RecordSetGeneratorUnsorted<RecordType, RecordSetType, true>::getNext(Record
 
 
 // specialization which doesn't split the alignments
-template<typename RecordType, typename RecordSetType>
-class RecordSetGeneratorUnsorted<RecordType, RecordSetType, false> : public RecordSetGenerator< RecordType, RecordSetType > {
+template<typename RecordType, typename RecordSetType, typename ParserType>
+class RecordSetGeneratorUnsorted<RecordType, RecordSetType, false, ParserType> : public RecordSetGenerator< RecordType, RecordSetType > {
 public:
-    typedef FileParser< AlignmentRecordFactory< RecordType> > ParserType;
     RecordSetGeneratorUnsorted(ParserType& parser);
     void getNext(RecordSetType& rset);
     bool notEmpty();
+    std::size_t queryEndOffset() const { return record_offset_; }
 
 private:
     ParserType& parser_;
     RecordType* record_;
+    std::size_t record_offset_;  // position of record_ or the end
     const std::string* last_query_id_;
 
 };
 
 
-template< typename RecordType, typename RecordSetType >
-RecordSetGeneratorUnsorted<RecordType, RecordSetType, false>::RecordSetGeneratorUnsorted(ParserType& parser) : parser_(parser) {
+template< typename RecordType, typename RecordSetType, typename ParserType >
+RecordSetGeneratorUnsorted<RecordType, RecordSetType, false, ParserType>::RecordSetGeneratorUnsorted(ParserType& parser) : parser_(parser) {
+    record_offset_ = parser_.offset();
     if (parser_.eof()) {
         record_ = NULL;
         last_query_id_ = NULL;
@@ -532,19 +583,20 @@ RecordSetGeneratorUnsorted<RecordType, RecordSetType, false>::RecordSetGenerator
 }
 
     
-template< typename RecordType, typename RecordSetType >
-bool RecordSetGeneratorUnsorted<RecordType, RecordSetType, false>::notEmpty() {
+template< typename RecordType, typename RecordSetType, typename ParserType >
+bool RecordSetGeneratorUnsorted<RecordType, RecordSetType, false, ParserType>::notEmpty() {
         return record_ ;
 }
 
 
-template< typename RecordType, typename RecordSetType >
-void RecordSetGeneratorUnsorted< RecordType, RecordSetType, false >::getNext(RecordSetType& rset) {
+template< typename RecordType, typename RecordSetType, typename ParserType >
+void RecordSetGeneratorUnsorted<RecordType, RecordSetType, false, ParserType>::getNext(RecordSetType& rset) {
     if(record_) {  // always true unless called on empty input
         const std::string& query_id = *last_query_id_;
         rset.push_back(record_);
 
         while(true) {
+            record_offset_ = parser_.offset();
             if(parser_.eof()) {
                 record_ = NULL;
                 break;
@@ -564,12 +616,11 @@ void RecordSetGeneratorUnsorted< RecordType, RecordSetType, false >::getNext(Rec
 }
 
 
-template< typename RecordType, typename RecordSetType, bool split_alignments >
+template< typename RecordType, typename RecordSetType, bool split_alignments, typename ParserType = FileParser< AlignmentRecordFactory< RecordType > > >
 class RecordSetGeneratorSorted : public RecordSetGenerator< RecordType, RecordSetType > {
 public:
-    typedef FileParser< AlignmentRecordFactory< RecordType> > ParserType;
-
     RecordSetGeneratorSorted( ParserType& parser ) : parser_(parser) {
+        record_offset_ = query_end_offset_ = parser_.offset();
         if (parser_.eof()) {
             record_ = NULL;
             last_query_id_ = NULL;
@@ -585,6 +636,7 @@ public:
     void getNext( RecordSetType& rset ) {
         typedef typename RecordSetType::value_type AlignmentRecordTypePtr;
 
+        query_end_offset_ = 0;
         while( record_ ) {  // TODO: rework
             AlignmentRecordTypePtr record = record_;
             const std::string& query_id = *last_query_id_;
@@ -603,32 +655,59 @@ public:
                         rstop_ = std::max( record->getQueryStop() , rstop_ );
                         last_query_id_ = &(record->getQueryIdentifier());
                         rset.push_back(record);
+                        record_offset_ = parser_.offset();
                         if (parser_.eof()) record_ = NULL;
                         else record_ = parser_.next();
                     }
                 }
-                else rset.push_back(record);
+                else {
+                    rset.push_back(record);
+                    record_offset_ = parser_.offset();
+                    if (parser_.eof()) record_ = NULL;
+                    else record_ = parser_.next();
+                }
             }
             else {  // new recordset
                 last_query_id_ = &(record->getQueryIdentifier());
                 rstop_ = stop;
+                query_end_offset_ = record_offset_;
                 return;
             }
         }
+        query_end_offset_ = record_offset_;  // end of input
     }
 
     bool notEmpty() {
         return record_;
     };
 
+    std::size_t queryEndOffset() const {
+        return query_end_offset_;
+    }
+
 private:
     ParserType& parser_;
     RecordType* record_;
+    std::size_t record_offset_;  // position of record_ or the end
     const std::string* last_query_id_;
     large_unsigned_int rstop_;
+    std::size_t query_end_offset_;
 };
 
 
+// chooses the generator implementation at run-time because template parameters must be const
+template< typename RecordType, typename RecordSetType, typename ParserType >
+RecordSetGenerator< RecordType, RecordSetType >* newRecordSetGenerator( ParserType& parser, bool split_alignments, bool alignments_sorted ) {
+    if (alignments_sorted) {
+        if (split_alignments) return new RecordSetGeneratorSorted<RecordType, RecordSetType, true, ParserType>( parser );
+        return new RecordSetGeneratorSorted<RecordType, RecordSetType, false, ParserType>( parser );
+    }
+    if (split_alignments) return new RecordSetGeneratorUnsorted<RecordType, RecordSetType, true, ParserType>( parser );
+    return new RecordSetGeneratorUnsorted<RecordType, RecordSetType, false, ParserType>( parser );
+}
+
+
+
 template< typename ContainerT1, typename ContainerT2 >
 void records2Nodes( const ContainerT1& recordset, const TaxonomyInterface& taxinter, StrIDConverter& acc2taxid, ContainerT2& refnodes ) {
     typename ContainerT1::const_iterator it = recordset.begin();
@@ -662,5 +741,22 @@ void deleteRecords( ContainerT& recordset ) {
 }
 
 
+
+// deletes the records of a set on scope exit unless they were handed over
+template< typename ContainerT >
+class ScopedRecords {
+public:
+    ScopedRecords( ContainerT& recordset ) : recordset_( &recordset ) {}
+    ~ScopedRecords() { if( recordset_ ) deleteRecords( *recordset_ ); }
+    void release() { recordset_ = NULL; }
+
+private:
+    ScopedRecords( const ScopedRecords& );
+    ScopedRecords& operator=( const ScopedRecords& );
+
+    ContainerT* recordset_;
+};
+
+
 #endif // alignmentrecord_hh_
 
@@ -0,0 +1,235 @@
+#include "alignmentscorecache.hh"
+#include "exception.hh"
+#include <boost/functional/hash.hpp>
+#include <boost/lexical_cast.hpp>
+#ifdef SCORECACHE_SQLITE3
+#include "sqlite3pp.hh"
+#endif
+
+
+
+std::string alignmentSegmentKey( const std::string& id, bool reverse, large_unsigned_int start, large_unsigned_int stop ) {
+    std::string key( id );
+    key += reverse ? "\t-\t" : "\t+\t";
+    key += boost::lexical_cast< std::string >( start );
+    key += '\t';
+    key += boost::lexical_cast< std::string >( stop );
+    return key;
+}
+
+
+
+std::string alignmentPairKey( const std::string& segment_a, const std::string& segment_b ) {
+    const bool ordered = segment_a < segment_b;  // edit distance is symmetric
+    std::string key( ordered ? segment_a : segment_b );
+    key += '\n';
+    key += ordered ? segment_b : segment_a;
+    return key;
+}
+
+
+
+AlignmentScoreCache::AlignmentScoreCache( std::size_t capacity, std::size_t number_shards ) :
+    number_shards_( number_shards ),
+    shard_capacity_( ( capacity + number_shards - 1 )/number_shards ),
+    shards_( new Shard[ number_shards ] )
+{}
+
+
+
+AlignmentScoreCache::Shard& AlignmentScoreCache::shard( const std::string& key ) const {
+    return shards_[ boost::hash< std::string >()( key ) % number_shards_ ];
+}
+
+
+
+bool AlignmentScoreCache::find( const std::string& key, AlignmentPairScore& score ) {
+    if ( ! shard_capacity_ ) return false;
+    Shard& s = shard( key );
+    boost::mutex::scoped_lock lock( s.mutex );
+    ++s.lookups;
+    boost::unordered_map< std::string, Shard::EntryList::iterator >::const_iterator it = s.index.find( key );
+    if ( it == s.index.end() ) return false;
+    ++s.hits;
+    s.entries.splice( s.entries.begin(), s.entries, it->second );
+    score = it->second->second;
+    return true;
+}
+
+
+
+void AlignmentScoreCache::insert( const std::string& key, const AlignmentPairScore& score ) {
+    if ( ! shard_capacity_ ) return;
+    Shard& s = shard( key );
+    boost::mutex::scoped_lock lock( s.mutex );
+    boost::unordered_map< std::string, Shard::EntryList::iterator >::iterator it = s.index.find( key );
+    if ( it != s.index.end() ) {
+        it->second->second = score;
+        s.entries.splice( s.entries.begin(), s.entries, it->second );
+        return;
+    }
+    if ( s.index.size() == shard_capacity_ ) {
+        s.index.erase( s.entries.back().first );
+        s.entries.pop_back();
+    }
+    s.entries.push_front( std::make_pair( key, score ) );
+    s.index[ key ] = s.entries.begin();
+}
+
+
+
+std::size_t AlignmentScoreCache::size() const {
+    std::size_t n = 0;
+    for ( std::size_t i = 0; i < number_shards_; ++i ) {
+        boost::mutex::scoped_lock lock( shards_[i].mutex );
+        n += shards_[i].index.size();
+    }
+    return n;
+}
+
+
+
+boost::uint64_t AlignmentScoreCache::lookups() const {
+    boost::uint64_t n = 0;
+    for ( std::size_t i = 0; i < number_shards_; ++i ) {
+        boost::mutex::scoped_lock lock( shards_[i].mutex );
+        n += shards_[i].lookups;
+    }
+    return n;
+}
+
+
+
+boost::uint64_t AlignmentScoreCache::hits() const {
+    boost::uint64_t n = 0;
+    for ( std::size_t i = 0; i < number_shards_; ++i ) {
+        boost::mutex::scoped_lock lock( shards_[i].mutex );
+        n += shards_[i].hits;
+    }
+    return n;
+}
+
+
+
+#ifdef SCORECACHE_SQLITE3
+
+namespace {
+
+void checkSQLite( sqlite3pp::database& db, int rc ) {
+    if ( rc != SQLITE_OK ) throw sqlite3pp::database_error( db );
+}
+
+
+
+const char* const score_cache_format = "taxator-tk pair scores 1";
+
+
+
+std::string metaValue( sqlite3pp::database& db, const char* name ) {
+    sqlite3pp::query q( db, "SELECT value FROM meta WHERE name = ?" );
+    q.bind( 1, name, false );
+    for ( sqlite3pp::query::iterator it = q.begin(); it != q.end(); ++it ) return ( *it ).get< std::string >( 0 );
+    return std::string();
+}
+
+
+
+// sets up an empty database, other databases are only used if they were written by us
+void openScoreTables( sqlite3pp::database& db, const std::string& filename ) {
+    int tables = 0, meta_tables = 0;
+    {
+        sqlite3pp::query q( db, "SELECT count(*), count(CASE WHEN name = 'meta' THEN 1 END) FROM sqlite_master WHERE type = 'table'" );
+        for ( sqlite3pp::query::iterator it = q.begin(); it != q.end(); ++it ) {
+            tables = ( *it ).get< int >( 0 );
+            meta_tables = ( *it ).get< int >( 1 );
+        }
+    }
+    if ( ! tables ) {
+        checkSQLite( db, db.execute( "CREATE TABLE meta (name TEXT PRIMARY KEY, value TEXT)" ) );
+        checkSQLite( db, db.execute( "CREATE TABLE pair_scores (pair TEXT PRIMARY KEY, score INTEGER, length INTEGER)" ) );
+        sqlite3pp::command set_format( db, "INSERT INTO meta (name, value) VALUES ('format', ?)" );
+        set_format.bind( 1, score_cache_format, false );
+        checkSQLite( db, set_format.execute() );
+    } else if ( ! meta_tables || metaValue( db, "format" ) != score_cache_format ) {
+        BOOST_THROW_EXCEPTION( FileError {} << general_info {"not an alignment score cache"} << file_info { filename } );
+    }
+}
+
+}
+
+
+
+bool AlignmentScoreCache::persistent() {
+    return true;
+}
+
+
+
+std::size_t AlignmentScoreCache::load( const std::string& filename, const std::string& reference ) {
+    std::size_t n = 0;
+    try {
+        sqlite3pp::database db( filename.c_str() );
+        openScoreTables( db, filename );
+        if ( metaValue( db, "reference" ) != reference ) return 0;
+
+        sqlite3pp::query q( db, "SELECT pair, score, length FROM pair_scores" );
+        for ( sqlite3pp::query::iterator it = q.begin(); it != q.end() && n < number_shards_*shard_capacity_; ++it, ++n ) {
+            insert( ( *it ).get< std::string >( 0 ), AlignmentPairScore( ( *it ).get< int >( 1 ), ( *it ).get< sqlite3_int64 >( 2 ) ) );
+        }
+    } catch ( sqlite3pp::database_error& e ) {
+        BOOST_THROW_EXCEPTION( FileError {} << general_info { e.what() } << file_info { filename } );
+    }
+    return n;
+}
+
+
+
+void AlignmentScoreCache::save( const std::string& filename, const std::string& reference ) const {
+    try {
+        sqlite3pp::database db( filename.c_str() );
+        openScoreTables( db, filename );
+        sqlite3pp::transaction xct( db );
+        checkSQLite( db, db.execute( "DELETE FROM pair_scores" ) );  // file mirrors the cache, entries loaded before are in memory
+        {
+            sqlite3pp::command set_reference( db, "INSERT OR REPLACE INTO meta (name, value) VALUES ('reference', ?)" );
+            set_reference.bind( 1, reference.c_str(), false );
+            checkSQLite( db, set_reference.execute() );
+        }
+        {
+            sqlite3pp::command insert_score( db, "INSERT OR REPLACE INTO pair_scores (pair, score, length) VALUES (?, ?, ?)" );
+            for ( std::size_t i = 0; i < number_shards_; ++i ) {
+                boost::mutex::scoped_lock lock( shards_[i].mutex );
+                for ( Shard::EntryList::const_iterator it = shards_[i].entries.begin(); it != shards_[i].entries.end(); ++it ) {
+                    insert_score.bind( 1, it->first.c_str(), false );
+                    insert_score.bind( 2, it->second.distance );
+                    insert_score.bind( 3, static_cast< sqlite3_int64 >( it->second.length ) );
+                    checkSQLite( db, insert_score.execute() );
+                    insert_score.reset();
+                }
+            }
+        }
+        checkSQLite( db, xct.commit() );
+    } catch ( sqlite3pp::database_error& e ) {
+        BOOST_THROW_EXCEPTION( FileError {} << general_info { e.what() } << file_info { filename } );
+    }
+}
+
+#else
+
+bool AlignmentScoreCache::persistent() {
+    return false;
+}
+
+
+
+std::size_t AlignmentScoreCache::load( const std::string& filename, const std::string& ) {
+    BOOST_THROW_EXCEPTION( GeneralError {} << general_info {"built without SQLite, alignment scores cannot be stored"} << file_info { filename } );
+}
+
+
+
+void AlignmentScoreCache::save( const std::string& filename, const std::string& ) const {
+    BOOST_THROW_EXCEPTION( GeneralError {} << general_info {"built without SQLite, alignment scores cannot be stored"} << file_info { filename } );
+}
+
+#endif
@@ -0,0 +1,149 @@
+/*
+taxator-tk predicts the taxon for DNA sequences based on sequence alignment.
+
+Copyright (C) 2010 Johannes Dröge
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef alignmentscorecache_hh_
+#define alignmentscorecache_hh_
+
+#include <list>
+#include <string>
+#include <utility>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+#include "types.hh"
+
+// Edit distances between pairs of reference segments as used in RPA. A segment is
+// identified by the reference sequence, the strand and its range (1-based, after
+// extension to the query range), a pair by its two segments in any order.
+std::string alignmentSegmentKey( const std::string& id, bool reverse, large_unsigned_int start, large_unsigned_int stop );
+
+std::string alignmentPairKey( const std::string& segment_a, const std::string& segment_b );
+
+
+
+// The edit distance of a pair and the length of its longer segment, which RPA needs
+// besides the distance and would otherwise have to retrieve the segments for.
+struct AlignmentPairScore {
+    AlignmentPairScore() : distance( 0 ), length( 0 ) {};
+    AlignmentPairScore( int d, large_unsigned_int l ) : distance( d ), length( l ) {};
+
+    int distance;
+    large_unsigned_int length;
+};
+
+
+
+// Process-wide cache which can be used by several threads. It is split into shards
+// with a lock each and holds at most capacity pairs, the least recently used ones
+// are evicted first.
+class AlignmentScoreCache : boost::noncopyable {
+public:
+    AlignmentScoreCache( std::size_t capacity, std::size_t number_shards = 64 );
+
+    bool find( const std::string& key, AlignmentPairScore& score );
+
+    void insert( const std::string& key, const AlignmentPairScore& score );
+
+    std::size_t size() const;
+
+    boost::uint64_t lookups() const;
+
+    boost::uint64_t hits() const;
+
+    // Persistent storage in an SQLite database (if built with SQLite). The reference
+    // string identifies the reference sequences, entries stored for other references
+    // are not loaded and replaced on save. Returns the number of loaded pairs.
+    std::size_t load( const std::string& filename, const std::string& reference );
+
+    void save( const std::string& filename, const std::string& reference ) const;
+
+    static bool persistent();
+
+private:
+    struct Shard {
+        Shard() : lookups( 0 ), hits( 0 ) {};
+
+        typedef std::list< std::pair< std::string, AlignmentPairScore > > EntryList;  // most recently used first
+        mutable boost::mutex mutex;
+        EntryList entries;
+        boost::unordered_map< std::string, EntryList::iterator > index;
+        boost::uint64_t lookups;
+        boost::uint64_t hits;
+    };
+
+    Shard& shard( const std::string& key ) const;
+
+    const std::size_t number_shards_;
+    const std::size_t shard_capacity_;
+    boost::scoped_array< Shard > shards_;
+};
+
+
+
+// Layer for a single record set which answers repeated pairs without locking and
+// passes everything else on to the process-wide cache (if any).
+class AlignmentScoreCacheLayer : boost::noncopyable {
+public:
+    AlignmentScoreCacheLayer( AlignmentScoreCache* shared ) : shared_( shared ), lookups_( 0 ), hits_( 0 ), shared_hits_( 0 ) {};
+
+    bool find( const std::string& key, AlignmentPairScore& score ) {
+        ++lookups_;
+        boost::unordered_map< std::string, AlignmentPairScore >::const_iterator it = scores_.find( key );
+        if ( it != scores_.end() ) {
+            ++hits_;
+            score = it->second;
+            return true;
+        }
+        if ( shared_ && shared_->find( key, score ) ) {
+            ++shared_hits_;
+            scores_[ key ] = score;
+            return true;
+        }
+        return false;
+    }
+
+    void insert( const std::string& key, const AlignmentPairScore& score ) {
+        scores_[ key ] = score;
+        if ( shared_ ) shared_->insert( key, score );
+    }
+
+    boost::uint64_t lookups() const {
+        return lookups_;
+    }
+
+    boost::uint64_t hits() const {
+        return hits_;
+    }
+
+    boost::uint64_t sharedHits() const {
+        return shared_hits_;
+    }
+
+private:
+    AlignmentScoreCache* shared_;
+    boost::unordered_map< std::string, AlignmentPairScore > scores_;
+    boost::uint64_t lookups_;
+    boost::uint64_t hits_;
+    boost::uint64_t shared_hits_;
+};
+
+#endif // alignmentscorecache_hh_
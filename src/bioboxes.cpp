@@ -27,6 +27,11 @@ BioboxesBinningFormat::BioboxesBinningFormat(
 }
 
 
+BioboxesBinningFormat::BioboxesBinningFormat(const BioboxesBinningFormat::ColumnTags cols, std::ostream& ostr)
+        : ostr_(ostr), cols_(cols)
+{}
+
+
 BioboxesBinningFormat::~BioboxesBinningFormat()
 {
     ostr_ << std::flush;
@@ -44,6 +44,9 @@ public:
         const std::vector<std::string> custom_column_tags = std::vector<std::string>()  // TODO: easier syntax?
         );
     
+    // without header, for parts of the body which are joined later
+    BioboxesBinningFormat(const ColumnTags cols, std::ostream& ostr);
+    
     ~BioboxesBinningFormat();
     
     void writeBodyLine(
@@ -0,0 +1,130 @@
+/*
+taxator-tk predicts the taxon for DNA sequences based on sequence alignment.
+
+Copyright (C) 2010 Johannes Dröge
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef checkpoint_hh_
+#define checkpoint_hh_
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include "exception.hh"
+#include "mappedfile.hh"
+
+// Progress of a taxator run on an alignments file so that a stopped run can
+// continue behind the last query whose predictions were completely written. A
+// checkpoint holds the position in the alignments file where the next query begins
+// and the length of the output up to that query. The output is synced to disk
+// before the checkpoint file is replaced, so a checkpoint never refers to output
+// that was lost. Checkpoints are saved at most every interval seconds: the writer
+// of the output asks due() after a query and then calls save().
+class Checkpoint : boost::noncopyable {
+public:
+    Checkpoint( const std::string& filename, const MappedFile& input, unsigned int interval_seconds, int output_fd = STDOUT_FILENO ) :
+        filename_( filename ),
+        input_( input ),
+        interval_( interval_seconds ),
+        output_fd_( output_fd ),
+        next_save_( std::chrono::steady_clock::now() + interval_ ),
+        resumed_( false )
+    {
+        struct stat output;
+        if ( fstat( output_fd_, &output ) || ! S_ISREG( output.st_mode ) ) BOOST_THROW_EXCEPTION( FileError {} << general_info {"checkpoints need the output written to a file"} );
+    }
+
+    // Continues from the saved checkpoint: truncates the output, which must be the
+    // file of the earlier run, to the saved length and returns the position in the
+    // alignments file to read from, which is within the selected part of the file.
+    std::size_t resume() {
+        std::ifstream file( filename_.c_str() );
+        if ( ! file ) BOOST_THROW_EXCEPTION( FileNotFound {} << general_info {"no checkpoint to resume from"} << file_info {filename_} );
+        std::string format, key;
+        unsigned int version = 0;
+        std::size_t input_size = 0, input_offset = 0;
+        std::time_t input_mtime = 0;
+        off_t output_length = 0;
+        file >> format >> version >> key >> input_size >> key >> input_mtime >> key >> input_offset >> key >> output_length;
+        if ( ! file || format != magic_ || version != version_ ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"invalid checkpoint file"} << file_info {filename_} );
+        if ( input_size != input_.fileSize() || input_mtime != boost::filesystem::last_write_time( input_.filename() ) ) BOOST_THROW_EXCEPTION( FileError {} << general_info {"the alignments file differs from the one of the checkpoint"} << file_info {input_.filename()} );
+        if ( input_offset < input_.offset( input_.begin() ) || input_offset > input_.offset( input_.end() ) ) BOOST_THROW_EXCEPTION( FileError {} << general_info {"the checkpoint belongs to another part of the alignments file"} << file_info {filename_} );
+
+        struct stat output;
+        if ( fstat( output_fd_, &output ) || output.st_size < output_length ) BOOST_THROW_EXCEPTION( FileError {} << general_info {"the output must be appended to the output file of the checkpoint"} );
+        if ( ftruncate( output_fd_, output_length ) || lseek( output_fd_, 0, SEEK_END ) < 0 ) BOOST_THROW_EXCEPTION( FileError {} << general_info {"could not truncate the output to the checkpoint"} );
+        resumed_ = true;
+        return input_offset;
+    }
+
+    // the output continues the one of an earlier run
+    bool resumed() const {
+        return resumed_;
+    }
+
+    bool due() const {
+        return std::chrono::steady_clock::now() >= next_save_;
+    }
+
+    // input_offset is the position in the alignments file behind the last query of
+    // which all predictions have been written to the output file descriptor, only
+    // the last pending_bytes of the output belong to the following queries
+    void save( std::size_t input_offset, std::size_t pending_bytes = 0 ) {
+        struct stat output;
+        if ( fsync( output_fd_ ) || fstat( output_fd_, &output ) || output.st_size < static_cast< off_t >( pending_bytes ) ) BOOST_THROW_EXCEPTION( FileError {} << general_info {"could not sync the output for a checkpoint"} );
+
+        const std::string tmp_filename = filename_ + ".tmp";
+        {
+            std::ofstream file( tmp_filename.c_str() );
+            file << magic_ << '\t' << version_ << '\n'
+                 << "alignments-size\t" << input_.fileSize() << '\n'
+                 << "alignments-mtime\t" << boost::filesystem::last_write_time( input_.filename() ) << '\n'  // a file of the same size might be regenerated
+                 << "alignments-offset\t" << input_offset << '\n'
+                 << "output-length\t" << output.st_size - pending_bytes << '\n';
+            file.close();
+            if ( ! file ) BOOST_THROW_EXCEPTION( FileError {} << general_info {"could not write checkpoint"} << file_info {tmp_filename} );
+        }
+        const int fd = ::open( tmp_filename.c_str(), O_RDONLY );
+        const bool synced = fd >= 0 && ! fsync( fd );
+        if ( fd >= 0 ) ::close( fd );
+        if ( ! synced || std::rename( tmp_filename.c_str(), filename_.c_str() ) ) BOOST_THROW_EXCEPTION( FileError {} << general_info {"could not replace checkpoint"} << file_info {filename_} );
+        next_save_ = std::chrono::steady_clock::now() + interval_;
+    }
+
+    // after all predictions for the input are written
+    void finish() {
+        save( input_.offset( input_.end() ) );
+    }
+
+private:
+    const std::string filename_;
+    const MappedFile& input_;
+    const std::chrono::seconds interval_;
+    const int output_fd_;
+    std::chrono::steady_clock::time_point next_save_;
+    bool resumed_;
+    static constexpr const char* magic_ = "taxator-checkpoint";
+    static const unsigned int version_ = 1;
+};
+
+#endif // checkpoint_hh_
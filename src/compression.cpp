@@ -0,0 +1,618 @@
+#include "compression.hh"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <boost/bind.hpp>
+#include <zlib.h>
+#ifdef COMPRESSION_ZSTD
+#include <zstd.h>
+#endif
+#include "exception.hh"
+#include "threadpool.hh"
+
+
+
+namespace {
+
+const std::size_t piece_size = 1 << 20;  // decompressed bytes per piece
+const std::size_t pieces_ahead = 2;
+const std::size_t gzip_chunk_size = 1 << 16;
+const std::size_t bgzf_block_input = 0xff00;  // uncompressed bytes per block as in samtools
+const std::size_t bgzf_max_block = 1 << 16;
+const std::size_t bgzf_header_size = 18;
+const std::size_t bgzf_blocks_per_thread = 16;
+const unsigned char bgzf_eof[28] = { 0x1f, 0x8b, 0x08, 0x04, 0, 0, 0, 0, 0, 0xff, 0x06, 0, 'B', 'C', 0x02, 0, 0x1b, 0, 0x03, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+
+
+inline std::size_t getUint16( const char* data ) {
+    const unsigned char* bytes = reinterpret_cast< const unsigned char* >( data );
+    return bytes[0] | bytes[1] << 8;
+}
+
+
+
+inline std::size_t getUint32( const char* data ) {
+    const unsigned char* bytes = reinterpret_cast< const unsigned char* >( data );
+    return static_cast< std::size_t >( bytes[0] | bytes[1] << 8 | bytes[2] << 16 ) | static_cast< std::size_t >( bytes[3] ) << 24;
+}
+
+
+
+inline void putUint32( char* data, std::size_t value ) {
+    for ( int i = 0; i < 4; ++i ) data[i] = ( value >> 8*i ) & 0xff;
+}
+
+
+
+// the bytes read for the detection of the format before the rest of the source
+class Source {
+public:
+    Source( const std::string& prefix, std::streambuf* source ) : prefix_( prefix ), position_( 0 ), source_( source ) {}
+
+    // fewer than size bytes only at the end
+    std::size_t read( char* data, std::size_t size ) {
+        std::size_t n = std::min( size, prefix_.size() - position_ );
+        std::memcpy( data, prefix_.data() + position_, n );
+        position_ += n;
+        while ( n < size ) {
+            const std::streamsize m = source_->sgetn( data + n, size - n );
+            if ( m <= 0 ) break;
+            n += m;
+        }
+        return n;
+    }
+
+private:
+    const std::string prefix_;
+    std::size_t position_;
+    std::streambuf* const source_;
+};
+
+
+
+class PlainDecoder : public Decoder {
+public:
+    PlainDecoder( const std::string& prefix, std::streambuf* source ) : source_( prefix, source ) {}
+
+    bool decode( std::string& out ) {
+        out.resize( piece_size );
+        out.resize( source_.read( &out[0], out.size() ) );
+        return ! out.empty();
+    }
+
+private:
+    Source source_;
+};
+
+
+
+// concatenated gzip members, also BGZF in a single thread
+class GzipDecoder : public Decoder {
+public:
+    GzipDecoder( const std::string& prefix, std::streambuf* source ) : source_( prefix, source ), input_( gzip_chunk_size ), source_ended_( false ), member_ended_( true ) {
+        std::memset( &stream_, 0, sizeof( stream_ ) );
+        if ( inflateInit2( &stream_, 15 + 16 ) != Z_OK ) BOOST_THROW_EXCEPTION( GeneralError {} << general_info {"could not initialize gzip decompression"} );
+    }
+
+    ~GzipDecoder() {
+        inflateEnd( &stream_ );
+    }
+
+    bool decode( std::string& out ) {
+        out.resize( piece_size );
+        stream_.next_out = reinterpret_cast< Bytef* >( &out[0] );
+        stream_.avail_out = out.size();
+        while ( stream_.avail_out ) {
+            if ( ! stream_.avail_in && ! source_ended_ ) {
+                stream_.next_in = reinterpret_cast< Bytef* >( &input_[0] );
+                stream_.avail_in = source_.read( &input_[0], input_.size() );
+                source_ended_ = ! stream_.avail_in;
+            }
+            if ( member_ended_ ) {
+                if ( ! stream_.avail_in ) break;  // end of the data
+                inflateReset( &stream_ );
+                member_ended_ = false;
+            }
+            const int status = inflate( &stream_, Z_NO_FLUSH );
+            if ( status == Z_STREAM_END ) member_ended_ = true;
+            else if ( status == Z_BUF_ERROR ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"truncated gzip data"} );  // no input left
+            else if ( status != Z_OK ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"invalid gzip data"} );
+        }
+        out.resize( out.size() - stream_.avail_out );
+        return ! out.empty();
+    }
+
+private:
+    Source source_;
+    std::vector< char > input_;
+    z_stream stream_;
+    bool source_ended_;
+    bool member_ended_;
+};
+
+
+
+// reads blocks for all threads and decompresses them directly into their place in the piece
+class BgzfDecoder : public Decoder {
+public:
+    BgzfDecoder( const std::string& prefix, std::streambuf* source, unsigned int number_threads ) : source_( prefix, source ), blocks_( bgzf_blocks_per_thread*number_threads ), offsets_( blocks_.size() + 1 ), output_( NULL ) {
+        if ( number_threads > 1 ) pool_.reset( new ThreadPool( number_threads - 1 ) );
+    }
+
+    bool decode( std::string& out ) {
+        std::size_t n = 0;
+        while ( n < blocks_.size() && readBlock( blocks_[ n ] ) ) {
+            offsets_[ n + 1 ] = offsets_[ n ] + getUint32( &blocks_[ n ][ blocks_[ n ].size() - 4 ] );
+            ++n;
+        }
+        out.resize( offsets_[ n ] );
+        output_ = &out[0];
+        if ( pool_ ) pool_->parallelFor( n, boost::bind( &BgzfDecoder::decompressBlock, this, _1 ) );
+        else for ( std::size_t i = 0; i < n; ++i ) decompressBlock( i );
+        return n;
+    }
+
+private:
+    bool readBlock( std::string& block ) {
+        block.resize( 12 );
+        const std::size_t n = source_.read( &block[0], 12 );
+        if ( ! n ) return false;
+        if ( n < 12 || detectCompression( block.data(), n ) != gzip || ! ( block[3] & 4 ) ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"invalid BGZF block"} );
+
+        // size of the block in the BC subfield of the extra field
+        const std::size_t header_size = 12 + getUint16( &block[10] );
+        block.resize( header_size );
+        if ( source_.read( &block[12], header_size - 12 ) < header_size - 12 ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"truncated BGZF data"} );
+        std::size_t block_size = 0;
+        for ( std::size_t pos = 12; pos + 4 <= header_size; pos += 4 + getUint16( &block[ pos + 2 ] ) ) {
+            if ( block[ pos ] == 'B' && block[ pos + 1 ] == 'C' && getUint16( &block[ pos + 2 ] ) == 2 && pos + 6 <= header_size ) block_size = getUint16( &block[ pos + 4 ] ) + 1;
+        }
+        if ( block_size < header_size + 8 || block_size > bgzf_max_block ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"invalid BGZF block"} );
+
+        block.resize( block_size );
+        if ( source_.read( &block[ header_size ], block_size - header_size ) < block_size - header_size ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"truncated BGZF data"} );
+        if ( getUint32( &block[ block_size - 4 ] ) > bgzf_max_block ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"invalid BGZF block"} );  // the output is allocated by this size
+        return true;
+    }
+
+    void decompressBlock( std::size_t i ) {
+        const std::string& block = blocks_[ i ];
+        const std::size_t header_size = 12 + getUint16( &block[10] );
+        const std::size_t size = offsets_[ i + 1 ] - offsets_[ i ];
+        char* out = output_ + offsets_[ i ];
+        if ( ! size ) return;  // empty block at the end
+
+        z_stream stream;
+        std::memset( &stream, 0, sizeof( stream ) );
+        if ( inflateInit2( &stream, -15 ) != Z_OK ) BOOST_THROW_EXCEPTION( GeneralError {} << general_info {"could not initialize gzip decompression"} );
+        stream.next_in = reinterpret_cast< Bytef* >( const_cast< char* >( block.data() ) + header_size );
+        stream.avail_in = block.size() - header_size - 8;
+        stream.next_out = reinterpret_cast< Bytef* >( out );
+        stream.avail_out = size;
+        const int status = inflate( &stream, Z_FINISH );
+        inflateEnd( &stream );
+        if ( status != Z_STREAM_END || stream.avail_out ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"invalid BGZF block"} );
+        if ( crc32( crc32( 0, Z_NULL, 0 ), reinterpret_cast< const Bytef* >( out ), size ) != getUint32( &block[ block.size() - 8 ] ) ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"BGZF block checksum mismatch"} );
+    }
+
+    Source source_;
+    std::vector< std::string > blocks_;
+    std::vector< std::size_t > offsets_;  // of the decompressed blocks in the piece
+    char* output_;
+    boost::scoped_ptr< ThreadPool > pool_;
+};
+
+
+
+#ifdef COMPRESSION_ZSTD
+// concatenated zstd frames
+class ZstdDecoder : public Decoder {
+public:
+    ZstdDecoder( const std::string& prefix, std::streambuf* source ) : source_( prefix, source ), input_( ZSTD_DStreamInSize() ), input_position_( 0 ), input_size_( 0 ), source_ended_( false ), frame_ended_( true ), stream_( ZSTD_createDStream() ) {
+        if ( ! stream_ || ZSTD_isError( ZSTD_initDStream( stream_ ) ) ) BOOST_THROW_EXCEPTION( GeneralError {} << general_info {"could not initialize zstd decompression"} );
+    }
+
+    ~ZstdDecoder() {
+        ZSTD_freeDStream( stream_ );
+    }
+
+    bool decode( std::string& out ) {
+        out.resize( piece_size );
+        ZSTD_outBuffer output = { &out[0], out.size(), 0 };
+        while ( output.pos < output.size ) {
+            if ( input_position_ == input_size_ && ! source_ended_ ) {
+                input_size_ = source_.read( &input_[0], input_.size() );
+                input_position_ = 0;
+                source_ended_ = ! input_size_;
+            }
+            ZSTD_inBuffer input = { &input_[0], input_size_, input_position_ };
+            const std::size_t written = output.pos;
+            const std::size_t status = ZSTD_decompressStream( stream_, &output, &input );
+            if ( ZSTD_isError( status ) ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"invalid zstd data"} );
+            if ( input.pos != input_position_ || output.pos != written ) frame_ended_ = ! status;  // status of the last step
+            else if ( source_ended_ ) {  // nothing left to flush
+                if ( ! frame_ended_ ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"truncated zstd data"} );
+                break;
+            }
+            input_position_ = input.pos;
+        }
+        out.resize( output.pos );
+        return ! out.empty();
+    }
+
+private:
+    Source source_;
+    std::vector< char > input_;
+    std::size_t input_position_;
+    std::size_t input_size_;
+    bool source_ended_;
+    bool frame_ended_;
+    ZSTD_DStream* stream_;
+};
+#endif
+
+
+
+// a single gzip member
+class GzipEncoder : public Encoder {
+public:
+    GzipEncoder( int level ) {
+        std::memset( &stream_, 0, sizeof( stream_ ) );
+        if ( deflateInit2( &stream_, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY ) != Z_OK ) BOOST_THROW_EXCEPTION( GeneralError {} << general_info {"could not initialize gzip compression"} );
+    }
+
+    ~GzipEncoder() {
+        deflateEnd( &stream_ );
+    }
+
+    std::size_t chunkSize() const {
+        return gzip_chunk_size;
+    }
+
+    void encode( const char* data, std::size_t size, std::string& out ) {
+        stream_.next_in = reinterpret_cast< Bytef* >( const_cast< char* >( data ) );
+        stream_.avail_in = size;
+        while ( stream_.avail_in ) deflateInto( out, Z_NO_FLUSH );
+    }
+
+    void finish( std::string& out ) {
+        while ( deflateInto( out, Z_FINISH ) != Z_STREAM_END );
+    }
+
+private:
+    int deflateInto( std::string& out, int flush ) {
+        const std::size_t size = out.size();
+        out.resize( size + gzip_chunk_size );
+        stream_.next_out = reinterpret_cast< Bytef* >( &out[ size ] );
+        stream_.avail_out = gzip_chunk_size;
+        const int status = deflate( &stream_, flush );
+        out.resize( out.size() - stream_.avail_out );
+        if ( status == Z_STREAM_ERROR ) BOOST_THROW_EXCEPTION( GeneralError {} << general_info {"gzip compression failed"} );
+        return status;
+    }
+
+    z_stream stream_;
+};
+
+
+
+// compresses the blocks of a chunk in parallel
+class BgzfEncoder : public Encoder {
+public:
+    BgzfEncoder( int level, unsigned int number_threads ) : level_( level ), blocks_( bgzf_blocks_per_thread*number_threads ), input_( NULL ), size_( 0 ) {
+        if ( number_threads > 1 ) pool_.reset( new ThreadPool( number_threads - 1 ) );
+    }
+
+    std::size_t chunkSize() const {
+        return bgzf_block_input*blocks_.size();
+    }
+
+    void encode( const char* data, std::size_t size, std::string& out ) {
+        const std::size_t n = ( size + bgzf_block_input - 1 )/bgzf_block_input;
+        input_ = data;
+        size_ = size;
+        if ( pool_ ) pool_->parallelFor( n, boost::bind( &BgzfEncoder::compressBlock, this, _1 ) );
+        else for ( std::size_t i = 0; i < n; ++i ) compressBlock( i );
+        for ( std::size_t i = 0; i < n; ++i ) out += blocks_[ i ];
+    }
+
+    void finish( std::string& out ) {
+        out.append( reinterpret_cast< const char* >( bgzf_eof ), sizeof( bgzf_eof ) );
+    }
+
+private:
+    void compressBlock( std::size_t i ) {
+        const char* data = input_ + i*bgzf_block_input;
+        const std::size_t size = std::min( bgzf_block_input, size_ - i*bgzf_block_input );
+        std::string& block = blocks_[ i ];
+        block.resize( bgzf_max_block );
+
+        // incompressible data is stored at level 0, which always fits
+        z_stream stream;
+        for ( int level = level_; ; level = 0 ) {
+            std::memset( &stream, 0, sizeof( stream ) );
+            if ( deflateInit2( &stream, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY ) != Z_OK ) BOOST_THROW_EXCEPTION( GeneralError {} << general_info {"could not initialize gzip compression"} );
+            stream.next_in = reinterpret_cast< Bytef* >( const_cast< char* >( data ) );
+            stream.avail_in = size;
+            stream.next_out = reinterpret_cast< Bytef* >( &block[ bgzf_header_size ] );
+            stream.avail_out = bgzf_max_block - bgzf_header_size - 8;
+            const int status = deflate( &stream, Z_FINISH );
+            deflateEnd( &stream );
+            if ( status == Z_STREAM_END ) break;
+            if ( ! level ) BOOST_THROW_EXCEPTION( GeneralError {} << general_info {"BGZF compression failed"} );
+        }
+
+        const std::size_t block_size = bgzf_header_size + stream.total_out + 8;
+        std::memcpy( &block[0], bgzf_eof, bgzf_header_size - 2 );
+        block[ bgzf_header_size - 2 ] = ( block_size - 1 ) & 0xff;
+        block[ bgzf_header_size - 1 ] = ( block_size - 1 ) >> 8;
+        putUint32( &block[ block_size - 8 ], crc32( crc32( 0, Z_NULL, 0 ), reinterpret_cast< const Bytef* >( data ), size ) );
+        putUint32( &block[ block_size - 4 ], size );
+        block.resize( block_size );
+    }
+
+    const int level_;
+    std::vector< std::string > blocks_;
+    const char* input_;
+    std::size_t size_;
+    boost::scoped_ptr< ThreadPool > pool_;
+};
+
+
+
+#ifdef COMPRESSION_ZSTD
+// a single zstd frame, compressed by the worker threads of the library
+class ZstdEncoder : public Encoder {
+public:
+    ZstdEncoder( int level, unsigned int number_threads ) : stream_( ZSTD_createCCtx() ) {
+        if ( ! stream_ || ZSTD_isError( ZSTD_CCtx_setParameter( stream_, ZSTD_c_compressionLevel, level < 0 ? ZSTD_CLEVEL_DEFAULT : level ) ) ) BOOST_THROW_EXCEPTION( GeneralError {} << general_info {"could not initialize zstd compression"} );
+        if ( number_threads > 1 ) ZSTD_CCtx_setParameter( stream_, ZSTD_c_nbWorkers, number_threads );  // fails without thread support in the library
+    }
+
+    ~ZstdEncoder() {
+        ZSTD_freeCCtx( stream_ );
+    }
+
+    std::size_t chunkSize() const {
+        return ZSTD_CStreamInSize();
+    }
+
+    void encode( const char* data, std::size_t size, std::string& out ) {
+        ZSTD_inBuffer input = { data, size, 0 };
+        while ( input.pos < input.size ) compressInto( out, input, ZSTD_e_continue );
+    }
+
+    void finish( std::string& out ) {
+        ZSTD_inBuffer input = { NULL, 0, 0 };
+        while ( compressInto( out, input, ZSTD_e_end ) );
+    }
+
+private:
+    std::size_t compressInto( std::string& out, ZSTD_inBuffer& input, ZSTD_EndDirective mode ) {
+        const std::size_t size = out.size();
+        out.resize( size + ZSTD_CStreamOutSize() );
+        ZSTD_outBuffer output = { &out[ size ], ZSTD_CStreamOutSize(), 0 };
+        const std::size_t remaining = ZSTD_compressStream2( stream_, &output, &input, mode );
+        out.resize( size + output.pos );
+        if ( ZSTD_isError( remaining ) ) BOOST_THROW_EXCEPTION( GeneralError {} << general_info {"zstd compression failed"} );
+        return remaining;
+    }
+
+    ZSTD_CCtx* stream_;
+};
+#endif
+
+}
+
+
+
+bool parseCompressionFormat( const std::string& name, CompressionFormat& format ) {
+    if ( name == "none" ) format = uncompressed;
+    else if ( name == "gzip" ) format = gzip;
+    else if ( name == "bgzf" ) format = bgzf;
+#ifdef COMPRESSION_ZSTD
+    else if ( name == "zstd" ) format = zstd;
+#endif
+    else return false;
+    return true;
+}
+
+
+
+CompressionFormat detectCompression( const char* data, std::size_t size ) {
+    const unsigned char* bytes = reinterpret_cast< const unsigned char* >( data );
+    if ( size >= 4 && bytes[0] == 0x28 && bytes[1] == 0xb5 && bytes[2] == 0x2f && bytes[3] == 0xfd ) return zstd;
+    if ( size < 2 || bytes[0] != 0x1f || bytes[1] != 0x8b ) return uncompressed;
+    if ( size >= bgzf_header_size && ( bytes[3] & 4 ) && getUint16( data + 10 ) >= 6 && bytes[12] == 'B' && bytes[13] == 'C' && getUint16( data + 14 ) == 2 ) return bgzf;
+    return gzip;
+}
+
+
+
+DecodingBuffer::DecodingBuffer( Decoder* decoder, bool threaded ) : decoder_( decoder ), threaded_( threaded ), finished_( false ), stop_( false ) {
+    if ( threaded_ ) thread_ = boost::thread( boost::bind( &DecodingBuffer::decodeAhead, this ) );
+}
+
+
+
+DecodingBuffer::~DecodingBuffer() {
+    if ( ! threaded_ ) return;
+    {
+        boost::mutex::scoped_lock lock( mutex_ );
+        stop_ = true;
+    }
+    space_available_.notify_all();
+    thread_.join();
+}
+
+
+
+DecodingBuffer::int_type DecodingBuffer::underflow() {
+    if ( gptr() < egptr() ) return traits_type::to_int_type( *gptr() );
+
+    if ( threaded_ ) {
+        boost::mutex::scoped_lock lock( mutex_ );
+        do {
+            while ( decoded_.empty() && ! finished_ ) piece_available_.wait( lock );
+            if ( decoded_.empty() ) {
+                if ( error_ ) boost::rethrow_exception( error_ );
+                return traits_type::eof();
+            }
+            current_.swap( decoded_.front() );
+            decoded_.pop_front();
+            space_available_.notify_one();
+        } while ( current_.empty() );
+    } else {
+        do {
+            if ( ! decoder_->decode( current_ ) ) return traits_type::eof();
+        } while ( current_.empty() );
+    }
+
+    setg( &current_[0], &current_[0], &current_[0] + current_.size() );
+    return traits_type::to_int_type( *gptr() );
+}
+
+
+
+void DecodingBuffer::decodeAhead() {
+    try {
+        std::string piece;
+        while ( decoder_->decode( piece ) ) {
+            boost::mutex::scoped_lock lock( mutex_ );
+            while ( decoded_.size() >= pieces_ahead && ! stop_ ) space_available_.wait( lock );
+            if ( stop_ ) return;
+            decoded_.push_back( std::string() );
+            decoded_.back().swap( piece );
+            piece_available_.notify_one();
+        }
+    } catch ( ... ) {
+        boost::mutex::scoped_lock lock( mutex_ );
+        error_ = boost::current_exception();
+    }
+    boost::mutex::scoped_lock lock( mutex_ );
+    finished_ = true;
+    piece_available_.notify_one();
+}
+
+
+
+CompressedInputStream::CompressedInputStream( std::istream& source, unsigned int number_threads ) : std::istream( NULL ) {
+    open( source.rdbuf(), number_threads );
+}
+
+
+
+CompressedInputStream::CompressedInputStream( const std::string& filename, unsigned int number_threads ) : std::istream( NULL ), file_( filename.c_str(), std::ios::binary ) {
+    if ( ! file_ ) BOOST_THROW_EXCEPTION( FileNotFound {} << general_info {"could not open file"} << file_info {filename} );
+    open( file_.rdbuf(), number_threads );
+}
+
+
+
+void CompressedInputStream::open( std::streambuf* source, unsigned int number_threads ) {
+    format_ = uncompressed;
+    const int first = source->sgetc();
+    if ( first != 0x1f && first != 0x28 ) rdbuf( source );  // neither gzip nor zstd, read in place
+    else {
+        std::string prefix( bgzf_header_size, '\0' );
+        prefix.resize( Source( "", source ).read( &prefix[0], prefix.size() ) );
+        format_ = detectCompression( prefix.data(), prefix.size() );
+
+        Decoder* decoder = NULL;
+        if ( format_ == uncompressed ) decoder = new PlainDecoder( prefix, source );
+        else if ( format_ == gzip ) decoder = new GzipDecoder( prefix, source );
+        else if ( format_ == bgzf ) decoder = new BgzfDecoder( prefix, source, number_threads );
+#ifdef COMPRESSION_ZSTD
+        else decoder = new ZstdDecoder( prefix, source );
+#else
+        else BOOST_THROW_EXCEPTION( GeneralError {} << general_info {"zstd compressed input is not supported by this build"} );
+#endif
+        buffer_.reset( new DecodingBuffer( decoder, number_threads > 1 ) );
+        rdbuf( buffer_.get() );
+    }
+    exceptions( std::ios::badbit );  // errors in compressed data must not look like the end of the input
+}
+
+
+
+CompressedOutputStream::Buffer::Buffer( int output_fd, Encoder* chunk_encoder ) : fd( output_fd ), encoder( chunk_encoder ), pending( chunk_encoder->chunkSize() ) {
+    setp( &pending[0], &pending[0] + pending.size() );
+}
+
+
+
+CompressedOutputStream::Buffer::int_type CompressedOutputStream::Buffer::overflow( int_type c ) {
+    encodePending();
+    if ( ! traits_type::eq_int_type( c, traits_type::eof() ) ) {
+        *pptr() = traits_type::to_char_type( c );
+        pbump( 1 );
+    }
+    return traits_type::not_eof( c );
+}
+
+
+
+int CompressedOutputStream::Buffer::sync() {
+    return 0;  // partial chunks would compress worse
+}
+
+
+
+void CompressedOutputStream::Buffer::encodePending() {
+    encoder->encode( pbase(), pptr() - pbase(), compressed );
+    setp( &pending[0], &pending[0] + pending.size() );
+    write( compressed );
+    compressed.clear();
+}
+
+
+
+void CompressedOutputStream::Buffer::write( const std::string& data ) {
+    const char* pos = data.data();
+    std::size_t remaining = data.size();
+    while ( remaining ) {
+        const ssize_t n = ::write( fd, pos, remaining );
+        if ( n < 0 ) {
+            if ( errno == EINTR ) continue;
+            BOOST_THROW_EXCEPTION( FileError {} << general_info {"could not write compressed output"} );
+        }
+        pos += n;
+        remaining -= n;
+    }
+}
+
+
+
+CompressedOutputStream::CompressedOutputStream( int fd, CompressionFormat format, unsigned int number_threads, int level ) : std::ostream( NULL ), closed_( false ) {
+    Encoder* encoder = NULL;
+    if ( format == gzip ) encoder = new GzipEncoder( level );
+    else if ( format == bgzf ) encoder = new BgzfEncoder( level, std::max( number_threads, 1u ) );
+#ifdef COMPRESSION_ZSTD
+    else if ( format == zstd ) encoder = new ZstdEncoder( level, number_threads );
+#endif
+    else BOOST_THROW_EXCEPTION( GeneralError {} << general_info {"unsupported output compression"} );
+    buffer_.reset( new Buffer( fd, encoder ) );
+    rdbuf( buffer_.get() );
+    exceptions( std::ios::badbit );
+}
+
+
+
+CompressedOutputStream::~CompressedOutputStream() {
+    try {
+        close();
+    } catch ( ... ) {}
+}
+
+
+
+void CompressedOutputStream::close() {
+    if ( closed_ ) return;
+    closed_ = true;
+    buffer_->encodePending();
+    buffer_->encoder->finish( buffer_->compressed );
+    buffer_->write( buffer_->compressed );
+    buffer_->compressed.clear();
+}
@@ -0,0 +1,158 @@
+/*
+taxator-tk predicts the taxon for DNA sequences based on sequence alignment.
+
+Copyright (C) 2010 Johannes Dröge
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef compression_hh_
+#define compression_hh_
+
+#include <deque>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <boost/exception_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+// Streams which read and write gzip, BGZF and zstd compressed data. The format of
+// input is detected from its first bytes, uncompressed input is read directly from
+// the source without copying. BGZF, the blocked gzip of samtools, consists of
+// independent gzip members of at most 64 kB which are decompressed and compressed
+// by several threads. With more than one thread, input is decompressed ahead in a
+// separate thread. zstd is only available if the library was found at build time,
+// it compresses with its own worker threads.
+
+enum CompressionFormat { uncompressed, gzip, bgzf, zstd };
+
+// "none", "gzip", "bgzf" or "zstd", false for other names and zstd without support
+bool parseCompressionFormat( const std::string& name, CompressionFormat& format );
+
+// the format of data which begins with the given bytes, BGZF needs the first 18 bytes
+CompressionFormat detectCompression( const char* data, std::size_t size );
+
+
+
+// produces the decompressed data of a source in pieces
+class Decoder : boost::noncopyable {
+public:
+    virtual ~Decoder() {}
+
+    // replaces out with the next piece, false at the end of the data
+    virtual bool decode( std::string& out ) = 0;
+};
+
+
+
+// std::streambuf over a Decoder, in a separate thread if threaded
+class DecodingBuffer : public std::streambuf, boost::noncopyable {
+public:
+    DecodingBuffer( Decoder* decoder, bool threaded );
+    ~DecodingBuffer();
+
+protected:
+    int_type underflow();
+
+private:
+    void decodeAhead();
+
+    boost::scoped_ptr< Decoder > decoder_;
+    std::string current_;
+    std::deque< std::string > decoded_;  // pieces decoded ahead
+    const bool threaded_;
+    bool finished_;
+    bool stop_;
+    boost::exception_ptr error_;
+    boost::mutex mutex_;
+    boost::condition_variable piece_available_;
+    boost::condition_variable space_available_;
+    boost::thread thread_;
+};
+
+
+
+// decompresses a file or another stream, read errors of compressed data throw
+class CompressedInputStream : public std::istream, boost::noncopyable {
+public:
+    CompressedInputStream( std::istream& source, unsigned int number_threads = 1 );
+    CompressedInputStream( const std::string& filename, unsigned int number_threads = 1 );
+
+    CompressionFormat format() const {
+        return format_;
+    }
+
+private:
+    void open( std::streambuf* source, unsigned int number_threads );
+
+    std::ifstream file_;
+    boost::scoped_ptr< std::streambuf > buffer_;
+    CompressionFormat format_;
+};
+
+
+
+// compresses data in chunks of a preferred size
+class Encoder : boost::noncopyable {
+public:
+    virtual ~Encoder() {}
+
+    // number of bytes which are best passed to encode() at once
+    virtual std::size_t chunkSize() const = 0;
+
+    // appends the compressed data to out, which may be held back until finish()
+    virtual void encode( const char* data, std::size_t size, std::string& out ) = 0;
+
+    // appends the rest and the end of the compressed data to out
+    virtual void finish( std::string& out ) = 0;
+};
+
+
+
+// compresses everything written to it into a file descriptor in chunks, flushing
+// has no effect. close() writes the end of the compressed data, write errors throw.
+// level -1 is the default of the format.
+class CompressedOutputStream : public std::ostream, boost::noncopyable {
+public:
+    CompressedOutputStream( int fd, CompressionFormat format, unsigned int number_threads = 1, int level = -1 );
+    ~CompressedOutputStream();
+
+    void close();
+
+private:
+    struct Buffer : public std::streambuf {
+        Buffer( int fd, Encoder* encoder );
+
+        int_type overflow( int_type c );
+        int sync();
+        void encodePending();
+        void write( const std::string& data );
+
+        const int fd;
+        boost::scoped_ptr< Encoder > encoder;
+        std::vector< char > pending;
+        std::string compressed;
+    };
+
+    boost::scoped_ptr< Buffer > buffer_;
+    bool closed_;
+};
+
+#endif // compression_hh_
@@ -46,7 +46,7 @@ class ConcurrentOutStream {
 		std::ostream& operator()( const uint channel ) { return buffers_[channel]; }
 		
 		void flush( const uint channel ) {
-			if ( buffers_[channel].str().size() < max_buffer_size_ ) tryFlush( channel );
+			if ( size( channel ) < max_buffer_size_ ) tryFlush( channel );
 			else forceFlush( channel );
 		}
 		
@@ -62,13 +62,18 @@ class ConcurrentOutStream {
 		}
 		
 		void forceFlush( const uint channel ) {
-			if ( ! buffers_[channel].str().empty() ) {
+			if ( size( channel ) ) {
 // 				os_ << "forced write " << buffers_[channel].str().size() << std::endl;
-				boost::mutex::scoped_lock( mutex_ );
+				boost::mutex::scoped_lock lock( mutex_ );
 				flushSerial( channel );
 			}
 		}
 		
+		std::size_t size( const uint channel ) { // without copying the buffer
+			const std::streampos pos = buffers_[channel].tellp();
+			return pos > 0 ? std::size_t( pos ) : 0;
+		}
+		
 		void flushSerial( const uint channel ) {
 			os_ << buffers_[channel].str();
 			buffers_[channel].str("");
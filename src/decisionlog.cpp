@@ -0,0 +1,200 @@
+#include "decisionlog.hh"
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <iomanip>
+#include <boost/cstdint.hpp>
+#include <boost/lexical_cast.hpp>
+
+namespace {
+
+struct EventDescription {
+    const char* text;  // '%' marks a field
+    const char* fields;
+    int precision;  // set before the event in text format unless 0
+    bool fixed;
+};
+
+// keep in sync with extra/taxator-log-decode, append new events only
+const EventDescription event_descriptions[] = {
+    { "", "", 0, false },  // header
+    { "\n", "", 0, false },
+    { "ID\t%\n", "s", 0, false },
+    { "  NUMREF\t%\n", "u", 0, false },
+    { "  RANGE\t%\t%\t%\n", "ttt", 0, false },
+    { "    RANGE\t%\t%\t%\n", "ttt", 0, false },
+    { "STATS\t%\t%\t0\t0\t0\t0\t%\t0\t0\t.0\n", "suu", 0, false },
+    { "STATS\t%\t%\t%\t%\t%\t%\t%\t%\t%\t%\n", "suuuuuuuuf", 2, true },
+    { "  PASS\t%\n", "u", 0, false },
+    { "    *ALN % <=> query\tqlscore=%; qlmatch=%; score=%; match=%; qpid=1.0\n", "ufuiu", 2, false },
+    { "    +ALN % <=> query\tqlscore=%; qlmatch=%; qlpid=%; score=%; match=%; qpid=%\n", "ufudiud", 2, false },
+    { "      current ref node: (%) % (+ % )\n", "itt", 0, false },
+    { "    NUMALN\t%\t%\n", "uu", 0, false },
+    { "      query: (%) unknown\n", "i", 0, false },
+    { "    +ALN % <=> %\tqlscore=%; qlmatch=%; qlpid=%; score=%; match=%; qpid=%; qlscore_cut=%; qpid_cutg=%; qpid_cut_h=%\n", "uufudiudidd", 2, false },
+    { "      current lower node: (%) % (+ % at % )\n", "itti", 0, false },
+    { "    EXT\tqueryscore = %; threshold = %; bandfactor = %\n", "iif", 0, false },
+    { "      current upper node: (%) % (+ % at % )\n", "itti", 0, false },
+    { "    SCORE\tlscore = %; uscore = %; queryscore = %; queryscore_ex = %; ival = %\n", "iiiif", 0, false },
+    { "    NUMOUTGRP\t%\n", "U", 0, false },
+    { "    +ALN % <=> %\tqlscore=%; qlmatch=%; score%%; qpid=%\n", "uufucid", 2, false },
+    { "    +ALN query <=> %\tqlscore=%; qlmatch=%; score=%; match=%; qpid=%\n", "ufuiud", 2, false },
+    { "    CACHE\t%\t%\t%\n", "UUU", 0, false },
+    { "    current ref/lower node: (%) % (+ % )\n", "ftt", 0, false },
+    { "    current upper node: (%) % (+ % at % )\n", "ftti", 0, false },
+    { "SCORECACHE\t%\t%\t%\n", "UUU", 0, false }
+};
+
+const char binary_magic[] = "TTKDLOG";
+const char binary_version = 1;
+
+template< typename T >
+void writeLittleEndian( std::ostream& sink, T value ) {  // IEEE 754 floating point types
+    char bytes[ sizeof( T ) ];
+    std::memcpy( bytes, &value, sizeof( T ) );
+#if defined( __BYTE_ORDER__ ) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    std::reverse( bytes, bytes + sizeof( T ) );
+#endif
+    sink.write( bytes, sizeof( T ) );
+}
+
+}
+
+
+
+void DecisionLog::writeHeader() {
+    if ( format_ != binary || level_ == off ) return;
+    sink_.put( static_cast< char >( header ) );
+    sink_.write( binary_magic, sizeof( binary_magic ) - 1 );
+    sink_.put( binary_version );
+}
+
+
+
+void DecisionLog::writeVarint( unsigned long value ) {
+    while ( value >= 0x80 ) {
+        sink_.put( static_cast< char >( ( value & 0x7F ) | 0x80 ) );
+        value >>= 7;
+    }
+    sink_.put( static_cast< char >( value ) );
+}
+
+
+
+DecisionLog::Event::Event( DecisionLog& log, EventType type ) :
+    log_( &log ),
+    text_( event_descriptions[ type ].text ),
+    fields_( event_descriptions[ type ].fields )
+{
+    assert( type < number_event_types && sizeof( event_descriptions )/sizeof( EventDescription ) == number_event_types );
+    if ( log_->format_ == binary ) log_->sink_.put( static_cast< char >( type ) );
+    else {
+        if ( event_descriptions[ type ].precision ) log_->sink_ << std::setprecision( event_descriptions[ type ].precision );
+        if ( event_descriptions[ type ].fixed ) log_->sink_ << std::fixed;
+    }
+}
+
+
+
+DecisionLog::Event::Event( Event&& other ) :
+    log_( other.log_ ),
+    text_( other.text_ ),
+    fields_( other.fields_ )
+{
+    other.log_ = NULL;
+}
+
+
+
+DecisionLog::Event::~Event() {
+    if ( ! log_ ) return;
+    assert( ! *fields_ );  // all fields given
+    if ( log_->format_ == text ) log_->sink_ << text_;
+}
+
+
+
+void DecisionLog::Event::next( char field_type ) {
+    assert( *fields_ == field_type );
+    ++fields_;
+    if ( log_->format_ == text ) {
+        const char* end = std::strchr( text_, '%' );
+        log_->sink_.write( text_, end - text_ );
+        text_ = end + 1;
+    }
+}
+
+
+
+DecisionLog::Event& DecisionLog::Event::operator<<( unsigned int value ) {
+    next( 'u' );
+    if ( log_->format_ == text ) log_->sink_ << value;
+    else log_->writeVarint( value );
+    return *this;
+}
+
+
+
+DecisionLog::Event& DecisionLog::Event::operator<<( unsigned long value ) {
+    next( 'U' );
+    if ( log_->format_ == text ) log_->sink_ << value;
+    else log_->writeVarint( value );
+    return *this;
+}
+
+
+
+DecisionLog::Event& DecisionLog::Event::operator<<( int value ) {
+    next( 'i' );
+    if ( log_->format_ == text ) log_->sink_ << value;
+    else log_->writeVarint( ( static_cast< boost::uint32_t >( value ) << 1 ) ^ static_cast< boost::uint32_t >( value >> 31 ) );  // zigzag
+    return *this;
+}
+
+
+
+DecisionLog::Event& DecisionLog::Event::operator<<( float value ) {
+    next( 'f' );
+    if ( log_->format_ == text ) log_->sink_ << value;
+    else writeLittleEndian( log_->sink_, value );
+    return *this;
+}
+
+
+
+DecisionLog::Event& DecisionLog::Event::operator<<( double value ) {
+    next( 'd' );
+    if ( log_->format_ == text ) log_->sink_ << value;
+    else writeLittleEndian( log_->sink_, value );
+    return *this;
+}
+
+
+
+DecisionLog::Event& DecisionLog::Event::operator<<( char value ) {
+    next( 'c' );
+    log_->sink_.put( value );
+    return *this;
+}
+
+
+
+DecisionLog::Event& DecisionLog::Event::operator<<( const std::string& value ) {
+    next( 's' );
+    if ( log_->format_ == binary ) log_->writeVarint( value.size() );
+    log_->sink_.write( value.data(), value.size() );
+    return *this;
+}
+
+
+
+DecisionLog::Event& DecisionLog::Event::operator<<( const TaxonNode* value ) {
+    next( 't' );
+    if ( log_->format_ == text ) log_->sink_ << value->data->annotation->name;
+    else {
+        const std::string taxid = boost::lexical_cast< std::string >( value->data->taxid );
+        log_->writeVarint( taxid.size() );
+        log_->sink_.write( taxid.data(), taxid.size() );
+    }
+    return *this;
+}
@@ -0,0 +1,145 @@
+/*
+taxator-tk predicts the taxon for DNA sequences based on sequence alignment.
+
+Copyright (C) 2010 Johannes Dröge
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef decisionlog_hh_
+#define decisionlog_hh_
+
+#include <ostream>
+#include <string>
+#include "taxontree.hh"
+
+// Log of the decisions taken for each query, written as text lines or as compact
+// binary events which extra/taxator-log-decode turns back into text. Callers check
+// enabled() before an event so that nothing is computed or formatted for levels
+// which are switched off:
+//
+//   if(log.enabled(DecisionLog::passes)) log.event(DecisionLog::ext) << qscore << threshold << bandfactor;
+//
+// The fields of each event are given in the table in decisionlog.cpp, in the same
+// order and type as in the binary format:
+//
+//   u, U  unsigned 32/64 bit integer as little-endian base 128 varint
+//   i     signed 32 bit integer as zigzag varint
+//   f, d  float, double in little-endian IEEE 754
+//   c     character, one byte
+//   s     string, varint length and bytes
+//   t     taxon: name in text, taxonomic identifier as string in binary
+//
+// A binary event is the event code (one byte) followed by its fields. Each run
+// starts with a header event: "TTKDLOG" and the format version (one byte).
+class DecisionLog {
+public:
+    enum Level { off = 0, summary = 1, passes = 2, alignments = 3 };
+
+    enum Format { text, binary };
+
+    enum EventType {
+        header = 0,
+        blank,
+        query_id,
+        numref,
+        query_range,
+        range,
+        stats_trivial,
+        stats,
+        pass,
+        aln_identical,
+        aln_query,
+        ref_node,
+        numaln,
+        query_score,
+        aln_anchor,
+        lower_node,
+        ext,
+        upper_node,
+        score,
+        numoutgrp,
+        aln_outgroup,
+        aln_query_anchor,
+        cache,
+        identical_lower_node,
+        identical_upper_node,
+        scorecache,
+        number_event_types
+    };
+
+    // fields of one event, written when given and finished on destruction
+    class Event {
+    public:
+        Event( DecisionLog& log, EventType type );
+
+        Event( Event&& other );
+
+        ~Event();
+
+        Event& operator<<( unsigned int value );
+
+        Event& operator<<( unsigned long value );
+
+        Event& operator<<( int value );
+
+        Event& operator<<( float value );
+
+        Event& operator<<( double value );
+
+        Event& operator<<( char value );
+
+        Event& operator<<( const std::string& value );
+
+        Event& operator<<( const TaxonNode* value );
+
+    private:
+        Event( const Event& );
+        Event& operator=( const Event& );
+
+        // writes the text up to the next field
+        void next( char field_type );
+
+        DecisionLog* log_;
+        const char* text_;  // rest of the text template
+        const char* fields_;  // rest of the field types
+    };
+
+    DecisionLog( std::ostream& sink, Level level = alignments, Format format = text ) : sink_( sink ), level_( level ), format_( format ) {};
+
+    bool enabled( Level level ) const {
+        return level <= level_;
+    }
+
+    Event event( EventType type ) {
+        return Event( *this, type );
+    }
+
+    // once per run in binary format
+    void writeHeader();
+
+    Level level() const {
+        return level_;
+    }
+
+private:
+    void writeVarint( unsigned long value );
+
+    std::ostream& sink_;
+    const Level level_;
+    const Format format_;
+};
+
+#endif // decisionlog_hh_
@@ -0,0 +1,146 @@
+#include "editdistance.hh"
+#include <algorithm>
+#include <cstdlib>
+#include "editdistancekernel.hh"
+
+
+
+#ifdef EDITDISTANCE_AVX2
+void editDistanceKernelAVX2( const unsigned char* text, std::size_t text_length, const boost::uint64_t* peq, std::size_t blocks, boost::int64_t row_lo, boost::int64_t row_hi, boost::uint64_t* pv, boost::uint64_t* mv, boost::uint64_t* scores );
+#endif
+
+#ifdef EDITDISTANCE_AVX512
+void editDistanceKernelAVX512( const unsigned char* text, std::size_t text_length, const boost::uint64_t* peq, std::size_t blocks, boost::int64_t row_lo, boost::int64_t row_hi, boost::uint64_t* pv, boost::uint64_t* mv, boost::uint64_t* scores );
+#endif
+
+
+
+namespace {
+
+struct ScalarVec {
+    typedef boost::uint64_t Type;
+    static const std::size_t lanes = 1;
+    static Type zero() { return 0; }
+    static Type one() { return 1; }
+    static Type ones() { return ~static_cast< Type >( 0 ); }
+    static Type load( const boost::uint64_t* p ) { return *p; }
+    static void store( boost::uint64_t* p, Type v ) { *p = v; }
+    static Type add( Type a, Type b ) { return a + b; }
+    static Type sub( Type a, Type b ) { return a - b; }
+    static Type bitAnd( Type a, Type b ) { return a & b; }
+    static Type bitOr( Type a, Type b ) { return a | b; }
+    static Type bitXor( Type a, Type b ) { return a ^ b; }
+    static Type shiftLeft1( Type a ) { return a << 1; }
+    static Type shiftRight63( Type a ) { return a >> 63; }
+    static Type set( boost::uint64_t a ) { return a; }
+};
+
+void editDistanceKernelScalar( const unsigned char* text, std::size_t text_length, const boost::uint64_t* peq, std::size_t blocks, boost::int64_t row_lo, boost::int64_t row_hi, boost::uint64_t* pv, boost::uint64_t* mv, boost::uint64_t* scores ) {
+    editDistanceKernel< ScalarVec >( text, text_length, peq, blocks, row_lo, row_hi, pv, mv, scores );
+}
+
+
+
+std::vector< EditDistanceKernel > detectEditDistanceKernels() {
+    std::vector< EditDistanceKernel > kernels;
+#if defined( EDITDISTANCE_AVX2 ) || defined( EDITDISTANCE_AVX512 )
+    __builtin_cpu_init();
+#endif
+#ifdef EDITDISTANCE_AVX512
+    if ( __builtin_cpu_supports( "avx512f" ) ) {
+        const EditDistanceKernel kernel = { "avx512", 8, &editDistanceKernelAVX512 };
+        kernels.push_back( kernel );
+    }
+#endif
+#ifdef EDITDISTANCE_AVX2
+    if ( __builtin_cpu_supports( "avx2" ) ) {
+        const EditDistanceKernel kernel = { "avx2", 4, &editDistanceKernelAVX2 };
+        kernels.push_back( kernel );
+    }
+#endif
+    const EditDistanceKernel kernel = { "scalar", 1, &editDistanceKernelScalar };
+    kernels.push_back( kernel );
+    return kernels;
+}
+
+}
+
+
+
+const std::vector< EditDistanceKernel >& availableEditDistanceKernels() {
+    static const std::vector< EditDistanceKernel > kernels = detectEditDistanceKernels();
+    return kernels;
+}
+
+
+
+const EditDistanceKernel& defaultEditDistanceKernel() {
+    return availableEditDistanceKernels().front();
+}
+
+
+
+void BatchEditDistance::compute( std::vector< int >& distances ) {
+    const std::size_t lanes = kernel_.lanes;
+    const std::size_t number_patterns = pattern_offsets_.size();
+    const boost::int64_t text_length = text_.size();
+    pattern_offsets_.push_back( patterns_.size() );  // end of last pattern
+    distances.resize( number_patterns );
+
+    for ( std::size_t first = 0; first < number_patterns; first += lanes ) {
+        const std::size_t last = std::min( first + lanes, number_patterns );
+        std::size_t blocks = 1;
+        boost::int64_t row_lo = 0, row_hi = 0;  // union of the bands relative to the diagonal
+        bool align = false;
+        for ( std::size_t k = first; k < last; ++k ) {
+            const boost::int64_t length = pattern_offsets_[k + 1] - pattern_offsets_[k];
+            const boost::int64_t bound = bounds_[k] < 0 ? std::max( length, text_length ) : bounds_[k];
+            const boost::int64_t shift = length - text_length;
+            if ( std::abs( shift ) > bound ) {  // length difference alone exceeds the bound
+                distances[k] = bounds_[k] + 1;
+                continue;
+            }
+            if ( ! length || ! text_length ) {
+                distances[k] = std::max( length, text_length );
+                continue;
+            }
+            const boost::int64_t lo = std::max( -bound, shift - bound );
+            const boost::int64_t hi = std::min( bound, shift + bound );
+            row_lo = align ? std::min( row_lo, lo ) : lo;
+            row_hi = align ? std::max( row_hi, hi ) : hi;
+            align = true;
+            distances[k] = -1;
+            blocks = std::max< std::size_t >( blocks, ( length + 63 )/64 );
+        }
+        if ( ! align ) continue;
+
+        peq_.assign( alphabet_size_*blocks*lanes, 0 );
+        pv_.resize( blocks*lanes );
+        mv_.resize( blocks*lanes );
+        scores_.resize( blocks*lanes );
+        for ( std::size_t k = first; k < last; ++k ) {
+            if ( distances[k] >= 0 ) continue;
+            const std::size_t lane = k - first;
+            const std::size_t length = pattern_offsets_[k + 1] - pattern_offsets_[k];
+            const unsigned char* pattern = patterns_.data() + pattern_offsets_[k];
+            for ( std::size_t i = 0; i < length; ++i ) peq_[ ( pattern[i]*blocks + i/64 )*lanes + lane ] |= static_cast< boost::uint64_t >( 1 ) << ( i % 64 );
+        }
+
+        kernel_.function( text_.data(), text_.size(), peq_.data(), blocks, row_lo, row_hi, pv_.data(), mv_.data(), scores_.data() );
+
+        for ( std::size_t k = first; k < last; ++k ) {
+            if ( distances[k] >= 0 ) continue;
+            const std::size_t lane = k - first;
+            const std::size_t length = pattern_offsets_[k + 1] - pattern_offsets_[k];
+            const std::size_t cell = ( ( length - 1 )/64 )*lanes + lane;
+            const unsigned int row = ( length - 1 ) % 64;
+            const boost::uint64_t below = row == 63 ? 0 : ~( ( static_cast< boost::uint64_t >( 2 ) << row ) - 1 );  // padding rows of the block
+            const boost::int64_t distance = static_cast< boost::int64_t >( scores_[ cell ] ) - __builtin_popcountll( pv_[ cell ] & below ) + __builtin_popcountll( mv_[ cell ] & below );
+            distances[k] = bounds_[k] >= 0 && distance > bounds_[k] ? bounds_[k] + 1 : distance;
+        }
+    }
+
+    patterns_.clear();
+    pattern_offsets_.clear();
+    bounds_.clear();
+}
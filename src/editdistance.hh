@@ -0,0 +1,105 @@
+/*
+taxator-tk predicts the taxon for DNA sequences based on sequence alignment.
+
+Copyright (C) 2010 Johannes Dröge
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef editdistance_hh_
+#define editdistance_hh_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <seqan/sequence.h>
+
+
+
+typedef void (*EditDistanceKernelFunction)( const unsigned char* text, std::size_t text_length, const boost::uint64_t* peq, std::size_t blocks, boost::int64_t row_lo, boost::int64_t row_hi, boost::uint64_t* pv, boost::uint64_t* mv, boost::uint64_t* scores );
+
+struct EditDistanceKernel {
+    const char* name;
+    std::size_t lanes;  // patterns per kernel call
+    EditDistanceKernelFunction function;
+};
+
+
+
+// kernels supported by this build and CPU, widest first, "scalar" is always available
+const std::vector< EditDistanceKernel >& availableEditDistanceKernels();
+
+// kernel chosen at runtime for this CPU
+const EditDistanceKernel& defaultEditDistanceKernel();
+
+
+
+// Global edit distance (unit costs, as seqan::globalAlignmentScore with MyersBitVector)
+// between one text and many patterns, computed several patterns at a time in the
+// vector lanes of the kernel. Sequences are seqan strings of small alphabets.
+// A pattern can be given an upper bound for its distance; only the band of the
+// alignment matrix which can hold a distance within the bound is computed then.
+class BatchEditDistance {
+public:
+    BatchEditDistance( const EditDistanceKernel& kernel = defaultEditDistanceKernel() ) : kernel_( kernel ), alphabet_size_( 0 ) {};
+
+    std::size_t lanes() const {
+        return kernel_.lanes;
+    }
+
+    template< typename StringType >
+    void setText( const StringType& text ) {
+        text_.clear();
+        append( text, text_ );
+    }
+
+    // distances above a non-negative bound are reported as bound + 1
+    template< typename StringType >
+    void addPattern( const StringType& pattern, int bound = -1 ) {
+        pattern_offsets_.push_back( patterns_.size() );
+        bounds_.push_back( bound );
+        append( pattern, patterns_ );
+    }
+
+    std::size_t size() const {
+        return pattern_offsets_.size();
+    }
+
+    // edit distances of the queued patterns to the text in the order they were added,
+    // the queue is cleared afterwards
+    void compute( std::vector< int >& distances );
+
+private:
+    template< typename StringType >
+    void append( const StringType& seq, std::vector< unsigned char >& target ) {
+        const std::size_t length = seqan::length( seq );
+        for ( std::size_t i = 0; i < length; ++i ) {
+            const unsigned char c = seqan::ordValue( seq[i] );
+            if ( c >= alphabet_size_ ) alphabet_size_ = c + 1;
+            target.push_back( c );
+        }
+    }
+
+    const EditDistanceKernel& kernel_;
+    unsigned int alphabet_size_;
+    std::vector< unsigned char > text_;
+    std::vector< unsigned char > patterns_;
+    std::vector< std::size_t > pattern_offsets_;
+    std::vector< int > bounds_;
+    std::vector< boost::uint64_t > peq_, pv_, mv_, scores_;
+};
+
+#endif // editdistance_hh_
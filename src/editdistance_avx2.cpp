@@ -0,0 +1,33 @@
+// compiled with AVX2 enabled, only called if the CPU supports it
+#include <immintrin.h>
+#include "editdistancekernel.hh"
+
+
+
+namespace {
+
+struct AVX2Vec {
+    typedef __m256i Type;
+    static const std::size_t lanes = 4;
+    static Type zero() { return _mm256_setzero_si256(); }
+    static Type one() { return _mm256_set1_epi64x( 1 ); }
+    static Type ones() { return _mm256_set1_epi64x( -1 ); }
+    static Type load( const boost::uint64_t* p ) { return _mm256_loadu_si256( reinterpret_cast< const __m256i* >( p ) ); }
+    static void store( boost::uint64_t* p, Type v ) { _mm256_storeu_si256( reinterpret_cast< __m256i* >( p ), v ); }
+    static Type add( Type a, Type b ) { return _mm256_add_epi64( a, b ); }
+    static Type sub( Type a, Type b ) { return _mm256_sub_epi64( a, b ); }
+    static Type bitAnd( Type a, Type b ) { return _mm256_and_si256( a, b ); }
+    static Type bitOr( Type a, Type b ) { return _mm256_or_si256( a, b ); }
+    static Type bitXor( Type a, Type b ) { return _mm256_xor_si256( a, b ); }
+    static Type shiftLeft1( Type a ) { return _mm256_slli_epi64( a, 1 ); }
+    static Type shiftRight63( Type a ) { return _mm256_srli_epi64( a, 63 ); }
+    static Type set( boost::uint64_t a ) { return _mm256_set1_epi64x( a ); }
+};
+
+}
+
+
+
+void editDistanceKernelAVX2( const unsigned char* text, std::size_t text_length, const boost::uint64_t* peq, std::size_t blocks, boost::int64_t row_lo, boost::int64_t row_hi, boost::uint64_t* pv, boost::uint64_t* mv, boost::uint64_t* scores ) {
+    editDistanceKernel< AVX2Vec >( text, text_length, peq, blocks, row_lo, row_hi, pv, mv, scores );
+}
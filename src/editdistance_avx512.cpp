@@ -0,0 +1,35 @@
+// compiled with AVX-512 enabled, only called if the CPU supports it
+#include <immintrin.h>
+#include "editdistancekernel.hh"
+
+
+
+namespace {
+
+struct AVX512Vec {
+    typedef __m512i Type;
+    static const std::size_t lanes = 8;
+    static Type zero() { return _mm512_setzero_si512(); }
+    static Type one() { return _mm512_set1_epi64( 1 ); }
+    static Type ones() { return _mm512_set1_epi64( -1 ); }
+    static Type load( const boost::uint64_t* p ) { return _mm512_loadu_si512( p ); }
+    static void store( boost::uint64_t* p, Type v ) { _mm512_storeu_si512( p, v ); }
+    static Type add( Type a, Type b ) { return _mm512_add_epi64( a, b ); }
+    static Type sub( Type a, Type b ) { return _mm512_sub_epi64( a, b ); }
+    static Type bitAnd( Type a, Type b ) { return _mm512_and_si512( a, b ); }
+    static Type bitOr( Type a, Type b ) { return _mm512_or_si512( a, b ); }
+    static Type bitXor( Type a, Type b ) { return _mm512_xor_si512( a, b ); }
+    // zero-masked forms with all lanes selected, the unmasked shifts pass an undefined
+    // vector to the builtin which gcc reports as maybe uninitialized
+    static Type shiftLeft1( Type a ) { return _mm512_maskz_slli_epi64( 0xff, a, 1 ); }
+    static Type shiftRight63( Type a ) { return _mm512_maskz_srli_epi64( 0xff, a, 63 ); }
+    static Type set( boost::uint64_t a ) { return _mm512_set1_epi64( a ); }
+};
+
+}
+
+
+
+void editDistanceKernelAVX512( const unsigned char* text, std::size_t text_length, const boost::uint64_t* peq, std::size_t blocks, boost::int64_t row_lo, boost::int64_t row_hi, boost::uint64_t* pv, boost::uint64_t* mv, boost::uint64_t* scores ) {
+    editDistanceKernel< AVX512Vec >( text, text_length, peq, blocks, row_lo, row_hi, pv, mv, scores );
+}
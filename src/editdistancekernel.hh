@@ -0,0 +1,96 @@
+/*
+taxator-tk predicts the taxon for DNA sequences based on sequence alignment.
+
+Copyright (C) 2010 Johannes Dröge
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef editdistancekernel_hh_
+#define editdistancekernel_hh_
+
+#include <cstddef>
+#include <boost/cstdint.hpp>
+
+// Myers' bit-vector algorithm for global edit distance (J ACM 46(3), 1999, with the
+// block extension for long patterns) on several patterns at once, one per lane of
+// the register type provided by VecT. All patterns are aligned to the same text and
+// padded to the same number of 64 bit blocks; the rows below a pattern do not
+// influence it.
+//
+// Only the blocks which overlap the rows [j + row_lo, j + row_hi] of text column j
+// (1-based) are computed (Ukkonen's band). Blocks below are started with increasing
+// values and blocks above are assumed to increase by one per column, both are costs
+// of valid paths, so values inside the band are exact if their optimal path stays
+// in the band and too large otherwise.
+//
+// This header is compiled once per instruction set (see editdistance*.cpp) with a
+// VecT in an anonymous namespace, so do not include standard library templates
+// here which the linker could merge across the translation units.
+//
+// peq:      [alphabet][blocks][lanes] match masks of the patterns
+// pv, mv:   [blocks][lanes] vertical deltas of the last column on output
+// scores:   [blocks][lanes] values of the last row of each block on output
+template< typename VecT >
+void editDistanceKernel( const unsigned char* text, std::size_t text_length, const boost::uint64_t* peq, std::size_t blocks, boost::int64_t row_lo, boost::int64_t row_hi, boost::uint64_t* pv, boost::uint64_t* mv, boost::uint64_t* scores ) {
+    typedef typename VecT::Type Vec;
+    const std::size_t lanes = VecT::lanes;
+    const Vec ones = VecT::ones();
+    const Vec one = VecT::one();
+    const Vec zero = VecT::zero();
+    const Vec block_rows = VecT::set( 64 );
+
+    std::size_t active_end = 0;  // blocks [0, active_end) have been started
+    for ( std::size_t j = 1; j <= text_length; ++j ) {
+        const boost::int64_t lo = static_cast< boost::int64_t >( j ) + row_lo - 1;  // 0-based rows
+        const boost::int64_t hi = static_cast< boost::int64_t >( j ) + row_hi - 1;
+        const std::size_t first = lo > 0 ? std::size_t( lo )/64 : 0;
+        const std::size_t end = hi < 0 ? 1 : std::size_t( hi )/64 + 1 < blocks ? std::size_t( hi )/64 + 1 : blocks;
+        for ( ; active_end < end; ++active_end ) {  // values continue from the last row of the block above
+            VecT::store( pv + active_end*lanes, ones );
+            VecT::store( mv + active_end*lanes, zero );
+            const Vec above = active_end ? VecT::load( scores + ( active_end - 1 )*lanes ) : zero;
+            VecT::store( scores + active_end*lanes, VecT::add( above, block_rows ) );
+        }
+
+        const boost::uint64_t* peq_c = peq + text[j - 1]*blocks*lanes;
+        Vec hp = one;  // top row of global alignment or above the band increases by one per column
+        Vec hm = zero;
+        for ( std::size_t b = first; b < end; ++b ) {
+            Vec eq = VecT::load( peq_c + b*lanes );
+            Vec p = VecT::load( pv + b*lanes );
+            Vec m = VecT::load( mv + b*lanes );
+            const Vec xv = VecT::bitOr( eq, m );
+            eq = VecT::bitOr( eq, hm );
+            const Vec xh = VecT::bitOr( VecT::bitXor( VecT::add( VecT::bitAnd( eq, p ), p ), p ), eq );
+            Vec ph = VecT::bitOr( m, VecT::bitXor( VecT::bitOr( xh, p ), ones ) );
+            Vec mh = VecT::bitAnd( p, xh );
+
+            const Vec hp_out = VecT::shiftRight63( ph );
+            const Vec hm_out = VecT::shiftRight63( mh );
+            VecT::store( scores + b*lanes, VecT::sub( VecT::add( VecT::load( scores + b*lanes ), hp_out ), hm_out ) );
+            ph = VecT::bitOr( VecT::shiftLeft1( ph ), hp );
+            mh = VecT::bitOr( VecT::shiftLeft1( mh ), hm );
+            p = VecT::bitOr( mh, VecT::bitXor( VecT::bitOr( xv, ph ), ones ) );
+            m = VecT::bitAnd( ph, xv );
+            VecT::store( pv + b*lanes, p );
+            VecT::store( mv + b*lanes, m );
+            hp = hp_out;
+            hm = hm_out;
+        }
+    }
+}
+
+#endif // editdistancekernel_hh_
@@ -24,13 +24,14 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <boost/exception/all.hpp>
 #include <exception>
 #include <string>
+#include "types.hh"
 
 // tags
 typedef boost::error_info<struct exception_tag_general, const std::string> general_info;
 typedef boost::error_info<struct exception_tag_file, const std::string> file_info;
 typedef boost::error_info<struct exception_tag_seqid, const std::string> seqid_info;
 typedef boost::error_info<struct exception_tag_taxid, const TaxonID> taxid_info;
-typedef boost::error_info<struct exception_tag_line, const uint> line_info;
+typedef boost::error_info<struct exception_tag_line, const very_large_unsigned_int> line_info;
 typedef boost::error_info<struct exception_tag_position, const uint> position_info;
 
 // exception classes
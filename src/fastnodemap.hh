@@ -23,36 +23,70 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "taxontree.hh"
 #include "types.hh"
-#include <map>
+#include <cassert>
 #include <vector>
 
-// meta map without iterators
+// Values for the nodes of a taxonomy in an array indexed by the pre-order number of
+// the node (Taxon::preorder), a node has a value after it was first accessed with
+// operator[]. The nodes with a value are kept in a list, so that iterating,
+// clearing and adding up maps only touch those nodes.
 
 template< typename ValueType >
 class FastNodeMap {
 	public:
-		FastNodeMap( small_unsigned_int max_depth ) : map_at_level_( max_depth ) {};
-		typedef std::map< const TaxonNode*, ValueType > BasicMapType;
+		typedef std::vector< const TaxonNode* > NodeList;
 		
-		typename std::vector< BasicMapType >::size_type size() const {
-			typename std::vector< BasicMapType >::size_type sum = 0;
-			for ( typename std::vector< BasicMapType >::const_iterator it = map_at_level_.begin(); it != map_at_level_.end(); ++it ) sum += it->size();
-			return sum;
+		FastNodeMap( large_unsigned_int number_nodes ) : values_( number_nodes ), present_( number_nodes, false ) {};
+		
+		typename NodeList::size_type size() const {
+			return nodes_.size();
+		}
+		
+		// in order of insertion
+		const NodeList& nodes() const {
+			return nodes_;
 		}
 		
 		ValueType& operator[]( const TaxonNode* node ) {
-			return map_at_level_[ node->data->root_pathlength ][ node ];
+			const large_unsigned_int index = node->data->preorder;
+			assert( index < values_.size() );  // numbered after the map was sized
+			if ( ! present_[ index ] ) {
+				present_[ index ] = true;
+				nodes_.push_back( node );
+			}
+			return values_[ index ];
 		};
 		
 		ValueType* find( const TaxonNode* node ) {
-			BasicMapType& directmap = map_at_level_[ node->data->root_pathlength ];
-			typename BasicMapType::iterator it = directmap.find( node );
-			if ( it != directmap.end() ) return &it->second;
-			return NULL;
+			const large_unsigned_int index = node->data->preorder;
+			assert( index < values_.size() );
+			return present_[ index ] ? &values_[ index ] : NULL;
+		};
+		
+		const ValueType* find( const TaxonNode* node ) const {
+			const large_unsigned_int index = node->data->preorder;
+			assert( index < values_.size() );
+			return present_[ index ] ? &values_[ index ] : NULL;
+		};
+		
+		// adds the values of other node by node
+		void add( const FastNodeMap& other ) {
+			for ( typename NodeList::const_iterator it = other.nodes_.begin(); it != other.nodes_.end(); ++it ) (*this)[ *it ] += other.values_[ (*it)->data->preorder ];
+		};
+		
+		void clear() {
+			for ( typename NodeList::const_iterator it = nodes_.begin(); it != nodes_.end(); ++it ) {
+				const large_unsigned_int index = (*it)->data->preorder;
+				values_[ index ] = ValueType();
+				present_[ index ] = false;
+			}
+			nodes_.clear();
 		};
 		
 	private:
-		std::vector< BasicMapType > map_at_level_;
+		std::vector< ValueType > values_;
+		std::vector< bool > present_;
+		NodeList nodes_;
 };
 
 #endif //fastnodemap_hh_
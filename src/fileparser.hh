@@ -21,10 +21,14 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef fileparser_hh_
 #define fileparser_hh_
 
+#include <cstring>
+#include "compression.hh"
 #include "exception.hh"
 #include "utils.hh"
+#include "mappedfile.hh"
 
 
+// compressed input is decompressed on the fly
 template< typename FactoryType >
 class FileParser {
 public:
@@ -36,8 +40,9 @@ public:
         feed();
     }
     
-    FileParser( std::istream& strm, FactoryType& factory ) : handle_(strm),
-                                                             factory_(factory) {
+    FileParser( std::istream& strm, FactoryType& factory, unsigned int line_offset = 0 ) : handle_(strm),
+                                                                                         factory_(factory),
+                                                                                         line_num_(line_offset) {
         feed();
     }
 
@@ -57,25 +62,115 @@ public:
     inline void destroy( const RecordType* rec ) const { factory_.destroy(rec); }
     inline bool eof() { return eof_; }
 
+    // position in the input of the line which next() returns, the end after the last line
+    inline std::size_t offset() const { return eof_ ? byte_num_ : line_start_; }
+
 private:
     void feed() {
-        while (std::getline(handle_, line_)) {
+        while (line_start_ = byte_num_, std::getline(handle_, line_)) {
             ++line_num_;
+            byte_num_ += line_.size() + 1;
             if (!ignoreLine(line_)) return;
         }
         eof_ = true;
     }
     
     std::ifstream filehandle_;
-    std::istream& handle_;
+    CompressedInputStream handle_;
     std::string line_;
     FactoryType& factory_;
     
     unsigned int line_num_ = 0;
+    std::size_t byte_num_ = 0;
+    std::size_t line_start_ = 0;
+    bool eof_ = false;
+};
+
+
+// same contract as FileParser but the lines are read in place from a memory block
+// and passed to the factory as character ranges without copying
+template< typename FactoryType >
+class MemoryParser {
+public:
+    typedef typename FactoryType::value_type RecordType;
+
+    MemoryParser( const char* begin, const char* end, FactoryType& factory, very_large_unsigned_int line_offset = 0, std::size_t byte_offset = 0 ) : begin_(begin),
+                                                                                                                                                        pos_(begin),
+                                                                                                                                                        end_(end),
+                                                                                                                                                        factory_(factory),
+                                                                                                                                                        line_num_(line_offset),
+                                                                                                                                                        byte_offset_(byte_offset) {
+        feed();
+    }
+
+    MemoryParser( const MappedFile& file, FactoryType& factory ) : begin_(file.begin()),
+                                                                   pos_(file.begin()),
+                                                                   end_(file.end()),
+                                                                   factory_(factory),
+                                                                   byte_offset_(file.offset(file.begin())) {
+        feed();
+    }
+
+    RecordType* next() {
+        try {
+            RecordType* ret = factory_.create(line_begin_, line_end_);
+            feed();
+            return ret;
+        }
+        catch (Exception &e) {
+            e << line_info{line_num_};
+            BOOST_THROW_EXCEPTION(e);
+        }
+        return NULL;  // should never be reached
+    }
+
+    inline void destroy( const RecordType* rec ) const { factory_.destroy(rec); }
+    inline bool eof() { return eof_; }
+
+    // position in the input (the file if mapped) of the line which next() returns, the end after the last line
+    inline std::size_t offset() const { return ( eof_ ? pos_ : line_begin_ ) - begin_ + byte_offset_; }
+
+private:
+    void feed() {
+        while (pos_ < end_) {
+            line_begin_ = pos_;
+            line_end_ = static_cast< const char* >( std::memchr( pos_, endline, end_ - pos_ ) );
+            if (line_end_) pos_ = line_end_ + 1;
+            else pos_ = line_end_ = end_;  // last line without line break
+            ++line_num_;
+            if (line_begin_ == line_end_ || *line_begin_ != default_comment_symbol) return;
+        }
+        eof_ = true;
+    }
+
+    const char* const begin_;
+    const char* pos_;
+    const char* const end_;
+    const char* line_begin_;
+    const char* line_end_;
+    FactoryType& factory_;
+
+    very_large_unsigned_int line_num_ = 0;  // mapped files can have more than 2^32 lines
+    const std::size_t byte_offset_ = 0;
     bool eof_ = false;
 };
 
 
+// selects the parser for a type of input source
+template< typename InputType, typename FactoryType >
+struct ParserSelector;
+
+template< typename FactoryType >
+struct ParserSelector< std::istream, FactoryType > {
+    typedef FileParser< FactoryType > type;
+};
+
+template< typename FactoryType >
+struct ParserSelector< const MappedFile, FactoryType > {
+    typedef MemoryParser< FactoryType > type;
+};
+
+
 template< typename InType, typename FactoryType >  // TODO: not yet working!!
 auto make_file_parser(InType& in, FactoryType& fac) -> FileParser<FactoryType> {
     return FileParser<FactoryType>(in, fac);
@@ -0,0 +1,198 @@
+/*
+taxator-tk predicts the taxon for DNA sequences based on sequence alignment.
+
+Copyright (C) 2010 Johannes Dröge
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef hashindex_hh_
+#define hashindex_hh_
+
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include "exception.hh"
+
+
+
+// On-disk hash table from string keys to small binary payloads which is used
+// in place from a memory-mapped file. The section starts with three 64 bit
+// counts, followed by a power-of-two array of buckets (open addressing with
+// linear probing) and a block of entries "key\0payload". Each bucket holds the
+// entry offset + 1 in the lower 48 bits and the upper 16 bits of the key hash,
+// so that most probes are answered without touching the entry block. The
+// hash function is fixed to make files portable between builds.
+inline boost::uint64_t hashIndexKey( const char* key, std::size_t length ) {
+    boost::uint64_t hash = 14695981039346656037ULL;  // FNV-1a
+    for ( const char* c = key; c != key + length; ++c ) {
+        hash ^= static_cast< unsigned char >( *c );
+        hash *= 1099511628211ULL;
+    }
+    hash ^= hash >> 33;  // mix the lower bits used for bucket selection
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+
+
+// whether the zero-terminated key of entry equals key, like strncmp the entry is
+// not read past its terminator (it may be shorter than key and end the mapping)
+inline bool hashIndexEntryMatches( const char* entry, const char* key, std::size_t length ) {
+    for ( std::size_t i = 0; i < length; ++i ) {
+        if ( entry[i] != key[i] || ! entry[i] ) return false;
+    }
+    return entry[ length ] == '\0';
+}
+
+
+
+class MappedHashIndex {
+public:
+    MappedHashIndex() : buckets_( NULL ), mask_( 0 ), entries_( NULL ), entries_size_( 0 ), size_( 0 ) {};
+
+    // uses the section starting at begin (8 byte aligned) and returns its end
+    const char* attach( const char* begin, const char* end ) {
+        boost::uint64_t counts[3];
+        if ( end - begin < static_cast< std::ptrdiff_t >( sizeof( counts ) ) ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"truncated hash index"} );
+        std::memcpy( counts, begin, sizeof( counts ) );
+        const boost::uint64_t number_buckets = counts[1];
+        if ( ! number_buckets || number_buckets & ( number_buckets - 1 ) || counts[0] >= number_buckets ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"bad hash index"} );
+        if ( static_cast< boost::uint64_t >( end - begin ) < sizeof( counts ) + number_buckets*sizeof( boost::uint64_t ) + counts[2] ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"truncated hash index"} );
+
+        size_ = counts[0];
+        mask_ = number_buckets - 1;
+        buckets_ = reinterpret_cast< const boost::uint64_t* >( begin + sizeof( counts ) );
+        entries_ = reinterpret_cast< const char* >( buckets_ + number_buckets );
+        entries_size_ = counts[2];
+        return entries_ + entries_size_;
+    }
+
+    // pointer to the payload or NULL if the key is not in the index
+    const char* find( const char* key, std::size_t length ) const {
+        const boost::uint64_t hash = hashIndexKey( key, length );
+        const boost::uint64_t tag = hash & tag_mask;
+        for ( boost::uint64_t i = hash & mask_; buckets_[i]; i = ( i + 1 ) & mask_ ) {
+            if ( ( buckets_[i] & tag_mask ) != tag ) continue;
+            const boost::uint64_t offset = ( buckets_[i] & offset_mask ) - 1;
+            if ( offset + length >= entries_size_ ) continue;  // corrupt entry
+            const char* entry = entries_ + offset;
+            if ( hashIndexEntryMatches( entry, key, length ) ) return entry + length + 1;
+        }
+        return NULL;
+    }
+
+    const char* find( const std::string& key ) const {
+        return find( key.data(), key.size() );
+    }
+
+    std::size_t size() const {
+        return size_;
+    }
+
+    static const boost::uint64_t offset_mask = 0x0000ffffffffffffULL;
+    static const boost::uint64_t tag_mask = ~offset_mask;
+
+private:
+    const boost::uint64_t* buckets_;
+    boost::uint64_t mask_;
+    const char* entries_;
+    boost::uint64_t entries_size_;
+    boost::uint64_t size_;
+};
+
+
+
+// collects the entries in memory and writes the section for MappedHashIndex,
+// later insertions of the same key replace the payload
+class HashIndexWriter {
+public:
+    HashIndexWriter() : buckets_( 1024, 0 ), size_( 0 ) {};
+
+    void insert( const char* key, std::size_t length, const char* payload, std::size_t payload_length ) {
+        if ( std::memchr( key, '\0', length ) ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"key contains a null character"} );
+        if ( entries_.size() + length + 1 + payload_length >= MappedHashIndex::offset_mask ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"hash index too large"} );
+        if ( 2*( size_ + 1 ) > buckets_.size() ) grow();  // keep load factor below 1/2
+
+        boost::uint64_t& bucket = probe( key, length );
+        if ( ! bucket ) ++size_;
+        bucket = ( hashIndexKey( key, length ) & MappedHashIndex::tag_mask ) | ( entries_.size() + 1 );
+        entries_.insert( entries_.end(), key, key + length );
+        entries_.push_back( '\0' );
+        entries_.insert( entries_.end(), payload, payload + payload_length );
+    }
+
+    void insert( const std::string& key, const std::string& payload ) {
+        insert( key.data(), key.size(), payload.data(), payload.size() );
+    }
+
+    std::size_t size() const {
+        return size_;
+    }
+
+    // size of the section in bytes (a multiple of 8 so that sections can follow)
+    boost::uint64_t bytes() const {
+        return 3*sizeof( boost::uint64_t ) + buckets_.size()*sizeof( boost::uint64_t ) + paddedEntriesSize();
+    }
+
+    void write( std::ostream& out ) const {
+        const boost::uint64_t counts[3] = { size_, buckets_.size(), paddedEntriesSize() };
+        out.write( reinterpret_cast< const char* >( counts ), sizeof( counts ) );
+        out.write( reinterpret_cast< const char* >( buckets_.data() ), buckets_.size()*sizeof( boost::uint64_t ) );
+        out.write( entries_.data(), entries_.size() );
+        for ( boost::uint64_t i = entries_.size(); i < paddedEntriesSize(); ++i ) out.put( '\0' );
+    }
+
+private:
+    // bucket of key or the empty bucket where it belongs
+    boost::uint64_t& probe( const char* key, std::size_t length ) {
+        const boost::uint64_t mask = buckets_.size() - 1;
+        const boost::uint64_t hash = hashIndexKey( key, length );
+        boost::uint64_t i = hash & mask;
+        for ( ; buckets_[i]; i = ( i + 1 ) & mask ) {
+            if ( ( buckets_[i] & MappedHashIndex::tag_mask ) != ( hash & MappedHashIndex::tag_mask ) ) continue;
+            const char* entry = entries_.data() + ( buckets_[i] & MappedHashIndex::offset_mask ) - 1;
+            if ( hashIndexEntryMatches( entry, key, length ) ) break;
+        }
+        return buckets_[i];
+    }
+
+    void grow() {
+        std::vector< boost::uint64_t > old;
+        old.swap( buckets_ );
+        buckets_.resize( 2*old.size(), 0 );
+        const boost::uint64_t mask = buckets_.size() - 1;
+        for ( std::vector< boost::uint64_t >::const_iterator it = old.begin(); it != old.end(); ++it ) {
+            if ( ! *it ) continue;
+            const char* key = entries_.data() + ( *it & MappedHashIndex::offset_mask ) - 1;
+            boost::uint64_t i = hashIndexKey( key, std::strlen( key ) ) & mask;
+            while ( buckets_[i] ) i = ( i + 1 ) & mask;
+            buckets_[i] = *it;
+        }
+    }
+
+    boost::uint64_t paddedEntriesSize() const {
+        return ( entries_.size() + 7 ) & ~static_cast< boost::uint64_t >( 7 );
+    }
+
+    std::vector< boost::uint64_t > buckets_;
+    std::vector< char > entries_;
+    boost::uint64_t size_;
+};
+
+#endif // hashindex_hh_
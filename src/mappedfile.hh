@@ -0,0 +1,94 @@
+/*
+taxator-tk predicts the taxon for DNA sequences based on sequence alignment.
+
+Copyright (C) 2010 Johannes Dröge
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef mappedfile_hh_
+#define mappedfile_hh_
+
+#include <string>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/interprocess/exceptions.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include "exception.hh"
+
+
+
+// read-only memory mapping of a whole file, the pages are loaded by the OS on access;
+// begin() and end() can be restricted to a part of the file
+class MappedFile : boost::noncopyable {
+public:
+    MappedFile( const std::string& filename, bool sequential_access = true ) : filename_( filename ), first_( 0 ), last_( 0 ) {
+        if ( ! boost::filesystem::exists( filename ) ) BOOST_THROW_EXCEPTION( FileNotFound {} << file_info {filename} );
+        try {
+            if ( boost::filesystem::file_size( filename ) ) {  // cannot map empty files
+                mapping_.reset( new boost::interprocess::file_mapping( filename.c_str(), boost::interprocess::read_only ) );
+                region_.reset( new boost::interprocess::mapped_region( *mapping_, boost::interprocess::read_only ) );
+                if ( sequential_access ) region_->advise( boost::interprocess::mapped_region::advice_sequential );
+                last_ = region_->get_size();
+            }
+        } catch ( boost::interprocess::interprocess_exception& e ) {
+            BOOST_THROW_EXCEPTION( FileError {} << general_info {e.what()} << file_info {filename} );
+        }
+    }
+
+    inline const char* begin() const {
+        return region_ ? static_cast< const char* >( region_->get_address() ) + first_ : NULL;
+    }
+
+    inline const char* end() const {
+        return begin() + size();
+    }
+
+    inline std::size_t size() const {
+        return last_ - first_;
+    }
+
+    // size of the whole file
+    inline std::size_t fileSize() const {
+        return region_ ? region_->get_size() : 0;
+    }
+
+    // position of pos in the file
+    inline std::size_t offset( const char* pos ) const {
+        return pos - begin() + first_;
+    }
+
+    // restricts begin() and end() to the bytes from first to last (exclusive) of the file
+    void select( std::size_t first, std::size_t last ) {
+        if ( first > last || last > fileSize() ) BOOST_THROW_EXCEPTION( FileError {} << general_info {"file range out of bounds"} << file_info {filename_} );
+        first_ = first;
+        last_ = last;
+    }
+
+    inline const std::string& filename() const {
+        return filename_;
+    }
+
+private:
+    const std::string filename_;
+    boost::scoped_ptr< boost::interprocess::file_mapping > mapping_;
+    boost::scoped_ptr< boost::interprocess::mapped_region > region_;
+    std::size_t first_;
+    std::size_t last_;
+};
+
+#endif // mappedfile_hh_
@@ -12,6 +12,8 @@
 #include "utils.hh"
 #include "ncbidata.hh"
 #include "constants.hh"
+#include "exception.hh"
+#include "taxonomysnapshot.hh"
 
 Taxonomy* parseNCBIFlatFiles( const std::string& nodes_filename, const std::string& names_filename, const std::string& version, const std::vector< std::string >* ranks_to_mark ) {
 
@@ -156,6 +158,7 @@ Taxonomy* parseNCBIFlatFiles( const std::string& nodes_filename, const std::stri
                     }
                 } else {
                     tax->setMaxDepth( max_depth );
+                    tax->recreateLCAIndex();
                     return tax; //bad style but efficient
                 }
             } while( true );
@@ -163,12 +166,39 @@ Taxonomy* parseNCBIFlatFiles( const std::string& nodes_filename, const std::stri
     } while( true ); //single exit condition is return
 
     tax->setMaxDepth( max_depth );
+    tax->recreateLCAIndex();
     return tax;
 }
 
 
 
-Taxonomy* loadTaxonomyFromEnvironment( const std::vector< std::string >* ranks_to_mark ) {
+namespace {
+
+// NULL if the snapshot is missing, older than the dump files or not usable (with a
+// warning) or if it was made for other ranks or pruning (sets mismatch)
+Taxonomy* loadSnapshot( const std::string& snapshot_filename, const std::string& nodes_filename, const std::string& names_filename, const std::vector< std::string >* ranks_to_mark, bool delete_unmarked, bool& mismatch ) {
+    if ( ! boost::filesystem::exists( snapshot_filename ) ) return NULL;
+    const std::time_t snapshot_time = boost::filesystem::last_write_time( snapshot_filename );
+    if ( ( boost::filesystem::exists( nodes_filename ) && boost::filesystem::last_write_time( nodes_filename ) > snapshot_time ) ||
+         ( boost::filesystem::exists( names_filename ) && boost::filesystem::last_write_time( names_filename ) > snapshot_time ) ) {
+        std::cerr << "Taxonomy snapshot \"" << snapshot_filename << "\" is older than the dump files, ignoring it" << std::endl;
+        return NULL;
+    }
+    try {
+        Taxonomy* tax = loadTaxonomySnapshot( snapshot_filename, ranks_to_mark, delete_unmarked );
+        if ( ! tax ) mismatch = true;
+        return tax;
+    } catch ( const Exception& ) {
+        std::cerr << "Taxonomy snapshot \"" << snapshot_filename << "\" is not usable, ignoring it" << std::endl;
+    }
+    return NULL;
+}
+
+}
+
+
+
+Taxonomy* loadTaxonomyFromEnvironment( const std::vector< std::string >* ranks_to_mark, bool delete_unmarked, bool use_snapshot ) {
     char* env = getenv( ENVVAR_TAXONOMY_NCBI.c_str() ); //TODO: portability
     if( env == NULL ) {
         std::cerr << "Specify the folder containing the NCBI taxonomy dump files as " << ENVVAR_TAXONOMY_NCBI << " environment variable" << std::endl;
@@ -179,8 +209,21 @@ Taxonomy* loadTaxonomyFromEnvironment( const std::vector< std::string >* ranks_t
     const std::string nodes_filename = ncbi_root_folder + "/nodes.dmp";
     const std::string names_filename = ncbi_root_folder + "/names.dmp";
     const std::string version_filename = ncbi_root_folder + "/version.txt";
+    const std::string snapshot_filename = ncbi_root_folder + "/" + taxonomy_snapshot_filename;
+
+    // compiled snapshot is used unless the dump files are newer, the unpruned companion
+    // of a pruned snapshot serves programs which need the full tree
+    if ( use_snapshot ) {
+        const std::string full_snapshot_filename = taxonomyFullSnapshotFilename( snapshot_filename );
+        const std::string& first = delete_unmarked ? snapshot_filename : full_snapshot_filename;
+        const std::string& second = delete_unmarked ? full_snapshot_filename : snapshot_filename;
+        bool mismatch = false;
+        Taxonomy* tax = loadSnapshot( first, nodes_filename, names_filename, ranks_to_mark, delete_unmarked, mismatch );
+        if ( ! tax ) tax = loadSnapshot( second, nodes_filename, names_filename, ranks_to_mark, delete_unmarked, mismatch );
+        if ( tax ) return tax;
+        if ( mismatch ) std::cerr << "Taxonomy snapshot \"" << snapshot_filename << "\" does not match the requested ranks or pruning, ignoring it" << std::endl;
+    }
 
-    
     if ( ! boost::filesystem::exists( nodes_filename ) ) {
         std::cerr << " \"" << nodes_filename << "\" not found" << std::endl;
         return NULL;
@@ -198,7 +241,9 @@ Taxonomy* loadTaxonomyFromEnvironment( const std::vector< std::string >* ranks_t
         std::getline(versionfile, version);
     }
     
-    return parseNCBIFlatFiles( nodes_filename, names_filename, version, ranks_to_mark );;
+    Taxonomy* tax = parseNCBIFlatFiles( nodes_filename, names_filename, version, ranks_to_mark );
+    if ( tax && delete_unmarked ) tax->deleteUnmarkedNodes();
+    return tax;
 }
 
 
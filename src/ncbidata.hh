@@ -30,7 +30,8 @@ Taxonomy* parseNCBIFlatFiles( const std::string& names, const std::string& nodes
 
 
 
-Taxonomy* loadTaxonomyFromEnvironment( const std::vector< std::string >* ranks_to_mark = NULL );
+// uses the taxonomy snapshot in the same folder if present and up-to-date
+Taxonomy* loadTaxonomyFromEnvironment( const std::vector< std::string >* ranks_to_mark = NULL, bool delete_unmarked = false, bool use_snapshot = true );
 
 
 
@@ -0,0 +1,104 @@
+/*
+taxator-tk predicts the taxon for DNA sequences based on sequence alignment.
+
+Copyright (C) 2010 Johannes Dröge
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef objectpool_hh_
+#define objectpool_hh_
+
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+
+
+
+// Fixed-size memory blocks for objects of type T, allocated contiguously in slabs
+// which are kept until the program ends. Each thread keeps a small cache of free
+// blocks so that objects created by the producer and deleted by the consumer
+// threads are recycled with a lock only every cache_size/2 operations.
+// Use via class-specific operator new and delete.
+template< typename T, std::size_t slab_size = 4096, std::size_t cache_size = 512 >
+class ObjectPool : boost::noncopyable {
+public:
+    static void* allocate() {
+        std::vector< void* >& cache = threadCache().free;
+        if ( cache.empty() ) central().refill( cache, cache_size/2 );
+        void* block = cache.back();
+        cache.pop_back();
+        return block;
+    }
+
+    static void deallocate( void* block ) {
+        std::vector< void* >& cache = threadCache().free;
+        cache.push_back( block );
+        if ( cache.size() >= cache_size ) central().release( cache, cache_size/2 );
+    }
+
+private:
+    typedef typename std::aligned_storage< sizeof( T ), std::alignment_of< T >::value >::type Block;
+
+    class Central : boost::noncopyable {
+    public:
+        ~Central() {
+            for ( typename std::vector< Block* >::iterator it = slabs_.begin(); it != slabs_.end(); ++it ) delete[] *it;
+        }
+
+        void refill( std::vector< void* >& cache, std::size_t number ) {
+            boost::mutex::scoped_lock lock( mutex_ );
+            if ( free_.size() < number ) {
+                Block* slab = new Block[ slab_size ];
+                slabs_.push_back( slab );
+                for ( std::size_t i = slab_size; i; --i ) free_.push_back( slab + i - 1 );  // hand out in address order
+            }
+            cache.insert( cache.end(), free_.end() - number, free_.end() );
+            free_.resize( free_.size() - number );
+        }
+
+        void release( std::vector< void* >& cache, std::size_t number ) {
+            boost::mutex::scoped_lock lock( mutex_ );
+            free_.insert( free_.end(), cache.end() - number, cache.end() );
+            cache.resize( cache.size() - number );
+        }
+
+    private:
+        boost::mutex mutex_;
+        std::vector< void* > free_;
+        std::vector< Block* > slabs_;
+    };
+
+    struct ThreadCache {
+        ~ThreadCache() {
+            central().release( free, free.size() );  // thread objects are destroyed before the static pool
+        }
+        std::vector< void* > free;
+    };
+
+    static Central& central() {
+        static Central pool;
+        return pool;
+    }
+
+    static ThreadCache& threadCache() {
+        static thread_local ThreadCache cache;
+        return cache;
+    }
+};
+
+#endif // objectpool_hh_
@@ -0,0 +1,269 @@
+/*
+taxator-tk predicts the taxon for DNA sequences based on sequence alignment.
+
+Copyright (C) 2010 Johannes Dröge
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef outputwriter_hh_
+#define outputwriter_hh_
+
+#include <cerrno>
+#include <map>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <unistd.h>
+#include <boost/atomic.hpp>
+#include <boost/bind.hpp>
+#include <boost/exception_ptr.hpp>
+#include <boost/lockfree/queue.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+#include "checkpoint.hh"
+#include "exception.hh"
+#include "profiling.hh"
+
+// std::ostream into a string which can be taken without copying
+class StringOutputStream : public std::ostream, boost::noncopyable {
+public:
+    StringOutputStream() : std::ostream( NULL ) {
+        rdbuf( &buffer_ );
+    }
+
+    std::string& str() {
+        return buffer_.data;
+    }
+
+private:
+    struct Buffer : public std::streambuf {
+        int_type overflow( int_type c ) {
+            if ( ! traits_type::eq_int_type( c, traits_type::eof() ) ) data += traits_type::to_char_type( c );
+            return traits_type::not_eof( c );
+        }
+
+        std::streamsize xsputn( const char* s, std::streamsize n ) {
+            data.append( s, n );
+            return n;
+        }
+
+        std::string data;
+    };
+
+    Buffer buffer_;
+};
+
+
+
+// Writes preformatted chunks from several threads to a file descriptor in a single
+// writer thread. Chunks are passed through a lock-free queue; with a reorder window
+// they are written in the order of their sequence numbers (0, 1, 2, ... without
+// gaps) and a thread blocks while its chunk is window or more ahead of the next one
+// to write. Without a window chunks are written as they arrive. Small chunks are
+// collected and written together, large ones directly. With a window and a
+// checkpoint, chunks can be marked with the input position behind the last query
+// they complete, which is saved in the checkpoint when due after the chunk is written.
+// If a stream is given, e.g. for compression, the chunks are written to it instead of
+// the file descriptor.
+class OrderedOutputWriter : boost::noncopyable {
+public:
+    OrderedOutputWriter( int fd, std::size_t reorder_window, Checkpoint* checkpoint = NULL, std::ostream* stream = NULL, std::size_t direct_write_size = 1 << 16 ) :
+        fd_( fd ),
+        stream_( stream ),
+        window_( reorder_window ),
+        direct_write_size_( direct_write_size ),
+        checkpoint_( window_ ? checkpoint : NULL ),
+        queue_( 128 ),
+        next_( 0 ),
+        waiting_( 0 ),
+        sleeping_( false ),
+        closed_( false ),
+        failed_( false ),
+        writer_( boost::bind( &OrderedOutputWriter::work, this ) )
+    {}
+
+    ~OrderedOutputWriter() {
+        if ( writer_.joinable() ) {
+            try {
+                close();
+            } catch ( ... ) {}
+        }
+    }
+
+    // takes the content of data (leaving it empty), the last pending_bytes of data
+    // belong to queries behind the mark
+    void submit( std::size_t sequence, std::string& data, std::size_t mark = 0, std::size_t pending_bytes = 0 ) {
+        if ( window_ && sequence >= next_.load() + window_ ) {
+            boost::mutex::scoped_lock lock( mutex_ );
+            ++waiting_;
+            while ( sequence >= next_.load() + window_ && ! failed_.load() ) space_available_.wait( lock );
+            --waiting_;
+        }
+
+        Chunk* chunk = new Chunk;
+        chunk->sequence = sequence;
+        chunk->mark = mark;
+        chunk->pending_bytes = pending_bytes;
+        chunk->data.swap( data );
+        queue_.push( chunk );
+        if ( sleeping_.load() ) {
+            boost::mutex::scoped_lock lock( mutex_ );
+            data_available_.notify_one();
+        }
+    }
+
+    // call after the last submit, writes everything and rethrows write errors
+    void close() {
+        {
+            boost::mutex::scoped_lock lock( mutex_ );
+            closed_ = true;
+            data_available_.notify_one();
+        }
+        writer_.join();
+        if ( error_ ) boost::rethrow_exception( error_ );
+    }
+
+private:
+    struct Chunk {
+        std::size_t sequence;
+        std::size_t mark;
+        std::size_t pending_bytes;
+        std::string data;
+    };
+
+    void work() {
+        PipelineProfiler::instance().nameThread( "writer" );
+        std::map< std::size_t, Chunk* > pending;  // arrived ahead of the next one
+        std::size_t next = 0;
+        while ( true ) {
+            Chunk* chunk;
+            if ( queue_.pop( chunk ) ) {
+                if ( ! window_ ) write( chunk );
+                else if ( chunk->sequence != next ) pending[ chunk->sequence ] = chunk;
+                else {
+                    write( chunk );
+                    for ( ++next; ! pending.empty() && pending.begin()->first == next; ++next ) {
+                        write( pending.begin()->second );
+                        pending.erase( pending.begin() );
+                    }
+                    advance( next );
+                }
+                continue;
+            }
+
+            flushBuffer();  // do not hold back output while waiting
+            boost::mutex::scoped_lock lock( mutex_ );
+            if ( closed_ && queue_.empty() ) break;
+            sleeping_ = true;
+            if ( queue_.empty() && ! closed_ ) data_available_.timed_wait( lock, boost::posix_time::milliseconds( 10 ) );
+            sleeping_ = false;
+        }
+
+        // gaps only if the input was aborted
+        for ( std::map< std::size_t, Chunk* >::iterator it = pending.begin(); it != pending.end(); ++it ) write( it->second );
+        flushBuffer();
+    }
+
+    void advance( std::size_t next ) {
+        next_.store( next );
+        if ( waiting_.load() ) {
+            boost::mutex::scoped_lock lock( mutex_ );
+            space_available_.notify_all();
+        }
+    }
+
+    void write( Chunk* chunk ) {
+        if ( chunk->data.size() >= direct_write_size_ ) {
+            flushBuffer();
+            writeFD( chunk->data );
+        } else {
+            buffer_ += chunk->data;
+            if ( buffer_.size() >= direct_write_size_ ) flushBuffer();
+        }
+        if ( checkpoint_ && chunk->mark && checkpoint_->due() ) {
+            flushBuffer();
+            if ( ! failed_.load() ) {
+                try {
+                    checkpoint_->save( chunk->mark, chunk->pending_bytes );
+                } catch ( ... ) {
+                    fail();
+                }
+            }
+        }
+        delete chunk;
+    }
+
+    void flushBuffer() {
+        writeFD( buffer_ );
+        buffer_.clear();
+    }
+
+    // after an error the remaining output is dropped
+    void writeFD( const std::string& data ) {
+        if ( failed_.load() || data.empty() ) return;
+        ScopedStage measure_flush( stage_flush );
+        measure_flush.addItems( data.size() );
+        try {
+            if ( stream_ ) {
+                stream_->write( data.data(), data.size() );
+                if ( ! *stream_ ) BOOST_THROW_EXCEPTION( FileError {} << general_info {"could not write output"} );
+                return;
+            }
+            const char* pos = data.data();
+            std::size_t remaining = data.size();
+            while ( remaining ) {
+                const ssize_t n = ::write( fd_, pos, remaining );
+                if ( n < 0 ) {
+                    if ( errno == EINTR ) continue;
+                    BOOST_THROW_EXCEPTION( FileError {} << general_info {"could not write output"} );
+                }
+                pos += n;
+                remaining -= n;
+            }
+        } catch ( ... ) {
+            fail();
+        }
+    }
+
+    // in a catch block
+    void fail() {
+        error_ = boost::current_exception();
+        boost::mutex::scoped_lock lock( mutex_ );
+        failed_ = true;
+        space_available_.notify_all();  // no more waiting for the window
+    }
+
+    const int fd_;
+    std::ostream* const stream_;
+    const std::size_t window_;
+    const std::size_t direct_write_size_;
+    Checkpoint* const checkpoint_;
+    boost::lockfree::queue< Chunk* > queue_;
+    std::string buffer_;  // writer thread only
+    boost::exception_ptr error_;  // read after join
+
+    boost::mutex mutex_;  // only to sleep and wake up
+    boost::condition_variable data_available_;
+    boost::condition_variable space_available_;
+    boost::atomic< std::size_t > next_;  // next sequence to write
+    boost::atomic< std::size_t > waiting_;  // threads waiting for the window
+    boost::atomic< bool > sleeping_;
+    bool closed_;
+    boost::atomic< bool > failed_;
+    boost::thread writer_;  // last, starts when everything else is initialized
+};
+
+#endif // outputwriter_hh_
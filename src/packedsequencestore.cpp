@@ -0,0 +1,162 @@
+#include "packedsequencestore.hh"
+#include <fstream>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include "exception.hh"
+
+
+
+namespace {
+
+struct PackedSequencesHeader {
+    char magic[8];
+    boost::uint32_t format_version;
+    boost::uint32_t reserved;
+    boost::uint64_t number_runs;
+    boost::uint64_t packed_size;
+};
+
+
+
+// collects nucleotides of the current sequence and appends full bytes to a file
+class PackedSequenceWriter {
+public:
+    PackedSequenceWriter( const std::string& filename ) : out_( filename.c_str(), std::ios::binary | std::ios::trunc ), position_( 0 ), byte_( 0 ) {
+        if ( ! out_ ) BOOST_THROW_EXCEPTION( FileError {} << general_info {"could not write packed sequences"} << file_info {filename} );
+        for ( int c = 0; c < 256; ++c ) code_[c] = -1;
+        code_[ 'A' ] = code_[ 'a' ] = 0;
+        code_[ 'C' ] = code_[ 'c' ] = 1;
+        code_[ 'G' ] = code_[ 'g' ] = 2;
+        code_[ 'T' ] = code_[ 't' ] = code_[ 'U' ] = code_[ 'u' ] = 3;
+    }
+
+    void startSequence( PackedSequenceRecord& record, const std::vector< PackedSequenceNRun >& runs ) {
+        record.offset = position_;
+        record.length = 0;
+        record.first_run = runs.size();
+        record.number_runs = 0;
+    }
+
+    void append( const char* begin, const char* end, PackedSequenceRecord& record, std::vector< PackedSequenceNRun >& runs ) {
+        for ( const char* c = begin; c != end; ++c ) {
+            const int code = code_[ static_cast< unsigned char >( *c ) ];
+            if ( code < 0 ) {
+                if ( *c == ' ' || *c == '\t' || *c == '\r' ) continue;
+                if ( record.number_runs && runs.back().start + runs.back().length == record.length ) ++runs.back().length;
+                else {
+                    const PackedSequenceNRun run = { record.length, 1 };
+                    runs.push_back( run );
+                    ++record.number_runs;
+                }
+            }
+            byte_ |= ( code < 0 ? 0 : code ) << ( ( position_ & 3 ) << 1 );
+            ++position_;
+            ++record.length;
+            if ( ! ( position_ & 3 ) ) flushByte();
+        }
+    }
+
+    boost::uint64_t finish() {
+        if ( position_ & 3 ) flushByte();
+        out_.close();
+        if ( ! out_ ) BOOST_THROW_EXCEPTION( FileError {} << general_info {"could not write packed sequences"} );
+        return ( position_ + 3 ) >> 2;
+    }
+
+private:
+    void flushByte() {
+        out_.put( byte_ );
+        byte_ = 0;
+    }
+
+    std::ofstream out_;
+    boost::uint64_t position_;
+    char byte_;
+    int code_[256];
+};
+
+}
+
+
+
+PackedSequenceFile::PackedSequenceFile( const std::string& filename ) : file_( filename, false ) {
+    PackedSequencesHeader header;
+    if ( file_.size() < sizeof( header ) ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"not a packed sequence file"} << file_info {filename} );
+    std::memcpy( &header, file_.begin(), sizeof( header ) );
+    if ( std::memcmp( header.magic, packed_sequences_magic, sizeof( packed_sequences_magic ) ) ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"not a packed sequence file"} << file_info {filename} );
+    if ( header.format_version != packed_sequences_format_version ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"unsupported packed sequence file version"} << file_info {filename} );
+
+    try {
+        const char* runs = index_.attach( file_.begin() + sizeof( header ), file_.end() );
+        if ( static_cast< boost::uint64_t >( file_.end() - runs ) != header.number_runs*sizeof( PackedSequenceNRun ) + header.packed_size ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"truncated packed sequence file"} );
+        runs_ = reinterpret_cast< const PackedSequenceNRun* >( runs );
+        packed_ = reinterpret_cast< const unsigned char* >( runs_ + header.number_runs );
+    } catch ( ParsingError& e ) {
+        e << file_info {filename};
+        throw;
+    }
+}
+
+
+
+bool PackedSequenceFile::detect( const std::string& filename ) {
+    char magic[ sizeof( packed_sequences_magic ) ] = {};
+    std::ifstream file( filename.c_str(), std::ios::binary );
+    file.read( magic, sizeof( magic ) );
+    return file && ! std::memcmp( magic, packed_sequences_magic, sizeof( magic ) );
+}
+
+
+
+void buildPackedSequenceFile( const std::string& fasta_filename, const std::string& packed_filename ) {
+    MappedFile fasta( fasta_filename );
+    const std::string tmp_filename = packed_filename + ".tmp";
+    const std::string tmp_bases_filename = packed_filename + ".tmp.bases";
+
+    HashIndexWriter index;
+    std::vector< PackedSequenceNRun > runs;
+    std::string id;
+    PackedSequenceRecord record;
+    bool in_record = false;
+    boost::uint64_t packed_size;
+    {
+        PackedSequenceWriter writer( tmp_bases_filename );
+        uint line_number = 0;
+        for ( const char* line = fasta.begin(); line != fasta.end(); ) {
+            const char* line_end = static_cast< const char* >( std::memchr( line, '\n', fasta.end() - line ) );
+            if ( ! line_end ) line_end = fasta.end();
+            ++line_number;
+
+            if ( *line == '>' ) {
+                if ( in_record ) index.insert( id.data(), id.size(), reinterpret_cast< const char* >( &record ), sizeof( record ) );
+                id.assign( line + 1, line_end != line + 1 && *( line_end - 1 ) == '\r' ? line_end - 1 : line_end );
+                writer.startSequence( record, runs );
+                in_record = true;
+            } else if ( line != line_end && *line != ';' ) {
+                if ( ! in_record ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"sequence without FASTA header"} << file_info {fasta_filename} << line_info {line_number} );
+                writer.append( line, line_end, record, runs );
+            }
+            line = line_end == fasta.end() ? line_end : line_end + 1;
+        }
+        if ( in_record ) index.insert( id.data(), id.size(), reinterpret_cast< const char* >( &record ), sizeof( record ) );
+        packed_size = writer.finish();
+    }
+
+    {
+        std::ofstream out( tmp_filename.c_str(), std::ios::binary | std::ios::trunc );
+        PackedSequencesHeader header;
+        std::memset( &header, 0, sizeof( header ) );
+        std::memcpy( header.magic, packed_sequences_magic, sizeof( packed_sequences_magic ) );
+        header.format_version = packed_sequences_format_version;
+        header.number_runs = runs.size();
+        header.packed_size = packed_size;
+        out.write( reinterpret_cast< const char* >( &header ), sizeof( header ) );
+        index.write( out );
+        out.write( reinterpret_cast< const char* >( runs.data() ), runs.size()*sizeof( PackedSequenceNRun ) );
+        std::ifstream bases( tmp_bases_filename.c_str(), std::ios::binary );
+        if ( packed_size ) out << bases.rdbuf();
+        if ( ! out ) BOOST_THROW_EXCEPTION( FileError {} << general_info {"could not write packed sequences"} << file_info {tmp_filename} );
+    }
+    boost::filesystem::remove( tmp_bases_filename );
+    boost::filesystem::rename( tmp_filename, packed_filename );
+}
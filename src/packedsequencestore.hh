@@ -0,0 +1,112 @@
+/*
+taxator-tk predicts the taxon for DNA sequences based on sequence alignment.
+
+Copyright (C) 2010 Johannes Dröge
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef packedsequencestore_hh_
+#define packedsequencestore_hh_
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include "hashindex.hh"
+#include "mappedfile.hh"
+
+// Prebuilt FASTA file with 2 bits per nucleotide (A, C, G, T) which is used in
+// place from a memory-mapped file. Other characters are stored as runs of N in a
+// side table. The file consists of a header, a hashed sequence identifier index
+// (see hashindex.hh) with a PackedSequenceRecord as payload, the N-run table and
+// the packed nucleotides, four per byte starting at the lowest bits.
+
+const char packed_sequences_magic[8] = { 'T', 'T', 'K', 'P', 'A', 'C', 'K', 'S' };
+const boost::uint32_t packed_sequences_format_version = 1;
+
+
+
+struct PackedSequenceRecord {
+    boost::uint64_t offset;  // position of the first nucleotide in the packed data
+    boost::uint64_t length;
+    boost::uint64_t first_run;  // position in N-run table
+    boost::uint64_t number_runs;
+};
+
+
+
+struct PackedSequenceNRun {
+    boost::uint64_t start;  // relative to the sequence
+    boost::uint64_t length;
+};
+
+
+
+class PackedSequenceFile : boost::noncopyable {
+public:
+    PackedSequenceFile( const std::string& filename );
+
+    // false if there is no sequence with this identifier
+    bool find( const std::string& id, PackedSequenceRecord& record ) const {
+        const char* payload = index_.find( id );
+        if ( ! payload ) return false;
+        std::memcpy( &record, payload, sizeof( record ) );
+        return true;
+    }
+
+    // writes the nucleotides [begin, end) (0-based) of a sequence to seq
+    template< typename StringType >
+    void extract( const PackedSequenceRecord& record, boost::uint64_t begin, boost::uint64_t end, StringType& seq ) const {
+        static const char nucleotides[] = "ACGT";
+        resize( seq, end - begin );  // seqan string, found by argument-dependent lookup
+        for ( boost::uint64_t i = begin, pos = record.offset + begin; i < end; ++i, ++pos ) {
+            seq[ i - begin ] = nucleotides[ ( packed_[ pos >> 2 ] >> ( ( pos & 3 ) << 1 ) ) & 3 ];
+        }
+
+        const PackedSequenceNRun* runs_end = runs_ + record.first_run + record.number_runs;
+        const PackedSequenceNRun* run = std::lower_bound( runs_ + record.first_run, runs_end, begin, RunEndsBefore() );
+        for ( ; run != runs_end && run->start < end; ++run ) {
+            const boost::uint64_t run_end = std::min( run->start + run->length, end );
+            for ( boost::uint64_t i = std::max( run->start, begin ); i < run_end; ++i ) seq[ i - begin ] = 'N';
+        }
+    }
+
+    std::size_t size() const {
+        return index_.size();
+    }
+
+    static bool detect( const std::string& filename );
+
+private:
+    struct RunEndsBefore {
+        bool operator()( const PackedSequenceNRun& run, boost::uint64_t pos ) const {
+            return run.start + run.length <= pos;
+        }
+    };
+
+    MappedFile file_;
+    MappedHashIndex index_;
+    const PackedSequenceNRun* runs_;
+    const unsigned char* packed_;
+};
+
+
+
+// converts a FASTA file, the full header lines are used as identifiers
+void buildPackedSequenceFile( const std::string& fasta_filename, const std::string& packed_filename );
+
+#endif // packedsequencestore_hh_
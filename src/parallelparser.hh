@@ -0,0 +1,254 @@
+/*
+taxator-tk predicts the taxon for DNA sequences based on sequence alignment.
+
+Copyright (C) 2010 Johannes Dröge
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef parallelparser_hh_
+#define parallelparser_hh_
+
+#include <istream>
+#include <string>
+#include <cstring>
+#include <vector>
+#include <boost/atomic.hpp>
+#include <boost/thread.hpp>
+#include <boost/exception_ptr.hpp>
+#include "types.hh"
+#include "utils.hh"
+#include "alignmentrecord.hh"
+#include "boundedbuffer.hh"
+#include "fileparser.hh"
+#include "mappedfile.hh"
+#include "profiling.hh"
+
+
+
+// extract the query identifier from an alignment line without parsing the rest
+inline const char* queryIdentifierSpan( const char* line, const char* end, const char*& start ) {
+    start = ( line != end && *line == default_mask_symbol ) ? line + 1 : line;
+    const char* stop = static_cast< const char* >( std::memchr( start, default_field_separator[0], end - start ) );
+    return stop ? stop : end;
+}
+
+
+
+// Splits the alignments input into chunks which never cut a block of consecutive
+// alignment lines for the same query. The chunks are parsed concurrently by
+// a number of worker threads and the resulting record sets are handed to the
+// buffer in input order, so the consumers see exactly the same sequence of
+// record sets as with a single producer. BufferType needs a push() for a record set
+// and the position in the input behind its query (0 within a query, see
+// RecordSetGenerator::queryEndOffset()). An error of push() stops the parsing like
+// an error in the input.
+template< typename RecordType, typename RecordSetType, typename BufferType >
+class ParallelRecordSetProducer {
+public:
+    typedef AlignmentRecordFactory< RecordType > FactoryType;
+    typedef MemoryParser< FactoryType > ParserType;
+
+    ParallelRecordSetProducer( BufferType& buffer, FactoryType& fac, bool split_alignments, bool alignments_sorted, uint number_threads, std::size_t chunk_size = 4*1024*1024 ) :
+        buffer_( buffer ),
+        fac_( fac ),
+        split_alignments_( split_alignments ),
+        alignments_sorted_( alignments_sorted ),
+        number_threads_( std::max( number_threads, 1u ) ),
+        chunk_size_( chunk_size ),
+        chunks_( 2*number_threads_ ),
+        next_chunk_( 0 ),
+        failed_( false )
+    {}
+
+    void produce( std::istream& strm ) {
+        boost::thread_group workers;
+        for ( uint i = 0; i < number_threads_; ++i ) workers.create_thread( boost::bind( &ParallelRecordSetProducer::work, this ) );
+
+        std::string line;
+        std::string last_query_id;
+        const char* start;
+        const char* stop;
+        very_large_unsigned_int line_num = 0;
+        large_unsigned_int chunk_index = 0;
+        std::size_t byte_num = 0;
+        Chunk* chunk = new Chunk( chunk_index++, line_num, byte_num );
+
+        while ( std::getline( strm, line ) && ! failed() ) {
+            ++line_num;
+            if ( ! ignoreLine( line ) ) {
+                stop = queryIdentifierSpan( line.data(), line.data() + line.size(), start );
+                if ( last_query_id.compare( 0, std::string::npos, start, stop - start ) ) {  // begin of new query block
+                    if ( chunk->data.size() >= chunk_size_ ) {
+                        chunk->assignData();
+                        chunks_.push( chunk );
+                        chunk = new Chunk( chunk_index++, line_num - 1, byte_num );
+                    }
+                    last_query_id.assign( start, stop );
+                }
+            }
+            chunk->data += line;
+            chunk->data += '\n';
+            byte_num += line.size() + 1;
+        }
+
+        if ( chunk->data.empty() ) delete chunk;
+        else {
+            chunk->assignData();
+            chunks_.push( chunk );
+        }
+        finish( workers );
+    }
+
+    // the chunks point directly into the mapped file, nothing is copied
+    void produce( const MappedFile& file ) {
+        boost::thread_group workers;
+        for ( uint i = 0; i < number_threads_; ++i ) workers.create_thread( boost::bind( &ParallelRecordSetProducer::work, this ) );
+
+        const char* const end = file.end();
+        const char* pos = file.begin();
+        const char* last_query_begin = NULL;
+        const char* last_query_end = NULL;
+        const char* start;
+        const char* stop;
+        very_large_unsigned_int line_num = 0;
+        large_unsigned_int chunk_index = 0;
+        Chunk* chunk = new Chunk( chunk_index++, line_num, file.offset( pos ), pos );
+
+        while ( pos < end && ! failed() ) {
+            const char* line_end = static_cast< const char* >( std::memchr( pos, endline, end - pos ) );
+            if ( ! line_end ) line_end = end;
+            ++line_num;
+            if ( pos == line_end || *pos != default_comment_symbol ) {
+                stop = queryIdentifierSpan( pos, line_end, start );
+                if ( ! last_query_begin || stop - start != last_query_end - last_query_begin || std::memcmp( start, last_query_begin, stop - start ) ) {  // begin of new query block
+                    if ( static_cast< std::size_t >( pos - chunk->begin ) >= chunk_size_ ) {
+                        chunk->end = pos;
+                        chunks_.push( chunk );
+                        chunk = new Chunk( chunk_index++, line_num - 1, file.offset( pos ), pos );
+                    }
+                    last_query_begin = start;
+                    last_query_end = stop;
+                }
+            }
+            pos = line_end == end ? end : line_end + 1;
+        }
+
+        chunk->end = pos;
+        if ( chunk->begin == chunk->end ) delete chunk;
+        else chunks_.push( chunk );
+        finish( workers );
+    }
+
+private:
+    struct Chunk {
+        Chunk( large_unsigned_int idx, very_large_unsigned_int first_line, std::size_t first_byte, const char* first = NULL ) : index( idx ), line_offset( first_line ), byte_offset( first_byte ), begin( first ), end( first ) {}
+        void assignData() {
+            begin = data.data();
+            end = begin + data.size();
+        }
+        const large_unsigned_int index;
+        const very_large_unsigned_int line_offset;
+        const std::size_t byte_offset;  // in the input
+        const char* begin;
+        const char* end;
+        std::string data;  // only used if the input is not in memory
+    };
+
+    BufferType& buffer_;
+    FactoryType& fac_;
+    const bool split_alignments_;
+    const bool alignments_sorted_;
+    const uint number_threads_;
+    const std::size_t chunk_size_;
+    BoundedBuffer< Chunk* > chunks_;
+
+    boost::mutex order_mutex_;
+    boost::condition_variable order_changed_;
+    large_unsigned_int next_chunk_;
+    boost::atomic< bool > failed_;  // checked by the producer for every chunk without locking
+    boost::exception_ptr error_;  // read after all workers finished
+
+    void finish( boost::thread_group& workers ) {
+        for ( uint i = 0; i < number_threads_; ++i ) chunks_.push( NULL );  // one stop signal per worker
+        workers.join_all();
+
+        if ( error_ ) boost::rethrow_exception( error_ );
+    }
+
+    bool failed() const {
+        return failed_.load( boost::memory_order_relaxed );
+    }
+
+    // keeps the first error only
+    void fail() {
+        if ( ! failed_.exchange( true ) ) error_ = boost::current_exception();
+    }
+
+    void work() {
+        PipelineProfiler::instance().nameThread( "parser" );
+        std::vector< RecordSetType > rsets;
+        std::vector< std::size_t > query_end_offsets;
+
+        while ( true ) {
+            Chunk* chunk = chunks_.pop();
+            if ( ! chunk ) return;
+
+            bool parsed = true;
+            ScopedStage measure_parse( stage_parse );
+            try {
+                ParserType parser( chunk->begin, chunk->end, fac_, chunk->line_offset, chunk->byte_offset );
+                boost::scoped_ptr< RecordSetGenerator< RecordType, RecordSetType > > recgen( newRecordSetGenerator< RecordType, RecordSetType >( parser, split_alignments_, alignments_sorted_ ) );
+                while ( recgen->notEmpty() ) {
+                    rsets.push_back( RecordSetType() );
+                    recgen->getNext( rsets.back() );
+                    query_end_offsets.push_back( recgen->queryEndOffset() );
+                }
+            } catch ( ... ) {
+                parsed = false;
+                for ( typename std::vector< RecordSetType >::iterator it = rsets.begin(); it != rsets.end(); ++it ) deleteRecords( *it );
+                rsets.clear();
+                fail();
+            }
+
+            measure_parse.addItems( rsets.size() );
+            measure_parse.stop();
+
+            // wait for the turn of this chunk to keep the input order
+            ScopedStage measure_wait( stage_queue_wait );
+            boost::mutex::scoped_lock lock( order_mutex_ );
+            while ( next_chunk_ != chunk->index ) order_changed_.wait( lock );
+            std::size_t pushed = 0;
+            if ( parsed && ! failed() ) {
+                try {
+                    for ( ; pushed < rsets.size(); ++pushed ) buffer_.push( rsets[pushed], query_end_offsets[pushed] );  // ownership transferred
+                } catch ( ... ) {
+                    fail();
+                }
+            }
+            for ( std::size_t i = pushed; i < rsets.size(); ++i ) deleteRecords( rsets[i] );
+            ++next_chunk_;
+            lock.unlock();
+            measure_wait.stop();
+            order_changed_.notify_all();
+
+            rsets.clear();
+            query_end_offsets.clear();
+            delete chunk;
+        }
+    }
+};
+
+#endif // parallelparser_hh_
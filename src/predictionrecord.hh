@@ -27,6 +27,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <fstream>
 #include <iostream>
 #include "types.hh"
+#include "compression.hh"
 #include "constants.hh"
 #include "taxontree.hh"
 #include "taxonomyinterface.hh"
@@ -305,13 +306,13 @@ protected:
                 std::vector< std::string >::const_iterator it = taxpath.begin();
                 tokenizeSingleCharDelim( *it, taxid_support, ":", 2, false );
                 taxid = boost::lexical_cast< TaxonID >( taxid_support[0] );
-                if ( taxid_support[1].empty() ) support = getQueryFeatureWidth();
+                if ( taxid_support.size() < 2 || taxid_support[1].empty() ) support = getQueryFeatureWidth();
                 else support = boost::lexical_cast< large_unsigned_int >( taxid_support[1] );
                 const TaxonNode* last_node = taxinter_.getNode( taxid );
                 lower_node_ = last_node;
                 std::list< large_unsigned_int > tmp_taxon_support;
 
-                while ( ! (++it)->empty() ) { //last field is empty by definition, if well formed
+                while ( ++it != taxpath.end() && ! it->empty() ) { //support of the last node may be omitted
                     taxid_support.clear();
                     tokenizeSingleCharDelim( *it, taxid_support, ":", 2, false );
                     taxid = boost::lexical_cast< TaxonID >( taxid_support[0] );
@@ -330,7 +331,7 @@ protected:
                         tmp_taxon_support.push_front( support );
                     }
 
-                    if ( ! taxid_support[1].empty() ) support = boost::lexical_cast< large_unsigned_int >( taxid_support[1] );
+                    if ( taxid_support.size() > 1 && ! taxid_support[1].empty() ) support = boost::lexical_cast< large_unsigned_int >( taxid_support[1] );
                     last_node = node;
                 }
                 tmp_taxon_support.push_front( support );
@@ -344,7 +345,7 @@ protected:
                 return;
             }
             if(key == "rtax") {
-                const TaxonNode* rtax_node = taxinter_.getNode( value );
+                const TaxonNode* rtax_node = taxinter_.getNode( boost::lexical_cast< TaxonID >( value ) );
                 setBestReferenceTaxon(rtax_node);
                 return;
             }
@@ -443,8 +444,8 @@ protected:
 template< class PredictionRecordType >
 class PredictionFileParser {
 public:
-    PredictionFileParser( const std::string& filename, const Taxonomy* tax ) : filehandle( filename.c_str() ), handle( filehandle ), tax_( tax ) {};
-    PredictionFileParser( std::istream& strm, const Taxonomy* tax ) : handle( strm ), tax_( tax ) {};
+    PredictionFileParser( const std::string& filename, const Taxonomy* tax, unsigned int decompression_threads = 1 ) : filehandle( filename.c_str() ), handle( filehandle, decompression_threads ), tax_( tax ) {};
+    PredictionFileParser( std::istream& strm, const Taxonomy* tax, unsigned int decompression_threads = 1 ) : handle( strm, decompression_threads ), tax_( tax ) {};
 
     inline void destroyRecord( const PredictionRecordType* rec ) const {
         delete rec;
@@ -467,7 +468,7 @@ public:
 
 protected:
     std::ifstream filehandle;
-    std::istream& handle;
+    CompressedInputStream handle;  // decompresses if needed
     const Taxonomy* tax_;
 };
 
@@ -18,48 +18,244 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 */
 
+#include <algorithm>
+#include <ostream>
 #include <string>
 #include <ctime>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
 #include "types.hh"
 
 #ifndef profiling_hh_
 #define profiling_hh_
 
+// nanoseconds of a POSIX clock, CLOCK_THREAD_CPUTIME_ID only counts the calling thread
+inline boost::uint64_t clockNanoseconds( clockid_t clock ) {
+    timespec t;
+    clock_gettime( clock, &t );
+    return static_cast< boost::uint64_t >( t.tv_sec )*1000000000 + t.tv_nsec;
+}
+
+
+
+// CPU time of the calling thread in milliseconds
 class StopWatchCPUTime {
 	public:
-		StopWatchCPUTime( const std::string& info ) : info_( info ), stopped_(true), sum_( 0 ), counter_( 0 ), conversion_to_milliseconds_( CLOCKS_PER_SEC/1000 ) {}
-		
-// 		~StopWatchCPUTime() {
-// 			std::cerr << info_ << " took: " << static_cast< int >( sum_ ) << '/' << sum_/static_cast< double >( counter_ ) << " (total/avg. in milliseconds)" << std::endl;
-// 		}
+		StopWatchCPUTime( const std::string& info, bool enabled = true ) : info_( info ), enabled_( enabled ), stopped_(true), sum_( 0 ), counter_( 0 ) {}
 		
 		void start() {
-            if(stopped_) {
-                timestamp_ = clock();
+            if(stopped_ && enabled_) {  // disabled watches read zero without reading the clock
+                timestamp_ = clockNanoseconds( CLOCK_THREAD_CPUTIME_ID );
                 stopped_ = false;
             }
 		}
 		
 		void stop() {
 			if(!stopped_) {
-                sum_ += (std::clock() - timestamp_)/conversion_to_milliseconds_;
+                sum_ += clockNanoseconds( CLOCK_THREAD_CPUTIME_ID ) - timestamp_;
                 ++counter_;
                 stopped_ = true;
             }
 		}
 		
 		large_unsigned_int read() {
-            if(stopped_) return sum_;
-            return (std::clock() - timestamp_)/conversion_to_milliseconds_;
+            if(stopped_) return sum_/1000000;
+            return ( sum_ + clockNanoseconds( CLOCK_THREAD_CPUTIME_ID ) - timestamp_ )/1000000;
         }
 		
 	private:
 		const std::string info_;
+        const bool enabled_;
         bool stopped_;
-        clock_t timestamp_;
-		large_unsigned_int sum_;
+        boost::uint64_t timestamp_;
+		boost::uint64_t sum_;
 		large_unsigned_int counter_;
-		const unsigned int conversion_to_milliseconds_;
 };
 
-#endif //profiling_hh_
\ No newline at end of file
+
+
+// stages of taxator's pipeline, may be nested (mapping in parse, sequence retrieval
+// in the passes)
+enum PipelineStage {
+    stage_parse = 0,
+    stage_mapping,
+    stage_queue_wait,
+    stage_sequence_retrieval,
+    stage_pass_0,
+    stage_pass_1,
+    stage_pass_2,
+    stage_output,
+    stage_flush,
+    number_pipeline_stages
+};
+
+inline const char* pipelineStageName( PipelineStage stage ) {
+    static const char* names[] = { "parse", "mapping", "queue_wait", "sequence_retrieval", "pass_0", "pass_1", "pass_2", "output", "flush" };
+    return names[ stage ];
+}
+
+
+
+struct StageProfile {
+    static const std::size_t latency_buckets = 32;  // bucket k counts calls of less than 2^k microseconds
+
+    StageProfile() : calls( 0 ), items( 0 ), wall_ns( 0 ), cpu_ns( 0 ) {
+        std::fill( histogram, histogram + latency_buckets, 0 );
+    }
+
+    void add( boost::uint64_t wall, boost::uint64_t cpu ) {
+        ++calls;
+        wall_ns += wall;
+        cpu_ns += cpu;
+        std::size_t bucket = 0;
+        for ( boost::uint64_t us = wall/1000; us && bucket < latency_buckets - 1; us >>= 1 ) ++bucket;
+        ++histogram[ bucket ];
+    }
+
+    void merge( const StageProfile& other ) {
+        calls += other.calls;
+        items += other.items;
+        wall_ns += other.wall_ns;
+        cpu_ns += other.cpu_ns;
+        for ( std::size_t k = 0; k < latency_buckets; ++k ) histogram[k] += other.histogram[k];
+    }
+
+    boost::uint64_t calls;
+    boost::uint64_t items;  // records, alignments or bytes depending on the stage
+    boost::uint64_t wall_ns;
+    boost::uint64_t cpu_ns;
+    boost::uint64_t histogram[ latency_buckets ];
+};
+
+
+
+struct ThreadProfile {
+    ThreadProfile() : name( "thread" ) {};
+
+    std::string name;
+    StageProfile stages[ number_pipeline_stages ];
+};
+
+
+
+// Per-thread measurements of the pipeline stages, only taken if enabled (before any
+// thread starts). Each thread writes to its own profile which is kept after the
+// thread ends; report() merges them and must be called when all threads are done.
+class PipelineProfiler : boost::noncopyable {
+public:
+    static PipelineProfiler& instance() {
+        static PipelineProfiler profiler;
+        return profiler;
+    }
+
+    void enable() {
+        enabled_ = true;
+        start_ns_ = clockNanoseconds( CLOCK_MONOTONIC );
+    }
+
+    bool enabled() const {
+        return enabled_;
+    }
+
+    // profile of the calling thread
+    ThreadProfile& thread() {
+        ThreadProfile* profile = current_.get();
+        if ( ! profile ) {
+            profile = new ThreadProfile;
+            boost::mutex::scoped_lock lock( mutex_ );
+            threads_.push_back( profile );
+            current_.reset( profile );
+        }
+        return *profile;
+    }
+
+    void nameThread( const std::string& name ) {
+        if ( enabled_ ) thread().name = name;
+    }
+
+    // JSON with the merged stages and the stages per thread
+    void report( std::ostream& os ) const {
+        StageProfile total[ number_pipeline_stages ];
+        for ( boost::ptr_vector< ThreadProfile >::const_iterator it = threads_.begin(); it != threads_.end(); ++it ) {
+            for ( int s = 0; s < number_pipeline_stages; ++s ) total[s].merge( it->stages[s] );
+        }
+
+        os << "{\n  \"wall_seconds\": " << ( clockNanoseconds( CLOCK_MONOTONIC ) - start_ns_ )/1e9 << ",\n  \"stages\": ";
+        writeStages( os, total, "  " );
+        os << ",\n  \"threads\": [";
+        for ( boost::ptr_vector< ThreadProfile >::const_iterator it = threads_.begin(); it != threads_.end(); ++it ) {
+            os << ( it == threads_.begin() ? "\n" : ",\n" ) << "    { \"name\": \"" << it->name << "\", \"stages\": ";
+            writeStages( os, it->stages, "    " );
+            os << " }";
+        }
+        os << "\n  ]\n}\n";
+    }
+
+private:
+    PipelineProfiler() : enabled_( false ), start_ns_( 0 ), current_( &keepProfile ) {};
+
+    static void keepProfile( ThreadProfile* ) {}  // owned by threads_
+
+    static void writeStages( std::ostream& os, const StageProfile* stages, const std::string& indent ) {
+        os << '{';
+        bool first = true;
+        for ( int s = 0; s < number_pipeline_stages; ++s ) {
+            const StageProfile& stage = stages[s];
+            if ( ! stage.calls ) continue;
+            os << ( first ? "\n" : ",\n" ) << indent << "  \"" << pipelineStageName( PipelineStage( s ) ) << "\": { \"calls\": " << stage.calls << ", \"items\": " << stage.items << ", \"wall_seconds\": " << stage.wall_ns/1e9 << ", \"cpu_seconds\": " << stage.cpu_ns/1e9 << ", \"latency_us\": {";
+            bool first_bucket = true;
+            for ( std::size_t k = 0; k < StageProfile::latency_buckets; ++k ) {
+                if ( ! stage.histogram[k] ) continue;
+                os << ( first_bucket ? " " : ", " ) << "\"<" << ( boost::uint64_t( 1 ) << k ) << "\": " << stage.histogram[k];
+                first_bucket = false;
+            }
+            os << " } }";
+            first = false;
+        }
+        os << ( first ? "}" : "\n" + indent + "}" );
+    }
+
+    bool enabled_;
+    boost::uint64_t start_ns_;
+    boost::thread_specific_ptr< ThreadProfile > current_;
+    boost::mutex mutex_;
+    boost::ptr_vector< ThreadProfile > threads_;
+};
+
+
+
+// measures the wall and CPU time of the calling thread in a stage until stop() or
+// destruction, nothing is measured if the profiler is not enabled
+class ScopedStage : boost::noncopyable {
+public:
+    explicit ScopedStage( PipelineStage stage ) : profile_( NULL ) {
+        if ( ! PipelineProfiler::instance().enabled() ) return;
+        profile_ = &PipelineProfiler::instance().thread().stages[ stage ];
+        wall_start_ = clockNanoseconds( CLOCK_MONOTONIC );
+        cpu_start_ = clockNanoseconds( CLOCK_THREAD_CPUTIME_ID );
+    }
+
+    ~ScopedStage() {
+        stop();
+    }
+
+    void addItems( boost::uint64_t n ) {
+        if ( profile_ ) profile_->items += n;
+    }
+
+    void stop() {
+        if ( ! profile_ ) return;
+        profile_->add( clockNanoseconds( CLOCK_MONOTONIC ) - wall_start_, clockNanoseconds( CLOCK_THREAD_CPUTIME_ID ) - cpu_start_ );
+        profile_ = NULL;
+    }
+
+private:
+    StageProfile* profile_;
+    boost::uint64_t wall_start_;
+    boost::uint64_t cpu_start_;
+};
+
+#endif //profiling_hh_
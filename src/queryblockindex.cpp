@@ -0,0 +1,120 @@
+#include "queryblockindex.hh"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include <unistd.h>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include "constants.hh"
+#include "exception.hh"
+
+
+
+namespace {
+
+struct QueryBlocksHeader {
+    char magic[8];
+    boost::uint32_t format_version;
+    boost::uint32_t reserved;
+    boost::uint64_t alignments_size;
+    boost::int64_t alignments_mtime;  // a file of the same size might be regenerated
+    boost::uint64_t number_blocks;
+    boost::uint64_t number_alignments;
+};
+
+
+
+struct HasFewerAlignmentsBefore {
+    HasFewerAlignmentsBefore( std::size_t n ) : n_( n ) {}
+
+    bool operator()( const QueryBlock& block, boost::uint64_t scaled_alignments ) const {
+        return block.alignments_before*n_ < scaled_alignments;
+    }
+
+    const boost::uint64_t n_;
+};
+
+}
+
+
+
+QueryBlockIndex::QueryBlockIndex( const std::string& filename ) : file_( filename, false ) {
+    QueryBlocksHeader header;
+    if ( file_.size() < sizeof( header ) ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"not a query block index"} << file_info {filename} );
+    std::memcpy( &header, file_.begin(), sizeof( header ) );
+    if ( std::memcmp( header.magic, query_blocks_magic, sizeof( query_blocks_magic ) ) ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"not a query block index"} << file_info {filename} );
+    if ( header.format_version != query_blocks_format_version ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"unsupported query block index version"} << file_info {filename} );
+    if ( file_.size() - sizeof( header ) != header.number_blocks*sizeof( QueryBlock ) ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"truncated query block index"} << file_info {filename} );
+
+    blocks_ = reinterpret_cast< const QueryBlock* >( file_.begin() + sizeof( header ) );
+    number_blocks_ = header.number_blocks;
+    number_alignments_ = header.number_alignments;
+    alignments_size_ = header.alignments_size;
+    alignments_mtime_ = header.alignments_mtime;
+}
+
+
+
+bool QueryBlockIndex::indexes( const MappedFile& alignments ) const {
+    return alignments_size_ == alignments.fileSize() && alignments_mtime_ == boost::filesystem::last_write_time( alignments.filename() );
+}
+
+
+
+void QueryBlockIndex::shard( std::size_t i, std::size_t n, std::size_t& first, std::size_t& last ) const {
+    if ( i >= n ) BOOST_THROW_EXCEPTION( GeneralError {} << general_info {"shard number out of range"} );
+    first = shardBegin( i, n );
+    last = shardBegin( i + 1, n );
+}
+
+
+
+std::size_t QueryBlockIndex::shardBegin( std::size_t i, std::size_t n ) const {
+    if ( ! i ) return 0;
+    const QueryBlock* block = std::lower_bound( blocks_, blocks_ + number_blocks_, i*number_alignments_, HasFewerAlignmentsBefore( n ) );
+    return block == blocks_ + number_blocks_ ? alignments_size_ : block->offset;
+}
+
+
+
+void buildQueryBlockIndex( const MappedFile& alignments, const std::string& index_filename ) {
+    std::vector< QueryBlock > blocks;
+    boost::uint64_t number_alignments = 0;
+    const char* query = NULL;  // identifier of the current block
+    std::size_t query_length = 0;
+    for ( const char* line = alignments.begin(); line != alignments.end(); ) {
+        const char* line_end = static_cast< const char* >( std::memchr( line, '\n', alignments.end() - line ) );
+        if ( ! line_end ) line_end = alignments.end();
+
+        if ( line != line_end && *line != default_comment_symbol ) {
+            const char* query_end = std::find( line, line_end, '\t' );
+            if ( ! query || static_cast< std::size_t >( query_end - line ) != query_length || std::memcmp( line, query, query_length ) ) {
+                const QueryBlock block = { alignments.offset( line ), number_alignments };
+                blocks.push_back( block );
+                query = line;
+                query_length = query_end - line;
+            }
+            ++number_alignments;
+        }
+        line = line_end == alignments.end() ? line_end : line_end + 1;
+    }
+
+    // unique name, several processes may build the index at the same time
+    const std::string tmp_filename = index_filename + ".tmp." + boost::lexical_cast< std::string >( getpid() );
+    {
+        std::ofstream out( tmp_filename.c_str(), std::ios::binary | std::ios::trunc );
+        QueryBlocksHeader header;
+        std::memset( &header, 0, sizeof( header ) );
+        std::memcpy( header.magic, query_blocks_magic, sizeof( query_blocks_magic ) );
+        header.format_version = query_blocks_format_version;
+        header.alignments_size = alignments.fileSize();
+        header.alignments_mtime = boost::filesystem::last_write_time( alignments.filename() );
+        header.number_blocks = blocks.size();
+        header.number_alignments = number_alignments;
+        out.write( reinterpret_cast< const char* >( &header ), sizeof( header ) );
+        out.write( reinterpret_cast< const char* >( blocks.data() ), blocks.size()*sizeof( QueryBlock ) );
+        if ( ! out ) BOOST_THROW_EXCEPTION( FileError {} << general_info {"could not write query block index"} << file_info {tmp_filename} );
+    }
+    boost::filesystem::rename( tmp_filename, index_filename );
+}
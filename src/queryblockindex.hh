@@ -0,0 +1,94 @@
+/*
+taxator-tk predicts the taxon for DNA sequences based on sequence alignment.
+
+Copyright (C) 2010 Johannes Dröge
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef queryblockindex_hh_
+#define queryblockindex_hh_
+
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/noncopyable.hpp>
+#include "mappedfile.hh"
+
+// Positions of the query blocks, the consecutive alignment lines of the same query,
+// in an alignments file with the number of alignments before each block. The index is
+// used in place from a memory-mapped file to split the alignments file into shards
+// of whole queries with about the same number of alignments. The file consists of
+// a header and one QueryBlock per block in input order.
+
+const char query_blocks_magic[8] = { 'T', 'T', 'K', 'Q', 'B', 'L', 'K', 'S' };
+const boost::uint32_t query_blocks_format_version = 1;
+
+
+
+struct QueryBlock {
+    boost::uint64_t offset;  // first line in the alignments file
+    boost::uint64_t alignments_before;  // in all earlier blocks
+};
+
+
+
+class QueryBlockIndex : boost::noncopyable {
+public:
+    QueryBlockIndex( const std::string& filename );
+
+    std::size_t size() const {
+        return number_blocks_;
+    }
+
+    boost::uint64_t numberAlignments() const {
+        return number_alignments_;
+    }
+
+    // size of the indexed alignments file
+    boost::uint64_t alignmentsSize() const {
+        return alignments_size_;
+    }
+
+    // modification time of the indexed alignments file
+    boost::int64_t alignmentsModificationTime() const {
+        return alignments_mtime_;
+    }
+
+    // whether the index was built for the current contents of alignments
+    bool indexes( const MappedFile& alignments ) const;
+
+    // byte range [first, last) of shard i (0-based) of n in the alignments file,
+    // the shards cover the whole file
+    void shard( std::size_t i, std::size_t n, std::size_t& first, std::size_t& last ) const;
+
+private:
+    // alignments file position of the first block with at least i/n of the alignments before it
+    std::size_t shardBegin( std::size_t i, std::size_t n ) const;
+
+    MappedFile file_;
+    const QueryBlock* blocks_;
+    boost::uint64_t number_blocks_;
+    boost::uint64_t number_alignments_;
+    boost::uint64_t alignments_size_;
+    boost::int64_t alignments_mtime_;
+};
+
+
+
+// indexes the whole alignments file in a sequential scan, comment lines belong to
+// the block before them
+void buildQueryBlockIndex( const MappedFile& alignments, const std::string& index_filename );
+
+#endif // queryblockindex_hh_
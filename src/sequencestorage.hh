@@ -27,11 +27,16 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <boost/progress.hpp>
 #include <boost/concept_check.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <map>
 #include <set>
 #include <string>
 #include "ncbidata.hh"
 #include <assert.h>
+#include "compression.hh"
 #include "exception.hh"
+#include "packedsequencestore.hh"
 
 
 // This currently works with standard and packed strings
@@ -142,45 +147,128 @@ protected:
 
 
 
-template< typename StringType, bool skip = true, typename Format = seqan::Fasta >
-class SequentialSeqStoreRO : public RandomSeqStoreROInterface<StringType> {
+// Sequences which are read on demand in the order of the record sets. acquire() is
+// called for the query of each record set in input order, release() when the
+// record set is done.
+class SequentialSeqStoreInterface {
 public:
-    SequentialSeqStoreRO ( const std::string& filename ) : strm_( filename.c_str() ), format_( Format() ) {};
+    virtual void acquire ( const std::string& id ) = 0;
+    virtual void release ( const std::string& id ) = 0;
+    virtual ~SequentialSeqStoreInterface() {};
+};
 
-    const StringType& getSequence ( const std::string& id ) {
 
-        if ( id == last_id_ ) return last_entry_;
 
-        seqan::readMeta( strm_, last_id_, format_ );
+// Reads a FASTA file, which may be compressed, once from the beginning to the end
+// when the alignments are in the same query order. Sequences without alignments are
+// skipped and a sequence is only kept while record sets of its query are in flight,
+// so the memory is bounded by the buffer depth. The last sequence read stays for
+// further record sets of its query. acquire() is called by one thread at a time,
+// sequences can be retrieved by any thread.
+template< typename StringType >
+class SequentialSeqStoreRO : public RandomSeqStoreROInterface<StringType>, public SequentialSeqStoreInterface {
+public:
+    SequentialSeqStoreRO ( const std::string& filename ) : filename_( filename ), line_number_( 0 ), has_next_( false ) {
+        if( ! boost::filesystem::exists( filename ) ) BOOST_THROW_EXCEPTION(FileNotFound{} << file_info{filename});
+        input_.reset( new CompressedInputStream( filename ) );
+        while ( ! has_next_ && std::getline( *input_, line_ ) ) {
+            ++line_number_;
+            if ( ! line_.empty() && line_[0] == '>' ) setNextId();
+            else if ( ! line_.empty() && line_[0] != ';' && line_ != "\r" ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"sequence without FASTA header"} << file_info {filename_} << line_info {line_number_} );
+        }
+    };
 
-        if( skip ) {
-            while ( last_id_ != id && ! strm_.eof() ) {
-                std::cerr << "skipping sequence id: " << last_id_ << std::endl;
-                seqan::read( strm_, last_entry_, format_ ); //eat it (is there no better way in seqan?)
-                seqan::readMeta( strm_, last_id_, format_ );
-            };
+    void acquire ( const std::string& id ) {
+        {
+            boost::mutex::scoped_lock lock( mutex_ );
+            typename std::map< std::string, Entry >::iterator find_it = sequences_.find( id );
+            if( find_it != sequences_.end() ) {  // further record set of the query
+                ++find_it->second.record_sets;
+                return;
+            }
         }
 
-        seqan::read( strm_, last_entry_, format_ );
-        
-        if(last_id_ != id) BOOST_THROW_EXCEPTION(SequenceNotFound {} << seqid_info{id});
+        StringType seq;
+        if( ! readSequence( id, seq ) ) BOOST_THROW_EXCEPTION(SequenceNotFound {} << general_info{"query sequences are not in the order of the alignments"} << seqid_info{id} << file_info{filename_});
+        boost::mutex::scoped_lock lock( mutex_ );
+        typename std::map< std::string, Entry >::iterator last_it = sequences_.find( last_id_ );
+        if( last_it != sequences_.end() && ! last_it->second.record_sets ) sequences_.erase( last_it );
+        Entry& entry = sequences_[ id ];
+        seqan::swap( entry.sequence, seq );
+        entry.record_sets = 1;
+        last_id_ = id;
+    };
 
-        return last_entry_;
+    void release ( const std::string& id ) {
+        boost::mutex::scoped_lock lock( mutex_ );
+        typename std::map< std::string, Entry >::iterator find_it = sequences_.find( id );
+        if( find_it != sequences_.end() && ! --find_it->second.record_sets && id != last_id_ ) sequences_.erase( find_it );
     };
 
-    const StringType getSequence ( const std::string& id, large_unsigned_int start, large_unsigned_int stop ) {
-        return seqan::infix ( getSequence ( id ), start - 1, stop );
+    const StringType getSequence ( const std::string& id, large_unsigned_int start, large_unsigned_int stop ) const {
+        boost::mutex::scoped_lock lock( mutex_ );
+        const StringType& query_seq = getEntry( id ).sequence;
+        stop = std::min< large_unsigned_int >( stop, seqan::length( query_seq ) );
+        if( start > seqan::length( query_seq ) ) BOOST_THROW_EXCEPTION(SequenceRangeError{} << general_info{"invalid position"} << seqid_info{id} << position_info{start});
+        StringType seq = seqan::infix ( query_seq, start - 1, stop );
+        return seq;
     };
 
-    const StringType getSequenceReverseComplement ( const std::string& id, large_unsigned_int start, large_unsigned_int stop ) {
-        return seqan::ModifiedString< seqan::ModifiedString< StringType, seqan::ModView< seqan::FunctorComplement< seqan::Dna > > >, seqan::ModReverse> ( seqan::infix ( getSequence ( id ), start, stop ) );
+    const StringType getSequenceReverseComplement ( const std::string& id, large_unsigned_int start, large_unsigned_int stop ) const {
+        StringType seq = getSequence( id, start, stop );
+        seqan::reverseComplement( seq );
+        return seq;
     };
 
 protected:
-    std::ifstream strm_;
-    Format format_;
-    StringType last_entry_;
-    std::string last_id_;
+    struct Entry {
+        StringType sequence;
+        std::size_t record_sets;  // acquired and not yet released
+    };
+
+    const Entry& getEntry ( const std::string& id ) const {
+        typename std::map< std::string, Entry >::const_iterator find_it = sequences_.find( id );
+        if( find_it == sequences_.end() ) BOOST_THROW_EXCEPTION(SequenceNotFound {} << seqid_info{id});
+        return find_it->second;
+    }
+
+    void setNextId () {
+        next_id_.assign( line_, 1, line_.size() - ( line_.size() > 1 && line_[ line_.size() - 1 ] == '\r' ? 2 : 1 ) );
+        has_next_ = true;
+    }
+
+    // reads on until behind the sequence of id, false at the end of the file
+    bool readSequence ( const std::string& id, StringType& seq ) {
+        std::string bases;
+        while ( has_next_ ) {
+            const bool found = next_id_ == id;
+            has_next_ = false;
+            while ( std::getline( *input_, line_ ) ) {
+                ++line_number_;
+                if ( line_.empty() || line_[0] == ';' ) continue;
+                if ( line_[0] == '>' ) {
+                    setNextId();
+                    break;
+                }
+                if ( found ) bases.append( line_, 0, line_.size() - ( line_[ line_.size() - 1 ] == '\r' ) );
+            }
+            if ( found ) {
+                seq = bases;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const std::string filename_;
+    boost::scoped_ptr< CompressedInputStream > input_;
+    std::string line_;
+    uint line_number_;
+    std::string next_id_;  // header of the next sequence in the file
+    bool has_next_;
+    std::string last_id_;  // of the last sequence read
+    std::map< std::string, Entry > sequences_;
+    mutable boost::mutex mutex_;
 };
 
 
@@ -250,6 +338,34 @@ protected:
 
 
 
+template< typename StringType >
+class RandomMappedPackedSeqStoreRO : public RandomSeqStoreROInterface<StringType> {
+public:
+    RandomMappedPackedSeqStoreRO( const std::string& packed_filename ) : file_( packed_filename ) {}
+
+    const StringType getSequence ( const std::string& id, large_unsigned_int start, large_unsigned_int stop ) const {
+        assert( start <= stop );
+        PackedSequenceRecord record;
+        if( ! file_.find( id, record ) ) BOOST_THROW_EXCEPTION(SequenceNotFound {} << seqid_info{id});
+        stop = std::min< large_unsigned_int >( stop, record.length );
+        if( start > record.length ) BOOST_THROW_EXCEPTION(SequenceRangeError{} << general_info{"invalid position"} << seqid_info{id} << position_info{start});
+        StringType seq;
+        file_.extract( record, start - 1, stop, seq );
+        return seq;
+    }
+
+    const StringType getSequenceReverseComplement ( const std::string& id, large_unsigned_int start, large_unsigned_int stop ) const {
+        StringType seq = getSequence( id , start, stop );
+        seqan::reverseComplement( seq );
+        return seq;
+    }
+
+protected:
+    PackedSequenceFile file_;
+};
+
+
+
 void populateIdentSet( std::set< std::string >& whitelist, const std::string& filename ) {
     std::ifstream flatfile( filename.c_str() );
     std::string line;
@@ -187,9 +187,9 @@ namespace sqlite3pp
 
   statement::~statement()
   {
-    int rc = finish();
-    if (rc != SQLITE_OK)
-      throw database_error(db_);
+    // finalizing only repeats the error of the last step which was reported there,
+    // throwing here would terminate
+    finish();
   }
 
   int statement::prepare(char const* stmt)
@@ -485,10 +485,10 @@ namespace sqlite3pp
 
   transaction::~transaction()
   {
+    // runs while unwinding from the error which aborted the transaction, throwing
+    // here would terminate; sqlite rolls back a pending transaction on close
     if (db_) {
-      int rc = db_->execute(fcommit_ ? "COMMIT" : "ROLLBACK");
-      if (rc != SQLITE_OK)
-	throw database_error(*db_);
+      db_->execute(fcommit_ ? "COMMIT" : "ROLLBACK");
     }
   }
 
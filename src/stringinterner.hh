@@ -0,0 +1,100 @@
+/*
+taxator-tk predicts the taxon for DNA sequences based on sequence alignment.
+
+Copyright (C) 2010 Johannes Dröge
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef stringinterner_hh_
+#define stringinterner_hh_
+
+#include <cstring>
+#include <string>
+#include <utility>
+#include <boost/functional/hash.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_set.hpp>
+
+
+
+// Keeps exactly one copy of each distinct string for the lifetime of the program,
+// meant for the small set of reference identifiers that occur in millions of
+// alignments. Every thread has its own index of the strings it has seen, so the
+// shared table is locked only on the first occurence per thread.
+class StringInterner : boost::noncopyable {
+public:
+    static const std::string& intern( const char* begin, const char* end ) {
+        const CharRange key( begin, end );
+        LocalIndex& local = localIndex();
+        LocalIndex::const_iterator it = local.find( key, Hash(), Equal() );
+        if ( it != local.end() ) return **it;
+
+        const std::string* str = &global().insert( key );
+        local.insert( str );
+        return *str;
+    }
+
+    static const std::string& intern( const std::string& str ) {
+        return intern( str.data(), str.data() + str.size() );
+    }
+
+private:
+    typedef std::pair< const char*, const char* > CharRange;
+
+    struct Hash {
+        std::size_t operator()( const CharRange& key ) const { return boost::hash_range( key.first, key.second ); }
+        std::size_t operator()( const std::string& str ) const { return boost::hash_range( str.data(), str.data() + str.size() ); }
+        std::size_t operator()( const std::string* str ) const { return operator()( *str ); }
+    };
+
+    struct Equal {
+        bool operator()( const CharRange& key, const std::string& str ) const {
+            return static_cast< std::size_t >( key.second - key.first ) == str.size() && ! std::memcmp( key.first, str.data(), str.size() );
+        }
+        bool operator()( const CharRange& key, const std::string* str ) const { return operator()( key, *str ); }
+        bool operator()( const std::string* a, const std::string* b ) const { return *a == *b; }
+        bool operator()( const std::string& a, const std::string& b ) const { return a == b; }
+    };
+
+    typedef boost::unordered_set< const std::string*, Hash, Equal > LocalIndex;
+
+    class Table : boost::noncopyable {
+    public:
+        const std::string& insert( const CharRange& key ) {
+            boost::mutex::scoped_lock lock( mutex_ );
+            boost::unordered_set< std::string, Hash, Equal >::const_iterator it = strings_.find( key, Hash(), Equal() );
+            if ( it == strings_.end() ) it = strings_.insert( std::string( key.first, key.second ) ).first;
+            return *it;  // elements never move in a node-based container
+        }
+
+    private:
+        boost::mutex mutex_;
+        boost::unordered_set< std::string, Hash, Equal > strings_;
+    };
+
+    static Table& global() {
+        static Table table;
+        return table;
+    }
+
+    static LocalIndex& localIndex() {
+        static thread_local LocalIndex index;
+        return index;
+    }
+};
+
+#endif // stringinterner_hh_
@@ -23,6 +23,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <string>
 #include <fstream>
+#include <deque>
 #include <boost/iterator/iterator_concepts.hpp>
 #include <boost/lexical_cast.hpp>
 #include "types.hh"
@@ -122,7 +123,14 @@ class NewickTaxonFilter : public TaxonFilter {
 					
 					// append node name
 					if ( show_names_ ) l.push_back( &node->data->annotation->name );
-					else l.push_back( &node->data->taxid );  // only if we can ensure TaxID == std::string
+#ifdef NUMERIC_TAXONID
+					else {
+						taxid_labels_.push_back( boost::lexical_cast< std::string >( node->data->taxid ) );
+						l.push_back( &taxid_labels_.back() );  // references in a deque stay valid
+					}
+#else
+					else l.push_back( &node->data->taxid );
+#endif
 					
 					// go to next parent
 					const TaxonNode* parent = node->parent;
@@ -151,6 +159,7 @@ class NewickTaxonFilter : public TaxonFilter {
 		const bool show_names_;
 		const bool fill_empty_ranks_;
 		std::vector< nodemap > newicklists;
+		std::deque< std::string > taxid_labels_;
 		static const std::string description_;
 };
 
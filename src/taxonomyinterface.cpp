@@ -6,9 +6,9 @@
 
 
 const TaxonNode* TaxonomyInterface::getNode ( const TaxonID taxid ) const {
-	std::map< TaxonID, TaxonNode* >::const_iterator node_it = tax->taxid2node_.find( taxid );
-	if(node_it == tax->taxid2node_.end()) BOOST_THROW_EXCEPTION(TaxonNotFound {} << taxid_info{taxid});
-	return node_it->second;
+	const TaxonNode* node = tax->taxid2node_.find( taxid );
+	if( ! node ) BOOST_THROW_EXCEPTION(TaxonNotFound {} << taxid_info{taxid});
+	return node;
 }
 
 
@@ -65,6 +65,13 @@ bool TaxonomyInterface::isParentOf ( const TaxonID A_taxid, const TaxonID B_taxi
 
 
 const TaxonNode* TaxonomyInterface::getLCA ( const TaxonNode* A, const TaxonNode* B ) const {
+	if( ! tax->lca_index_.empty() ) {
+		if( A == B || isParentOf( A, B ) ) return A;
+		if( isParentOf( B, A ) ) return B;
+		return tax->lca_index_.query( A, B );
+	}
+
+	// walk up from A if there is no index
 	large_unsigned_int left_min = std::min( A->data->leftvalue, B->data->rightvalue );
 	large_unsigned_int right_max = std::max( A->data->rightvalue, B->data->rightvalue );
 
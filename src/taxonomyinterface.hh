@@ -37,6 +37,9 @@ class TaxonomyInterface {
     const TaxonNode* getNode( const TaxonID taxid ) const;
     const TaxonNode* getRoot() const;
     small_unsigned_int getMaxDepth() { return tax->max_depth_; }
+    // nodes are numbered from 0 in pre-order (Taxon::preorder)
+    large_unsigned_int getNumberNodes() const { return tax->preorder_nodes_.size(); }
+    const TaxonNode* getNodeByPreorder( large_unsigned_int preorder ) const { return tax->preorder_nodes_[ preorder ]; }
 
     const std::string& getRank( const TaxonNode* node ) const;
     const std::string& getRank( const TaxonID taxid ) const;
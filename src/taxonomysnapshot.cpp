@@ -0,0 +1,237 @@
+#include "taxonomysnapshot.hh"
+#include "taxonomyinterface.hh"
+#include "mappedfile.hh"
+#include "exception.hh"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <boost/cstdint.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/unordered_map.hpp>
+
+
+
+namespace {
+
+const char snapshot_magic[8] = { 'T', 'T', 'K', 'T', 'A', 'X', 'S', '\0' };
+const boost::uint32_t no_rank = 0xffffffff;  // node without annotation
+const boost::uint32_t no_parent = 0xffffffff;
+
+struct SnapshotHeader {
+    char magic[8];
+    boost::uint32_t format_version;
+    boost::uint32_t pruned;
+    boost::uint64_t number_nodes;
+    boost::uint64_t number_ranks;
+    boost::uint64_t number_marked_ranks;
+    boost::uint64_t strings_size;
+    boost::uint32_t version;  // string offset
+    boost::uint32_t max_depth;
+};
+
+struct SnapshotNode {
+    boost::uint32_t parent;  // position in pre-order
+    boost::uint32_t taxid;  // string offset
+    boost::uint32_t name;  // string offset
+    boost::uint32_t rank;  // position in rank table
+    boost::uint32_t leftvalue;
+    boost::uint32_t rightvalue;
+    boost::uint8_t root_pathlength;
+    boost::uint8_t mark_special;
+    boost::uint8_t is_unclassified;
+    boost::uint8_t padding;
+};
+
+
+
+class StringBlock {
+public:
+    boost::uint32_t add( const std::string& str ) {
+        const boost::uint32_t offset = data_.size();
+        data_.append( str );
+        data_.push_back( '\0' );
+        return offset;
+    }
+
+    const std::string& data() const {
+        return data_;
+    }
+
+private:
+    std::string data_;
+};
+
+
+
+std::vector< std::string > sortedRanks( const std::vector< std::string >* ranks ) {
+    std::vector< std::string > sorted;
+    if( ranks ) sorted = *ranks;
+    std::sort( sorted.begin(), sorted.end() );
+    sorted.erase( std::unique( sorted.begin(), sorted.end() ), sorted.end() );
+    return sorted;
+}
+
+
+
+inline bool validString( boost::uint32_t offset, const SnapshotHeader* header ) {
+    return offset < header->strings_size;  // the last string is zero-terminated
+}
+
+
+
+// adds number*width to total, false on overflow
+inline bool addSection( boost::uint64_t& total, boost::uint64_t number, boost::uint64_t width ) {
+    const boost::uint64_t max = ~boost::uint64_t( 0 );
+    if( number > ( max - total )/width ) return false;
+    total += number*width;
+    return true;
+}
+
+
+
+template< typename T >
+void writeBinary( std::ofstream& out, const T* data, std::size_t number ) {
+    out.write( reinterpret_cast< const char* >( data ), number*sizeof( T ) );
+}
+
+}
+
+
+
+void writeTaxonomySnapshot( const Taxonomy& tax, const std::string& filename, const std::vector< std::string >& ranks_to_mark, bool pruned ) {
+    TaxonomyInterface taxinter( &tax );
+    StringBlock strings;
+    std::vector< boost::uint32_t > rank_offsets, marked_offsets;
+    boost::unordered_map< const std::string*, boost::uint32_t > rank_index;
+    boost::unordered_map< const TaxonNode*, boost::uint32_t > node_index;
+    std::vector< SnapshotNode > nodes;
+    nodes.reserve( tax.size() );
+
+    const std::vector< std::string > marked = sortedRanks( &ranks_to_mark );
+    for( std::vector< std::string >::const_iterator it = marked.begin(); it != marked.end(); ++it ) marked_offsets.push_back( strings.add( *it ) );
+
+    const std::set< std::string >& ranks = tax.getRanksInternal();
+    for( std::set< std::string >::const_iterator it = ranks.begin(); it != ranks.end(); ++it ) {
+        rank_index[ &*it ] = rank_offsets.size();
+        rank_offsets.push_back( strings.add( *it ) );
+    }
+
+    for( Taxonomy::pre_order_iterator node_it = tax.begin(); node_it != tax.end(); ++node_it ) {
+        const Taxon& taxon = **node_it;
+        SnapshotNode node;
+        std::memset( &node, 0, sizeof( node ) );
+        node.parent = node_it.node->parent ? node_index[ node_it.node->parent ] : no_parent;
+        node.taxid = strings.add( boost::lexical_cast< std::string >( taxon.taxid ) );
+        if( taxon.annotation ) {
+            node.name = strings.add( taxon.annotation->name );
+            node.rank = rank_index[ &taxon.annotation->rank ];
+        } else node.rank = no_rank;
+        node.leftvalue = taxon.leftvalue;
+        node.rightvalue = taxon.rightvalue;
+        node.root_pathlength = taxon.root_pathlength;
+        node.mark_special = taxon.mark_special;
+        node.is_unclassified = taxon.is_unclassified;
+        node_index[ node_it.node ] = nodes.size();
+        nodes.push_back( node );
+    }
+
+    SnapshotHeader header;
+    std::memset( &header, 0, sizeof( header ) );
+    std::memcpy( header.magic, snapshot_magic, sizeof( snapshot_magic ) );
+    header.format_version = taxonomy_snapshot_format_version;
+    header.pruned = pruned;
+    header.number_nodes = nodes.size();
+    header.number_ranks = rank_offsets.size();
+    header.number_marked_ranks = marked_offsets.size();
+    header.version = strings.add( taxinter.getVersion() );
+    header.max_depth = taxinter.getMaxDepth();
+    header.strings_size = strings.data().size();
+
+    const std::string tmp_filename = filename + ".tmp";
+    {
+        std::ofstream out( tmp_filename.c_str(), std::ios::binary | std::ios::trunc );
+        if( ! out ) BOOST_THROW_EXCEPTION( FileError {} << general_info {"could not write taxonomy snapshot"} << file_info {tmp_filename} );
+        writeBinary( out, &header, 1 );
+        writeBinary( out, rank_offsets.data(), rank_offsets.size() );
+        writeBinary( out, marked_offsets.data(), marked_offsets.size() );
+        writeBinary( out, nodes.data(), nodes.size() );
+        writeBinary( out, strings.data().data(), strings.data().size() );
+        if( ! out ) BOOST_THROW_EXCEPTION( FileError {} << general_info {"could not write taxonomy snapshot"} << file_info {tmp_filename} );
+    }
+    boost::filesystem::rename( tmp_filename, filename );  // readers never see a partial file
+}
+
+
+
+Taxonomy* loadTaxonomySnapshot( const std::string& filename, const std::vector< std::string >* ranks_to_mark, bool delete_unmarked ) {
+    MappedFile file( filename );
+    const char* const begin = file.begin();
+
+    // check integrity before touching anything else
+    const SnapshotHeader* header = reinterpret_cast< const SnapshotHeader* >( begin );
+    if( file.size() < sizeof( SnapshotHeader ) || std::memcmp( header->magic, snapshot_magic, sizeof( snapshot_magic ) ) ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"not a taxonomy snapshot"} << file_info {filename} );
+    if( header->format_version != taxonomy_snapshot_format_version ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"unsupported taxonomy snapshot version"} << file_info {filename} );
+
+    // sections must add up to the file size exactly, checked before forming any pointer
+    boost::uint64_t expected_size = sizeof( SnapshotHeader );
+    bool sized = addSection( expected_size, header->number_ranks, sizeof( boost::uint32_t ) )
+        && addSection( expected_size, header->number_marked_ranks, sizeof( boost::uint32_t ) )
+        && addSection( expected_size, header->number_nodes, sizeof( SnapshotNode ) )
+        && addSection( expected_size, header->strings_size, sizeof( char ) );
+    if( ! sized || expected_size != file.size() ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"truncated taxonomy snapshot"} << file_info {filename} );
+
+    const boost::uint32_t* rank_offsets = reinterpret_cast< const boost::uint32_t* >( begin + sizeof( SnapshotHeader ) );
+    const boost::uint32_t* marked_offsets = rank_offsets + header->number_ranks;
+    const SnapshotNode* nodes = reinterpret_cast< const SnapshotNode* >( marked_offsets + header->number_marked_ranks );
+    const char* strings = reinterpret_cast< const char* >( nodes + header->number_nodes );
+    if( ! header->number_nodes || ! header->strings_size || strings[ header->strings_size - 1 ] ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"truncated taxonomy snapshot"} << file_info {filename} );
+
+    // all references must point into the file, a corrupt file must not crash the loader
+    bool valid = validString( header->version, header );
+    for( boost::uint64_t i = 0; valid && i < header->number_ranks; ++i ) valid = validString( rank_offsets[i], header );
+    for( boost::uint64_t i = 0; valid && i < header->number_marked_ranks; ++i ) valid = validString( marked_offsets[i], header );
+    for( boost::uint64_t i = 0; valid && i < header->number_nodes; ++i ) {
+        const SnapshotNode& node = nodes[i];
+        valid = ( node.parent == no_parent ? i == 0 : node.parent < i )
+            && ( node.rank == no_rank || node.rank < header->number_ranks )
+            && validString( node.taxid, header )
+            && ( node.rank == no_rank || validString( node.name, header ) );
+    }
+    if( ! valid ) BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"corrupt taxonomy snapshot"} << file_info {filename} );
+
+    // must be made for the same ranks and contain all needed nodes
+    std::vector< std::string > marked;
+    for( boost::uint64_t i = 0; i < header->number_marked_ranks; ++i ) marked.push_back( strings + marked_offsets[i] );
+    if( marked != sortedRanks( ranks_to_mark ) || ( header->pruned && ! delete_unmarked ) ) return NULL;
+
+    std::unique_ptr< Taxonomy > tax( new Taxonomy( strings + header->version ) );  // released on success only
+    std::vector< const std::string* > ranks( header->number_ranks );
+    for( boost::uint64_t i = 0; i < header->number_ranks; ++i ) ranks[i] = &tax->insertRankInternal( strings + rank_offsets[i] );
+
+    std::vector< Taxonomy::iterator > tree_nodes( header->number_nodes );
+    for( boost::uint64_t i = 0; i < header->number_nodes; ++i ) {
+        const SnapshotNode& node = nodes[i];
+        Taxon* taxon = new Taxon( node.rank == no_rank ? NULL : new TaxonAnnotation( *ranks[ node.rank ], strings + node.name ) );
+        try {
+            taxon->taxid = boost::lexical_cast< TaxonID >( strings + node.taxid );
+        } catch( boost::bad_lexical_cast& ) {
+            delete taxon;
+            BOOST_THROW_EXCEPTION( ParsingError {} << general_info {"corrupt taxonomy snapshot"} << file_info {filename} );
+        }
+        taxon->leftvalue = node.leftvalue;
+        taxon->rightvalue = node.rightvalue;
+        taxon->root_pathlength = node.root_pathlength;
+        taxon->mark_special = node.mark_special;
+        taxon->is_unclassified = node.is_unclassified;
+        if( node.parent == no_parent ) tree_nodes[i] = tax->set_head( taxon );
+        else tree_nodes[i] = tax->append_child( tree_nodes[ node.parent ], taxon );  // pre-order keeps the order of siblings
+        tax->addToIndex( taxon->taxid, tree_nodes[i].node );
+    }
+    tax->setMaxDepth( header->max_depth );
+
+    if( delete_unmarked && ! header->pruned ) tax->deleteUnmarkedNodes();  // also builds the LCA index
+    else tax->recreateLCAIndex();
+    return tax.release();
+}
@@ -0,0 +1,54 @@
+/*
+taxator-tk predicts the taxon for DNA sequences based on sequence alignment.
+
+Copyright (C) 2010 Johannes Dröge
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef taxonomysnapshot_hh_
+#define taxonomysnapshot_hh_
+
+#include <string>
+#include <vector>
+#include "taxontree.hh"
+
+// Binary image of a parsed (and possibly pruned) taxonomy which is memory-mapped
+// and turned into a tree without any text parsing. The file consists of a header,
+// the rank name table, the list of marked ranks, the nodes in pre-order and a block
+// of zero-terminated strings which are referenced by their offsets. All numbers are
+// stored in the byte order of the machine that wrote the file.
+
+const std::string taxonomy_snapshot_filename = "taxonomy.snapshot";
+
+// a pruned snapshot is accompanied by the full tree for programs like taxknife
+inline std::string taxonomyFullSnapshotFilename( const std::string& snapshot_filename ) {
+    return snapshot_filename + ".full";
+}
+const unsigned int taxonomy_snapshot_format_version = 1;
+
+
+
+// writes tax to filename (atomically via a temporary file), ranks_to_mark must be
+// the rank list used to load tax and pruned tells whether unmarked nodes were deleted
+void writeTaxonomySnapshot( const Taxonomy& tax, const std::string& filename, const std::vector< std::string >& ranks_to_mark, bool pruned );
+
+
+
+// returns NULL if the snapshot was made for other ranks or is pruned while the full
+// tree is needed, unmarked nodes are deleted after loading if requested
+Taxonomy* loadTaxonomySnapshot( const std::string& filename, const std::vector< std::string >* ranks_to_mark, bool delete_unmarked );
+
+#endif // taxonomysnapshot_hh_
@@ -29,6 +29,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <boost/tuple/tuple_comparison.hpp>
 #include <boost/format.hpp>
 #include <assert.h>
+#include <algorithm>
 #include <limits>
 #include <set>
 #include <ostream>
@@ -36,6 +37,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "taxonpredictionmodel.hh"
 #include "sequencestorage.hh"
 #include "profiling.hh"
+#include "editdistance.hh"
+#include "alignmentscorecache.hh"
+#include "threadpool.hh"
+#include "decisionlog.hh"
 
 // helper class
 class BandFactor {
@@ -109,23 +114,25 @@ private:
 template< typename ContainerT, typename QStorType, typename DBStorType >
 class RPAPredictionModel : public TaxonPredictionModel< ContainerT > {
 public:
-    RPAPredictionModel(const Taxonomy* tax, QStorType& q_storage, const DBStorType& db_storage, float exclude_factor ,float reeval_bandwidth = .1) :
+    RPAPredictionModel(const Taxonomy* tax, QStorType& q_storage, const DBStorType& db_storage, float exclude_factor ,float reeval_bandwidth = .1, AlignmentScoreCache* score_cache = NULL, ThreadPool* pool = NULL, uint parallel_threshold = 0, DecisionLog::Level log_level = DecisionLog::alignments, DecisionLog::Format log_format = DecisionLog::text) :
         TaxonPredictionModel< ContainerT >(tax),
         query_sequences_(q_storage),
         db_sequences_(db_storage),
+        score_cache_(score_cache),
+        pool_(pool),
+        parallel_threshold_(parallel_threshold),
+        log_level_(log_level),
+        log_format_(log_format),
         exclude_alignments_factor_(exclude_factor),
-        reeval_bandwidth_factor_(1. - reeval_bandwidth),
-        measure_sequence_retrieval_("sequence retrieval using index"),
-        measure_pass_0_alignment_("best reference re-evaluation alignments (pass 0)"),
-        measure_pass_1_alignment_("best reference anchor alignments (pass 1)"),
-        measure_pass_2_alignment_("distant anchor alignments (pass 2)")
+        reeval_bandwidth_factor_(1. - reeval_bandwidth)
     {};
 
     void predict(ContainerT& recordset, PredictionRecord& prec, std::ostream& logsink) {
         this->initPredictionRecord(recordset, prec);  // set query name and length
         const std::string& qid = prec.getQueryIdentifier();
-        boost::format seqname_fmt("%d:%d@%s");  // local variable because not thread-safe
-        StopWatchCPUTime stopwatch_init("initializing this record");  // log overall time for this predict phase
+        DecisionLog log(logsink, log_level_, log_format_);
+        const bool timed = log.enabled(DecisionLog::summary);  // times are only logged
+        StopWatchCPUTime stopwatch_init("initializing this record", timed);  // log overall time for this predict phase
         stopwatch_init.start();
 
         // push records into active_records  TODO: remove intermediate active_records?
@@ -139,11 +146,16 @@ public:
         
         // with no unmasked alignment, set to unclassified and return
         if(n==0) {  //TODO: record should not be reported at all in GFF3
-            const std::string qrseqname = boost::str(seqname_fmt % -1 % -1 % qid);
-            logsink << "ID" << tab << qrseqname << std::endl;
-            logsink << "  NUMREF" << tab << n << std::endl << std::endl;
-            logsink << "    RANGE\t" << this->taxinter_.getRoot()->data->annotation->name << tab << this->taxinter_.getRoot()->data->annotation->name << tab << this->taxinter_.getRoot()->data->annotation->name << std::endl << std::endl;
-            logsink << "STATS" << tab << qrseqname << tab << n << "\t0\t0\t0\t0\t0\t0\t0\t.0" << std::endl << std::endl;
+            if(log.enabled(DecisionLog::summary)) {
+                const std::string qrseqname = boost::str(boost::format("%d:%d@%s") % -1 % -1 % qid);
+                log.event(DecisionLog::query_id) << qrseqname;
+                log.event(DecisionLog::numref) << n;
+                log.event(DecisionLog::blank);
+                log.event(DecisionLog::range) << this->taxinter_.getRoot() << this->taxinter_.getRoot() << this->taxinter_.getRoot();
+                log.event(DecisionLog::blank);
+                log.event(DecisionLog::stats_trivial) << qrseqname << n << 0u;
+                log.event(DecisionLog::blank);
+            }
             
             TaxonPredictionModel< ContainerT >::setUnclassified(prec);
             return;
@@ -154,12 +166,16 @@ public:
             typename ContainerT::value_type rec = active_records.front();
             large_unsigned_int qrstart = rec->getQueryStart();
             large_unsigned_int qrstop = rec->getQueryStop();
-            const std::string qrseqname = boost::str(seqname_fmt % qrstart % qrstop % qid);
             
-            logsink << "ID" << tab << qrseqname << std::endl;
-            logsink << "  NUMREF" << tab << n << std::endl;
-            logsink << "  RANGE\t" << rec->getReferenceNode()->data->annotation->name << tab << rec->getReferenceNode()->data->annotation->name << tab << this->taxinter_.getRoot()->data->annotation->name << std::endl << std::endl;
-            logsink << "STATS" << tab << qrseqname << tab << n << "\t0\t0\t0\t0\t0\t0\t0\t.0" << std::endl << std::endl;
+            if(log.enabled(DecisionLog::summary)) {
+                const std::string qrseqname = boost::str(boost::format("%d:%d@%s") % qrstart % qrstop % qid);
+                log.event(DecisionLog::query_id) << qrseqname;
+                log.event(DecisionLog::numref) << n;
+                log.event(DecisionLog::query_range) << rec->getReferenceNode() << rec->getReferenceNode() << this->taxinter_.getRoot();
+                log.event(DecisionLog::blank);
+                log.event(DecisionLog::stats_trivial) << qrseqname << n << 0u;
+                log.event(DecisionLog::blank);
+            }
             
             prec.setQueryFeatureBegin(qrstart);
             prec.setQueryFeatureEnd(qrstop);
@@ -186,15 +202,20 @@ public:
         const large_unsigned_int qrlength = qrstop - qrstart + 1;
         
         // logging
-        const std::string qrseqname = boost::str(seqname_fmt % qrstart % qrstop % qid);
-        logsink << "ID" << tab << qrseqname << std::endl;
-        logsink << "  NUMREF" << tab << n << std::endl;
+        const std::string qrseqname = log.enabled(DecisionLog::summary) ? boost::str(boost::format("%d:%d@%s") % qrstart % qrstop % qid) : std::string();
+        if(log.enabled(DecisionLog::summary)) {
+            log.event(DecisionLog::query_id) << qrseqname;
+            log.event(DecisionLog::numref) << n;
+        }
         
         // sort the list by score
         sort_.filter(active_records);
         
         // data storage  TODO: maybe use Boost ptr containers
+        ScopedStage measure_retrieval(stage_sequence_retrieval);
+        measure_retrieval.addItems(1);
         const seqan::Dna5String qrseq = query_sequences_.getSequence(qid, qrstart, qrstop);
+        measure_retrieval.stop();
         
         std::vector< typename ContainerT::value_type > records(n);  //TODO: move below next section and do not create records if q==r_best
         {
@@ -227,7 +248,7 @@ public:
                 if(score == score_best) {
                     const TaxonNode* cnode = records[i]->getReferenceNode();
                     lnode = this->taxinter_.getLCA(lnode, cnode);
-                    logsink << "    current ref/lower node: " << "("<< score <<") "<< lnode->data->annotation->name << " (+ " << cnode->data->annotation->name << " )" << std::endl;
+                    if(log.enabled(DecisionLog::alignments)) log.event(DecisionLog::identical_lower_node) << score << lnode << cnode;
                 }
                 else {  // 1 break
                     float uscore = score;
@@ -235,15 +256,19 @@ public:
                     do {
                         const TaxonNode* cnode = records[i]->getReferenceNode();
                         unode = this->taxinter_.getLCA(unode, cnode);
-                        logsink << "    current upper node: " << "("<< uscore <<") "<< unode->data->annotation->name << " (+ " << cnode->data->annotation->name << " at " << static_cast<int>(this->taxinter_.getLCA(cnode, lnode)->data->root_pathlength) << " )" << std::endl;
+                        if(log.enabled(DecisionLog::alignments)) log.event(DecisionLog::identical_upper_node) << uscore << unode << cnode << static_cast<int>(this->taxinter_.getLCA(cnode, lnode)->data->root_pathlength);
                     } while (++i < n && records[i]->getScore() == uscore);
                     break;
                 }
                 ++i;
             }
                         
-            logsink << "  RANGE\t" << lnode->data->annotation->name << tab << lnode->data->annotation->name << tab << unode->data->annotation->name << std::endl << std::endl;
-            logsink << "STATS" << tab << qrseqname << tab << n << "\t0\t0\t0\t0\t" << stopwatch_init.read() << "\t0\t0\t.0" << std::endl << std::endl;
+            if(log.enabled(DecisionLog::summary)) {
+                log.event(DecisionLog::query_range) << lnode << lnode << unode;
+                log.event(DecisionLog::blank);
+                log.event(DecisionLog::stats_trivial) << qrseqname << n << stopwatch_init.read();
+                log.event(DecisionLog::blank);
+            }
             
             prec.setQueryFeatureBegin(qrstart);
             prec.setQueryFeatureEnd(qrstop);
@@ -253,7 +278,6 @@ public:
             return;
         }
         
-        std::vector<seqan::Dna5String> segments(n);    //TODO: don't call element constructors
         std::vector< int > queryscores(n, std::numeric_limits< int >::max());
         std::vector< large_unsigned_int > querymatches(n, 0);   //TODO: value is not really relevant
         stopwatch_init.stop();
@@ -267,20 +291,35 @@ public:
         uint pass_2_counter = 0;
         uint pass_2_counter_naive = 0;
         
-        StopWatchCPUTime stopwatch_seqret("retrieving sequences for this record");  // log overall time for this predict phase
-        StopWatchCPUTime stopwatch_process("processing this record");  // log overall time for this predict phase
+        StopWatchCPUTime stopwatch_seqret("retrieving sequences for this record", timed);  // log overall time for this predict phase
+        StopWatchCPUTime stopwatch_process("processing this record", timed);  // log overall time for this predict phase
         stopwatch_process.start();
 
         std::set<uint> qgroup;
         large_unsigned_int anchors_support = 0;
+        SegmentAlignments aln(records, qrstart, qrstop, score_cache_, stopwatch_seqret);
+        const bool parallel = pool_ && pool_->size() && n >= parallel_threshold_;
+        const std::size_t batch_size = parallel ? aln.batch.lanes()*(pool_->size() + 1) : aln.batch.lanes();  // segments aligned together against an anchor
         const TaxonNode* rtax = NULL;  // taxon of closest evolutionary neighbor(s)
         const TaxonNode* lca_allnodes = records.front()->getReferenceNode();  // used for optimization
         
         {   // pass 0 (re-alignment to most similar reference segments)
-            logsink << std::endl << "  PASS\t0" << std::endl;
+            ScopedStage measure_pass(stage_pass_0);
+            if(log.enabled(DecisionLog::passes)) {
+                log.event(DecisionLog::blank);
+                log.event(DecisionLog::pass) << 0u;
+            }
             float dbalignment_score_threshold = reeval_bandwidth_factor_*qmaxscore;
             uint index_best = 0;
 
+            {   // align all similar segments to the query at once
+                std::vector< uint > candidates;
+                for (uint i = 0; i < n; ++i) {
+                    if(!(records[i]->getAlignmentLength() == qrlength && records[i]->getIdentities() == qrlength) && records[i]->getScore() >= dbalignment_score_threshold) candidates.push_back(i);
+                }
+                alignSegments(aln, &qrseq, 0, candidates, std::vector< int >(), false, parallel);
+            }
+
             for (uint i = 0; i < n; ++i) { //calculate scores for best-scoring references
                 int score;
                 large_unsigned_int matches;
@@ -292,22 +331,17 @@ public:
                     qgroup.insert(i);
                     score = 0;
                     matches = records[i]->getIdentities();
-                    logsink << std::setprecision(2) << "    *ALN " << i << " <=> query" << tab  << "qlscore=" << qlscore << "; qlmatch=" << qlmatch << "; score=" << score << "; match=" << matches << "; qpid=1.0" << std::endl;
+                    if(log.enabled(DecisionLog::alignments)) log.event(DecisionLog::aln_identical) << i << qlscore << qlmatch << score << matches;
                     ++pass_0_counter_naive;
                 } else if (records[i]->getScore() >= dbalignment_score_threshold) {
                     qgroup.insert(i);
-                    
-                    
-                    stopwatch_seqret.start();
-                    if(seqan::empty(segments[i])) segments[i] = getSequence(records[i]->getReferenceIdentifier(),  records[i]->getReferenceStart(), records[i]->getReferenceStop(), records[i]->getQueryStart() - qrstart, qrstop - records[i]->getQueryStop());
-                    stopwatch_seqret.stop();                   
-                    score = -seqan::globalAlignmentScore(segments[i], qrseq, seqan::MyersBitVector());
+                    score = aln.scores[i];
                     
                     ++pass_0_counter;
                     ++pass_0_counter_naive;
-                    matches = std::max(static_cast<large_unsigned_int>(std::max(seqan::length(segments[i]), seqan::length(qrseq)) - score), records[i]->getIdentities());
+                    matches = std::max(static_cast<large_unsigned_int>(std::max(seqan::length(aln.segments[i]), seqan::length(qrseq)) - score), records[i]->getIdentities());
                     double qpid = static_cast<double>(matches)/qrlength;
-                    logsink << std::setprecision(2) << "    +ALN " << i << " <=> query" << tab  << "qlscore=" << qlscore << "; qlmatch=" << qlmatch << "; qlpid=" << qlpid << "; score=" << score << "; match=" << matches << "; qpid=" << qpid << std::endl;
+                    if(log.enabled(DecisionLog::alignments)) log.event(DecisionLog::aln_query) << i << qlscore << qlmatch << qlpid << score << matches << qpid;
                 } else {  // not similar -> fill in some dummy values
                     score = std::numeric_limits< int >::max();
                     matches = records[i]->getIdentities();
@@ -334,13 +368,17 @@ public:
                 else {
                     const TaxonNode* cnode = records[*it]->getReferenceNode();
                     rtax = this->taxinter_.getLCA(rtax, cnode);
-                    logsink << "      current ref node: " << "("<< queryscores[*it] <<") "<< rtax->data->annotation->name << " (+ " << cnode->data->annotation->name << " )" << std::endl;
+                    if(log.enabled(DecisionLog::alignments)) log.event(DecisionLog::ref_node) << queryscores[*it] << rtax << cnode;
                     ++it;
                 }
             }
             assert(! qgroup.empty());  // TODO: only in debug mode
             
-            logsink << "    NUMALN\t" << pass_0_counter << tab << pass_0_counter_naive - pass_0_counter << std::endl << std::endl;
+            measure_pass.addItems(pass_0_counter);
+            if(log.enabled(DecisionLog::passes)) {
+                log.event(DecisionLog::numaln) << pass_0_counter << pass_0_counter_naive - pass_0_counter;
+                log.event(DecisionLog::blank);
+            }
         }
 
         float anchors_taxsig = 1.;  // a measure of tree-like scores  
@@ -351,7 +389,8 @@ public:
         float bandfactor_max = 1.;
 
         {   // pass 1 (best reference alignment)
-            logsink << "  PASS\t1" << std::endl;
+            ScopedStage measure_pass(stage_pass_1);
+            if(log.enabled(DecisionLog::passes)) log.event(DecisionLog::pass) << 1u;
 
             small_unsigned_int lca_root_dist_min = std::numeric_limits<small_unsigned_int>::max();
             do {  // for each most similar reference segment
@@ -369,7 +408,7 @@ public:
                 std::list< boost::tuple< uint, int > > outgroup_tmp;
 
                 // align all others <=> anchor TODO: adaptive cut-off
-                logsink << "      query: (" << qscore << ") unknown" << std::endl;
+                if(log.enabled(DecisionLog::passes)) log.event(DecisionLog::query_score) << qscore;
                 pass_1_counter_naive += n - 1;
                 
                 // TODO: implement heuristic cut-off
@@ -377,6 +416,7 @@ public:
                 double qpid_thresh_guarantee = 0.;
                 double qpid_thresh_heuristic = 0.;
                 int qlscore_thresh_heuristic = 0.;
+                std::fill(aln.scores.begin(), aln.scores.end(), -1);
                 
                 for(uint i = 0; lnode != this->taxinter_.getRoot() && i < n && records[i]->getScore() >= qlscore_thresh_heuristic; ++i) {  //TODO: break loop when qlscore < qlscore_thresh_heuristic
                     const TaxonNode* cnode = records[i]->getReferenceNode();
@@ -398,15 +438,17 @@ public:
                                 matches = querymatches[index_anchor];
                             }
                             else {
-                                stopwatch_seqret.start();
-                                if(seqan::empty(segments[index_anchor])) segments[index_anchor] = getSequence(records[index_anchor]->getReferenceIdentifier(),  records[index_anchor]->getReferenceStart(), records[index_anchor]->getReferenceStop(), records[index_anchor]->getQueryStart() - qrstart, qrstop - records[index_anchor]->getQueryStop());
-                                if(seqan::empty(segments[i])) segments[i] = getSequence(records[i]->getReferenceIdentifier(),  records[i]->getReferenceStart(), records[i]->getReferenceStop(), records[i]->getQueryStart() - qrstart, qrstop - records[i]->getQueryStop());
-                                stopwatch_seqret.stop();
-                                
-                                score = -seqan::globalAlignmentScore(segments[i], segments[index_anchor], seqan::MyersBitVector());
+                                if(aln.scores[i] < 0) {  // fill the batch with the next segments passing the current cut-offs
+                                    std::vector< uint > candidates(1, i);
+                                    for(uint j = i + 1; j < n && candidates.size() < batch_size && records[j]->getScore() >= qlscore_thresh_heuristic; ++j) {
+                                        if(j != index_anchor && queryscores[j] != 0 && static_cast<double>(querymatches[j])/qrlength >= qpid_thresh) candidates.push_back(j);
+                                    }
+                                    alignSegments(aln, NULL, index_anchor, candidates, std::vector< int >(), true, parallel);
+                                }
+                                score = aln.scores[i];
                                 ++pass_1_counter;
-                                matches = std::max(seqan::length(segments[i]), seqan::length(segments[index_anchor])) - score;
-                                logsink << std::setprecision(2) << "    +ALN " << i << " <=> " << index_anchor << tab << "qlscore=" << qlscore << "; qlmatch=" << qlmatch << "; qlpid=" << qlpid << "; score=" << score << "; match=" << matches << "; qpid=" << qpid << "; qlscore_cut=" << qlscore_thresh_heuristic << "; qpid_cutg=" << qpid_thresh_guarantee << "; qpid_cut_h=" << qpid_thresh_heuristic << std::endl;
+                                matches = aln.lengths[i] - score;  // segments are not fetched if the score is cached
+                                if(log.enabled(DecisionLog::alignments)) log.event(DecisionLog::aln_anchor) << i << index_anchor << qlscore << qlmatch << qlpid << score << matches << qpid << qlscore_thresh_heuristic << qpid_thresh_guarantee << qpid_thresh_heuristic;
                             }
                         }
                         
@@ -418,7 +460,7 @@ public:
                             if(score <= qscore) {
                                 lnode = this->taxinter_.getLCA(lnode, cnode);
                                 if(score > lscore) lscore = score;
-                                logsink << "      current lower node: " << "("<< score <<") "<<lnode->data->annotation->name << " (+ " << cnode->data->annotation->name << " at " << static_cast<int>(this->taxinter_.getLCA(cnode, rnode)->data->root_pathlength) << " )" << std::endl;
+                                if(log.enabled(DecisionLog::alignments)) log.event(DecisionLog::lower_node) << score << lnode << cnode << static_cast<int>(this->taxinter_.getLCA(cnode, rnode)->data->root_pathlength);
                             }
                             else {
                                 if(score < uscore) {  // true if we find a segment with a lower score than query
@@ -441,7 +483,10 @@ public:
                 int qscore_ex = qscore * bandfactor;
                 int min_upper_score = std::numeric_limits< int >::max();
                 
-                logsink << std::endl << "    EXT\tqueryscore = " << qscore << "; threshold = " << qscore_ex << "; bandfactor = " << bandfactor << std::endl;
+                if(log.enabled(DecisionLog::passes)) {
+                    log.event(DecisionLog::blank);
+                    log.event(DecisionLog::ext) << qscore << qscore_ex << bandfactor;
+                }
                 for(std::list< boost::tuple<uint,int> >::iterator it = outgroup_tmp.begin(); it != outgroup_tmp.end();) {
                     int score = it->get<1>();
 
@@ -470,7 +515,7 @@ public:
                     
                     // add to upper node if(score <= min_upper_score)
                     unode = this->taxinter_.getLCA(cnode, unode);
-                    logsink << "      current upper node: " << "("<< score <<") "<< unode->data->annotation->name << " (+ " << cnode->data->annotation->name << " at " << static_cast<int>(this->taxinter_.getLCA(cnode, rnode)->data->root_pathlength) << " )" << std::endl;
+                    if(log.enabled(DecisionLog::alignments)) log.event(DecisionLog::upper_node) << score << unode << cnode << static_cast<int>(this->taxinter_.getLCA(cnode, rnode)->data->root_pathlength);
 
                     // curate minimal outgroup TODO: only keep score == min_upper_score in outgroup?
                     const small_unsigned_int lca_root_dist = this->taxinter_.getLCA(cnode, rtax)->data->root_pathlength;
@@ -490,7 +535,11 @@ public:
                     ival = 1.;
                 } else if(unode != lnode && lscore < qscore) ival = (qscore - lscore)/static_cast<float>(uscore - lscore);
                 
-                logsink << std::endl << "    SCORE\tlscore = " << lscore << "; uscore = " << uscore << "; queryscore = " << qscore << "; queryscore_ex = " << qscore_ex << "; ival = " << ival  << std::endl << std::endl;
+                if(log.enabled(DecisionLog::passes)) {
+                    log.event(DecisionLog::blank);
+                    log.event(DecisionLog::score) << lscore << uscore << qscore << qscore_ex << ival;
+                    log.event(DecisionLog::blank);
+                }
                 const float taxsig = .0;  // TODO: placer.getTaxSignal(qscore);
 
                 ival_global = std::max(ival, ival_global);  // combine interpolation values conservatively
@@ -500,14 +549,21 @@ public:
                 
             } while (! qgroup.empty() && lnode_global != this->taxinter_.getRoot());
 
-            logsink << "    NUMALN\t" << pass_1_counter << tab << pass_1_counter_naive - pass_1_counter << std::endl;
-            logsink << "    NUMOUTGRP\t" << outgroup.size() << std::endl;
+            measure_pass.addItems(pass_1_counter);
+            if(log.enabled(DecisionLog::passes)) {
+                log.event(DecisionLog::numaln) << pass_1_counter << pass_1_counter_naive - pass_1_counter;
+                log.event(DecisionLog::numoutgrp) << outgroup.size();
+            }
         }
 
-        logsink << "    RANGE\t" << rtax->data->annotation->name << tab << lnode_global->data->annotation->name << tab << unode_global->data->annotation->name << std::endl << std::endl;
+        if(log.enabled(DecisionLog::passes)) {
+            log.event(DecisionLog::range) << rtax << lnode_global << unode_global;
+            log.event(DecisionLog::blank);
+        }
         
         {   // pass 2 (stable upper node estimation alignment)
-            logsink << "  PASS\t2" << std::endl;
+            ScopedStage measure_pass(stage_pass_2);
+            if(log.enabled(DecisionLog::passes)) log.event(DecisionLog::pass) << 2u;
             while (! outgroup.empty()) {
                 const uint index_anchor = *outgroup.begin();
                 outgroup.erase(outgroup.begin());
@@ -525,6 +581,8 @@ public:
                 const double qpid_thresh = std::max(qpid_thresh_guarantee, qpid_thresh_heuristic);
                 const float qlscore_thresh_heuristic = records[index_anchor]->getScore()*exclude_alignments_factor_;
                 ++pass_2_counter_naive; // query angainst reference alignment
+                std::fill(aln.scores.begin(), aln.scores.end(), -1);
+                int qscore_ex = queryscores[index_anchor] == std::numeric_limits<int>::max() ? -1 : queryscores[index_anchor]*bandfactor_max;  // -1 until query <=> anchor is aligned
 
                 for (uint i = 0; i < n && records[i]->getScore() >= qlscore_thresh_heuristic; ++i) {
                     const double qpid = static_cast<double>(querymatches[i])/qrlength;
@@ -540,13 +598,21 @@ public:
                             ++pass_2_counter_naive;
                             if( this->taxinter_.isParentOf(unode_global, cnode) || cnode == unode_global ) continue;
                             else {
-                                stopwatch_seqret.start();
-                                if(seqan::empty(segments[index_anchor])) segments[index_anchor] = getSequence(records[index_anchor]->getReferenceIdentifier(),  records[index_anchor]->getReferenceStart(), records[index_anchor]->getReferenceStop(), records[index_anchor]->getQueryStart() - qrstart, qrstop - records[index_anchor]->getQueryStop());
-                                if(seqan::empty(segments[i])) segments[i] = getSequence(records[i]->getReferenceIdentifier(),  records[i]->getReferenceStart(), records[i]->getReferenceStop(), records[i]->getQueryStart() - qrstart, qrstop - records[i]->getQueryStop());
-                                stopwatch_seqret.stop();
-                                
-                                score = -seqan::globalAlignmentScore(segments[i], segments[index_anchor], seqan::MyersBitVector());
-                                logsink << std::setprecision(2) << "    +ALN " << i << " <=> " << index_anchor << tab << "qlscore=" << qlscore << "; qlmatch=" << qlmatch << "; score=" << score << "; qpid=" << qpid << std::endl;
+                                if(aln.scores[i] < 0) {  // fill the batch with the next segments passing the current cut-offs
+                                    std::vector< uint > candidates(1, i);
+                                    for(uint j = i + 1; j < n && candidates.size() < batch_size && records[j]->getScore() >= qlscore_thresh_heuristic; ++j) {
+                                        const TaxonNode* jnode = records[j]->getReferenceNode();
+                                        if(j != index_anchor && static_cast<double>(querymatches[j])/qrlength >= qpid_thresh && ! this->taxinter_.isParentOf(unode_global, jnode) && jnode != unode_global) candidates.push_back(j);
+                                    }
+                                    // scores above qscore_ex cannot move the upper node, so they are only
+                                    // needed exactly for outgroup segments which may become anchors
+                                    std::vector< int > bounds;
+                                    for(std::vector< uint >::const_iterator it = candidates.begin(); it != candidates.end(); ++it) bounds.push_back(outgroup.count(*it) ? -1 : qscore_ex);
+                                    alignSegments(aln, NULL, index_anchor, candidates, bounds, true, parallel);
+                                }
+                                score = aln.scores[i];
+                                const bool bounded = aln.bounded[i];  // qscore_ex does not change once it bounded a batch
+                                if(log.enabled(DecisionLog::alignments)) log.event(DecisionLog::aln_outgroup) << i << index_anchor << qlscore << qlmatch << (bounded ? '>' : '=') << (bounded ? qscore_ex : score) << qpid;
                                 ++pass_2_counter;
                                 queryscores[i] = score;
                             }
@@ -554,39 +620,45 @@ public:
 
                         if (score == 0) outgroup.erase(i);
                         else {
-                            int qscore_ex;
                             if (queryscores[index_anchor] == std::numeric_limits<int>::max()) { //need to align query <=> anchor
-                                stopwatch_seqret.start();
-                                if(seqan::empty(segments[index_anchor])) segments[index_anchor] = getSequence(records[index_anchor]->getReferenceIdentifier(),  records[index_anchor]->getReferenceStart(), records[index_anchor]->getReferenceStop(), records[index_anchor]->getQueryStart() - qrstart, qrstop - records[index_anchor]->getQueryStop());
-                                stopwatch_seqret.stop();
+                                std::vector< int > query_score;
+                                aln.batch.setText(qrseq);
+                                aln.batch.addPattern(fetchSegment(index_anchor, aln));
+                                aln.batch.compute(query_score);
                                 
-                                int score = -seqan::globalAlignmentScore(segments[index_anchor], qrseq, seqan::MyersBitVector());
-                                large_unsigned_int matches = std::max(static_cast<large_unsigned_int>(std::max(seqan::length(segments[index_anchor]), seqan::length(qrseq)) - score), querymatches[index_anchor]);
+                                int score = query_score.front();
+                                large_unsigned_int matches = std::max(static_cast<large_unsigned_int>(std::max(seqan::length(aln.segments[index_anchor]), seqan::length(qrseq)) - score), querymatches[index_anchor]);
                                 double qpid = static_cast<double>(matches)/qrlength;
-                                logsink << std::setprecision(2) << "    +ALN query <=> " << index_anchor << tab << "qlscore=" << records[index_anchor]->getScore() << "; qlmatch=" << qlmatch << "; score=" << score << "; match=" << matches << "; qpid=" << qpid << std::endl;
+                                if(log.enabled(DecisionLog::alignments)) log.event(DecisionLog::aln_query_anchor) << index_anchor << records[index_anchor]->getScore() << qlmatch << score << matches << qpid;
                                 queryscores[index_anchor] = score;
                                 querymatches[index_anchor] = matches;
                                 qscore_ex = score*bandfactor_max;
-                                logsink << "      query: (" << qscore_ex << ") unknown" << std::endl;
+                                if(log.enabled(DecisionLog::passes)) log.event(DecisionLog::query_score) << qscore_ex;
                                 ++pass_2_counter;
-                            } else qscore_ex = queryscores[index_anchor]*bandfactor_max;
+                            }
 
                             if(score <= qscore_ex) {
                                 const TaxonNode* rnode = records[index_anchor]->getReferenceNode();
                                 unode_global = this->taxinter_.getLCA(unode_global, cnode);
-                                logsink << "      current upper node: " << "("<< score <<") "<< unode_global->data->annotation->name << " (+ " << cnode->data->annotation->name << " at " << static_cast<int>(this->taxinter_.getLCA(cnode, rnode)->data->root_pathlength) << " )" << std::endl;
+                                if(log.enabled(DecisionLog::alignments)) log.event(DecisionLog::upper_node) << score << unode_global << cnode << static_cast<int>(this->taxinter_.getLCA(cnode, rnode)->data->root_pathlength);
                             }
                         }
                     }
                 }
-                logsink << std::endl;
+                if(log.enabled(DecisionLog::passes)) log.event(DecisionLog::blank);
             }
-            logsink << "    NUMALN\t" << pass_2_counter << tab << pass_2_counter_naive - pass_2_counter << std::endl;
+            measure_pass.addItems(pass_2_counter);
+            if(log.enabled(DecisionLog::passes)) log.event(DecisionLog::numaln) << pass_2_counter << pass_2_counter_naive - pass_2_counter;
         }
 
+        if(log.enabled(DecisionLog::passes)) log.event(DecisionLog::cache) << aln.pair_scores.lookups() << aln.pair_scores.hits() << aln.pair_scores.sharedHits();
+
         if(unode_global == lnode_global) ival_global = 1.;
         
-        logsink << "    RANGE\t" << rtax->data->annotation->name << tab << lnode_global->data->annotation->name << tab << unode_global->data->annotation->name << std::endl << std::endl;
+        if(log.enabled(DecisionLog::summary)) {
+            log.event(DecisionLog::range) << rtax << lnode_global << unode_global;
+            log.event(DecisionLog::blank);
+        }
 
         prec.setSignalStrength(anchors_taxsig);
         prec.setQueryFeatureBegin(qrstart);
@@ -597,7 +669,10 @@ public:
         gcounter = pass_0_counter + pass_1_counter + pass_2_counter;
         float normalised_rt = (float)gcounter/(float)n;
         stopwatch_process.stop();
-        logsink << "STATS" << tab << qrseqname << tab << n << tab << pass_0_counter << tab << pass_1_counter << tab << pass_2_counter << tab << gcounter << tab << stopwatch_init.read() << tab << stopwatch_seqret.read() << tab << stopwatch_process.read() << tab << std::setprecision(2) << std::fixed << normalised_rt << std::endl << std::endl;
+        if(log.enabled(DecisionLog::summary)) {
+            log.event(DecisionLog::stats) << qrseqname << n << pass_0_counter << pass_1_counter << pass_2_counter << gcounter << stopwatch_init.read() << stopwatch_seqret.read() << stopwatch_process.read() << normalised_rt;
+            log.event(DecisionLog::blank);
+        }
     }
     
     const seqan::Dna5String getSequence(const std::string& id, const large_unsigned_int start, const large_unsigned_int stop, const large_unsigned_int left_ext = 0, const large_unsigned_int right_ext = 0 ) {
@@ -613,18 +688,137 @@ public:
 
 protected:
     typedef std::list<typename ContainerT::value_type> active_list_type_;
+
+    // alignment state of one record set, shared by all passes
+    struct SegmentAlignments {
+        SegmentAlignments(const std::vector< typename ContainerT::value_type >& r, large_unsigned_int start, large_unsigned_int stop, AlignmentScoreCache* cache, StopWatchCPUTime& sw) : records(r), qrstart(start), qrstop(stop), segments(r.size()), scores(r.size()), bounded(r.size()), lengths(r.size()), pair_scores(cache), stopwatch_seqret(sw) {};
+
+        const std::vector< typename ContainerT::value_type >& records;
+        const large_unsigned_int qrstart;
+        const large_unsigned_int qrstop;
+        BatchEditDistance batch;
+        std::vector<seqan::Dna5String> segments;  // fetched on demand  TODO: don't call element constructors
+        std::vector< int > scores;  // scores of segments against the current anchor, -1 if not aligned yet
+        std::vector< bool > bounded;  // score only known to exceed the bound it was computed with
+        std::vector< large_unsigned_int > lengths;  // length of the longer segment of each pair with the anchor
+        AlignmentScoreCacheLayer pair_scores;  // reference segment pairs aligned for this record set
+        StopWatchCPUTime& stopwatch_seqret;
+    };
+
+    const seqan::Dna5String& fetchSegment(uint i, SegmentAlignments& aln) {
+        const typename ContainerT::value_type& rec = aln.records[i];
+        if(seqan::empty(aln.segments[i])) {
+            ScopedStage measure_retrieval(stage_sequence_retrieval);
+            measure_retrieval.addItems(1);
+            aln.stopwatch_seqret.start();
+            aln.segments[i] = getSequence(rec->getReferenceIdentifier(),  rec->getReferenceStart(), rec->getReferenceStop(), rec->getQueryStart() - aln.qrstart, aln.qrstop - rec->getQueryStop());
+            aln.stopwatch_seqret.stop();
+        }
+        return aln.segments[i];
+    }
+
+    // identifies segment i for the alignment score cache, same range as in fetchSegment
+    std::string segmentKey(uint i, const SegmentAlignments& aln) const {
+        const typename ContainerT::value_type& rec = aln.records[i];
+        const large_unsigned_int start = rec->getReferenceStart();
+        const large_unsigned_int stop = rec->getReferenceStop();
+        const large_unsigned_int left_ext = rec->getQueryStart() - aln.qrstart;
+        const large_unsigned_int right_ext = aln.qrstop - rec->getQueryStop();
+        if(start <= stop) return alignmentSegmentKey(rec->getReferenceIdentifier(), false, left_ext < start ? start - left_ext : 1, stop + right_ext);
+        return alignmentSegmentKey(rec->getReferenceIdentifier(), true, right_ext < stop ? stop - right_ext : 1, start + left_ext);
+    }
+
+    // aligns one batch of the patterns of a parallel alignSegments call
+    struct AlignmentChunk {
+        AlignmentChunk(const seqan::Dna5String& a, const std::vector< const seqan::Dna5String* >& p, const std::vector< int >& b, std::vector< int >& d, std::size_t l) : anchor(a), patterns(p), bounds(b), distances(d), lanes(l) {};
+
+        void operator()(std::size_t chunk) const {
+            BatchEditDistance batch;
+            std::vector< int > chunk_distances;
+            batch.setText(anchor);
+            const std::size_t end = std::min(patterns.size(), (chunk + 1)*lanes);
+            for(std::size_t k = chunk*lanes; k < end; ++k) batch.addPattern(*patterns[k], bounds[k]);
+            batch.compute(chunk_distances);
+            std::copy(chunk_distances.begin(), chunk_distances.end(), distances.begin() + chunk*lanes);
+        }
+
+        const seqan::Dna5String& anchor;
+        const std::vector< const seqan::Dna5String* >& patterns;
+        const std::vector< int >& bounds;
+        std::vector< int >& distances;
+        const std::size_t lanes;
+    };
+
+    // aligns the candidate segments to the query if given, else to segment index_anchor
+    // distances go to aln.scores, the longer length of each pair to aln.lengths
+    // bounds are optional per candidate, aln.bounded marks distances above their bound
+    // exact distances between reference segments are cached in aln.pair_scores
+    // speculative candidates after the first are skipped if they cannot be fetched
+    // only the alignments, not the fetching, run on the thread pool if parallel is set
+    void alignSegments(SegmentAlignments& aln, const seqan::Dna5String* query, uint index_anchor, const std::vector< uint >& candidates, const std::vector< int >& bounds, bool speculative, bool parallel) {
+        const std::string anchor_key = query ? std::string() : segmentKey(index_anchor, aln);
+        std::vector< uint > aligned;
+        std::vector< std::string > aligned_keys;
+        std::vector< const seqan::Dna5String* > aligned_segments;
+        std::vector< int > aligned_bounds;
+        std::vector< int > distances;
+        for(std::vector< uint >::const_iterator it = candidates.begin(); it != candidates.end(); ++it) {
+            std::string key;
+            if(! anchor_key.empty()) {
+                key = alignmentPairKey(anchor_key, segmentKey(*it, aln));
+                AlignmentPairScore cached;
+                if(aln.pair_scores.find(key, cached)) {
+                    aln.scores[*it] = cached.distance;
+                    aln.bounded[*it] = false;
+                    aln.lengths[*it] = cached.length;
+                    continue;
+                }
+            }
+            if(speculative && it != candidates.begin()) {
+                try {
+                    fetchSegment(*it, aln);
+                } catch(Exception&) {
+                    aln.stopwatch_seqret.stop();
+                    continue;
+                }
+            }
+            const int bound = bounds.empty() ? -1 : bounds[it - candidates.begin()];
+            aligned_segments.push_back(&fetchSegment(*it, aln));
+            aligned_bounds.push_back(bound);
+            aligned.push_back(*it);
+            aligned_keys.push_back(bound < 0 ? key : std::string());  // bounded distances may be inexact
+        }
+        if(aligned.empty()) return;
+        const seqan::Dna5String& anchor = query ? *query : fetchSegment(index_anchor, aln);
+        if(parallel && pool_ && aligned.size() > aln.batch.lanes()) {
+            distances.resize(aligned.size());
+            pool_->parallelFor((aligned.size() + aln.batch.lanes() - 1)/aln.batch.lanes(), AlignmentChunk(anchor, aligned_segments, aligned_bounds, distances, aln.batch.lanes()));
+        } else {
+            aln.batch.setText(anchor);
+            for(uint k = 0; k < aligned.size(); ++k) aln.batch.addPattern(*aligned_segments[k], aligned_bounds[k]);
+            aln.batch.compute(distances);
+        }
+        for(uint k = 0; k < aligned.size(); ++k) {
+            aln.scores[aligned[k]] = distances[k];
+            aln.bounded[aligned[k]] = aligned_bounds[k] >= 0 && distances[k] > aligned_bounds[k];
+            aln.lengths[aligned[k]] = std::max(seqan::length(anchor), seqan::length(*aligned_segments[k]));
+            if(! aligned_keys[k].empty()) aln.pair_scores.insert(aligned_keys[k], AlignmentPairScore(distances[k], aln.lengths[aligned[k]]));
+        }
+    }
+
     QStorType& query_sequences_;
     const DBStorType& db_sequences_;
+    AlignmentScoreCache* score_cache_;
+    ThreadPool* pool_;  // shared by all threads, used for record sets with at least parallel_threshold_ alignments
+    const uint parallel_threshold_;
+    const DecisionLog::Level log_level_;
+    const DecisionLog::Format log_format_;
     SortFilter< active_list_type_ > sort_;
     compareTupleFirstLT< boost::tuple< int, uint >, 0 > tuple_1_cmp_le_;
 
 private:
     const float exclude_alignments_factor_;
     const float reeval_bandwidth_factor_;
-    StopWatchCPUTime measure_sequence_retrieval_;
-    StopWatchCPUTime measure_pass_0_alignment_;
-    StopWatchCPUTime measure_pass_1_alignment_;
-    StopWatchCPUTime measure_pass_2_alignment_;
 };
 
 #endif // taxonpredictionmodelsequence_hh_
@@ -1,5 +1,6 @@
 #include "taxontree.hh"
 #include <algorithm>
+#include <cassert>
 #include <vector>
 
 
@@ -14,7 +15,7 @@ TaxonTree::~TaxonTree() {
 
 
 void TaxonTree::addToIndex( TaxonID taxid , TaxonTree::Node* node ) {
-	taxid2node_[ taxid ] = node;
+	taxid2node_.insert( taxid, node );
 }
 
 
@@ -22,12 +23,82 @@ void TaxonTree::addToIndex( TaxonID taxid , TaxonTree::Node* node ) {
 void TaxonTree::recreateNodeIndex() {
 	taxid2node_.clear();
 	for( iterator node_it = this->begin(); node_it != this->end(); ++node_it ) {
-		taxid2node_.insert( std::make_pair( (*node_it)->taxid, node_it.node ) );
+		if( ! taxid2node_.find( (*node_it)->taxid ) ) taxid2node_.insert( (*node_it)->taxid, node_it.node );
 	}
 }
 
 
 
+void TaxonTree::recreatePreorder() {
+	preorder_nodes_.clear();
+	preorder_nodes_.reserve( size() );
+	for( pre_order_iterator node_it = begin(); node_it != end(); ++node_it ) {
+		(*node_it)->preorder = preorder_nodes_.size();
+		preorder_nodes_.push_back( node_it.node );
+	}
+}
+
+
+
+void TaxonTree::recreateLCAIndex() {
+	recreatePreorder();
+	lca_index_.build( *this );
+}
+
+
+
+void TaxonTree::clearLCAIndex() {
+	lca_index_.clear();
+}
+
+
+
+void LCAIndex::build( const TaxonTree& tree ) {
+	clear();
+	const large_unsigned_int size = tree.size();
+	nodes_.reserve( size );
+	depth_.reserve( size );
+	masks_.reserve( size );
+
+	for( TaxonTree::pre_order_iterator node_it = tree.begin(); node_it != tree.end(); ++node_it ) {
+		assert( (*node_it)->preorder == nodes_.size() );
+		depth_.push_back( node_it.node->parent ? depth_[ node_it.node->parent->data->preorder ] + 1 : 0 );
+		nodes_.push_back( node_it.node );
+	}
+
+	// masks of the positions which are the minimum of some range ending at the current position
+	Mask stack = 0;
+	for( large_unsigned_int i = 0; i < size; ++i ) {
+		const large_unsigned_int block_start = i & ~( block_size - 1 );
+		if( i == block_start ) stack = 0;
+		while( stack && depth_[ block_start + 63 - __builtin_clzll( stack ) ] >= depth_[ i ] ) stack &= ~( Mask( 1 ) << ( 63 - __builtin_clzll( stack ) ) );
+		stack |= Mask( 1 ) << ( i - block_start );
+		masks_.push_back( stack );
+	}
+
+	// sparse table over block minima
+	const large_unsigned_int blocks = ( size + block_size - 1 ) >> block_bits;
+	sparse_table_.push_back( std::vector< large_unsigned_int >( blocks ) );
+	for( large_unsigned_int b = 0; b < blocks; ++b ) sparse_table_[0][b] = minimumInBlock( b << block_bits, std::min( ( ( b + 1 ) << block_bits ), size ) - 1 );
+	for( large_unsigned_int width = 2; width <= blocks; width <<= 1 ) {
+		const std::vector< large_unsigned_int >& lower = sparse_table_.back();
+		std::vector< large_unsigned_int > row( blocks - width + 1 );
+		for( large_unsigned_int b = 0; b < row.size(); ++b ) row[b] = shallower( lower[b], lower[b + width/2] );
+		sparse_table_.push_back( row );
+	}
+}
+
+
+
+void LCAIndex::clear() {
+	nodes_.clear();
+	depth_.clear();
+	masks_.clear();
+	sparse_table_.clear();
+}
+
+
+
 // constant in time as apposed to size(), I think
 int TaxonTree::indexSize() const { //returns only real nodes (no dummies)
 	return taxid2node_.size();
@@ -67,6 +138,7 @@ void TaxonTree::deleteUnmarkedNodes() { //TODO: correct path_to_root: adjust at
 		}
 	}
 	recalcDistToRoot( this->begin() ); //distances shrink
+	recreateLCAIndex();
 }
 
 
@@ -24,7 +24,9 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "types.hh"
 #include <tree.hh>
 #include <boost/tuple/tuple.hpp>
+#include <boost/unordered_map.hpp>
 #include <map>
+#include <set>
 #include <vector>
 #include <iostream>
 #include <string>
@@ -63,6 +65,7 @@ public:
     small_unsigned_int root_pathlength;
     large_unsigned_int leftvalue; //nested set value
     large_unsigned_int rightvalue; //nested set value
+    large_unsigned_int preorder; //position in pre-order, see TaxonTree::recreatePreorder()
     TaxonAnnotation* annotation;
     bool mark_special;
     bool is_unclassified;
@@ -74,7 +77,159 @@ typedef tree_node_<Taxon*> TaxonNode;
 
 
 
+// maps taxonomic identifiers to nodes, hashed for string identifiers
+template< typename KeyT, typename NodeT >
+class TaxonIndex {
+public:
+    TaxonIndex() {}
+
+    NodeT* find( const KeyT& taxid ) const {
+        typename boost::unordered_map< KeyT, NodeT* >::const_iterator it = index_.find( taxid );
+        return it == index_.end() ? NULL : it->second;
+    }
+
+    void insert( const KeyT& taxid, NodeT* node ) { index_[ taxid ] = node; }
+    void erase( const KeyT& taxid ) { index_.erase( taxid ); }
+    void clear() { index_.clear(); }
+    std::size_t size() const { return index_.size(); }
+
+private:
+    boost::unordered_map< KeyT, NodeT* > index_;
+};
+
+
+
+// numeric identifiers are used as positions in an array (NCBI taxids are dense),
+// sparse outliers like a huge taxid from a malformed mapping are hashed instead of
+// growing the array to their size
+template< typename NodeT >
+class TaxonIndex< large_unsigned_int, NodeT > {
+public:
+    TaxonIndex() : size_( 0 ) {}
+
+    NodeT* find( large_unsigned_int taxid ) const {
+        if ( taxid < index_.size() ) return index_[ taxid ];
+        if ( outliers_.empty() ) return NULL;
+        typename boost::unordered_map< large_unsigned_int, NodeT* >::const_iterator it = outliers_.find( taxid );
+        return it == outliers_.end() ? NULL : it->second;
+    }
+
+    void insert( large_unsigned_int taxid, NodeT* node ) {
+        if ( taxid >= index_.size() ) {
+            if ( ! dense( taxid ) ) {
+                outliers_[ taxid ] = node;
+                return;
+            }
+            index_.resize( taxid + taxid/8 + 1, NULL );  // amortized growth
+            migrateOutliers();
+        }
+        if ( ! index_[ taxid ] ) ++size_;
+        index_[ taxid ] = node;
+    }
+
+    void erase( large_unsigned_int taxid ) {
+        if ( taxid < index_.size() ) {
+            if ( index_[ taxid ] ) {
+                index_[ taxid ] = NULL;
+                --size_;
+            }
+        } else outliers_.erase( taxid );
+    }
+
+    void clear() {
+        index_.clear();
+        outliers_.clear();
+        size_ = 0;
+    }
+
+    std::size_t size() const { return size_ + outliers_.size(); }
+
+private:
+    // array positions up to dense_limit are always fine (64 MB of pointers), beyond
+    // that at least a quarter of the array must be used
+    static const large_unsigned_int dense_limit = 1u << 23;
+
+    bool dense( large_unsigned_int taxid ) const {
+        return taxid < dense_limit || taxid/4 < size_;
+    }
+
+    // outliers are never inside the array
+    void migrateOutliers() {
+        for ( typename boost::unordered_map< large_unsigned_int, NodeT* >::iterator it = outliers_.begin(); it != outliers_.end(); ) {
+            if ( it->first < index_.size() ) {
+                if ( ! index_[ it->first ] ) ++size_;
+                index_[ it->first ] = it->second;
+                it = outliers_.erase( it );
+            } else ++it;
+        }
+    }
+
+    std::vector< NodeT* > index_;
+    boost::unordered_map< large_unsigned_int, NodeT* > outliers_;
+    std::size_t size_;
+};
+
+
+
 class TaxonomyInterface;
+class TaxonTree;
+
+
+
+// Answers lowest common ancestor queries in constant time. For two nodes where
+// neither is an ancestor of the other, the LCA is the parent of the shallowest
+// node between them in pre-order. The range minimum is found with a sparse table
+// over blocks of 64 nodes and bit masks of the minimum candidates inside a block.
+class LCAIndex {
+public:
+    void build( const TaxonTree& tree );  // nodes must be numbered in pre-order
+    void clear();
+
+    bool empty() const {
+        return nodes_.empty();
+    }
+
+    // A and B must not be ancestors of each other
+    const TaxonNode* query( const TaxonNode* A, const TaxonNode* B ) const {
+        large_unsigned_int left = A->data->preorder;
+        large_unsigned_int right = B->data->preorder;
+        if( left > right ) std::swap( left, right );
+        return nodes_[ minimumDepth( left + 1, right ) ]->parent;
+    }
+
+private:
+    typedef uint_least64_t Mask;
+    static const unsigned int block_bits = 6;
+    static const large_unsigned_int block_size = 1 << block_bits;
+
+    large_unsigned_int shallower( large_unsigned_int a, large_unsigned_int b ) const {
+        return depth_[ b ] < depth_[ a ] ? b : a;
+    }
+
+    large_unsigned_int minimumInBlock( large_unsigned_int left, large_unsigned_int right ) const {
+        const Mask candidates = masks_[ right ] & ( ~Mask( 0 ) << ( left & ( block_size - 1 ) ) );
+        return ( left & ~( block_size - 1 ) ) + __builtin_ctzll( candidates );
+    }
+
+    large_unsigned_int minimumDepth( large_unsigned_int left, large_unsigned_int right ) const {
+        const large_unsigned_int left_block = left >> block_bits;
+        const large_unsigned_int right_block = right >> block_bits;
+        if( left_block == right_block ) return minimumInBlock( left, right );
+
+        large_unsigned_int best = shallower( minimumInBlock( left, ( ( left_block + 1 ) << block_bits ) - 1 ), minimumInBlock( right_block << block_bits, right ) );
+        if( right_block - left_block > 1 ) {  // whole blocks in between
+            const unsigned int level = 31 - __builtin_clz( right_block - left_block - 1 );
+            const std::vector< large_unsigned_int >& row = sparse_table_[ level ];
+            best = shallower( best, shallower( row[ left_block + 1 ], row[ right_block - ( 1 << level ) ] ) );
+        }
+        return best;
+    }
+
+    std::vector< const TaxonNode* > nodes_;  // in pre-order
+    std::vector< medium_unsigned_int > depth_;  // real depth in the tree
+    std::vector< Mask > masks_;  // minimum candidates in block up to position
+    std::vector< std::vector< large_unsigned_int > > sparse_table_;  // positions of block minima for 2^i blocks
+};
 
 
 
@@ -88,6 +243,9 @@ public:
     int indexSize() const;
     const std::string& insertRankInternal( const std::string& rankname );
     const std::string& getRankInternal( const std::string& rankname ) const;
+    const std::set< std::string >& getRanksInternal() const {
+        return ranks_;
+    };
     void deleteUnmarkedNodes();
 // 		void addDummyRankNodes( const std::vector< std::string >& ranks );
     void setRankDistances( const std::vector< std::string >& ranks );
@@ -100,6 +258,9 @@ public:
     void recalcDistToRoot( const iterator start );
     void addToIndex( TaxonID taxid, Node* node );
     void recreateNodeIndex();
+    void recreatePreorder();
+    void recreateLCAIndex();  // also numbers the nodes
+    void clearLCAIndex();
 
     // base class for path iterators (only forward)
     class PathIteratorBase {
@@ -218,7 +379,9 @@ public:
 private:
     std::set< std::string > ranks_;
     const std::string& rank_not_found_;
-    std::map< TaxonID, Node* > taxid2node_; //use boost::ptr_map<> -> no destructor needed, hash map is faster
+    TaxonIndex< TaxonID, Node > taxid2node_;
+    std::vector< const Node* > preorder_nodes_;  // indexed by Taxon::preorder
+    LCAIndex lca_index_;
     small_unsigned_int max_depth_;
     std::string version_;
 };
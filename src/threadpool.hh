@@ -0,0 +1,117 @@
+/*
+taxator-tk predicts the taxon for DNA sequences based on sequence alignment.
+
+Copyright (C) 2010 Johannes Dröge
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef threadpool_hh_
+#define threadpool_hh_
+
+#include <algorithm>
+#include <deque>
+#include <boost/bind.hpp>
+#include <boost/exception_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread.hpp>
+#include "profiling.hh"
+
+// Worker threads which can be shared by several threads for data-parallel loops.
+// The thread calling parallelFor works on its own loop as well, so loops always
+// finish, even if all workers are busy with loops of other threads.
+class ThreadPool : boost::noncopyable {
+public:
+    explicit ThreadPool( std::size_t number_workers ) : stop_( false ) {
+        for ( std::size_t i = 0; i < number_workers; ++i ) workers_.create_thread( boost::bind( &ThreadPool::work, this ) );
+    }
+
+    ~ThreadPool() {
+        {
+            boost::mutex::scoped_lock lock( mutex_ );
+            stop_ = true;
+        }
+        work_available_.notify_all();
+        workers_.join_all();
+    }
+
+    std::size_t size() const {
+        return workers_.size();
+    }
+
+    // calls body( i ) for i in [0, n) in any order and thread, returns when all calls
+    // are finished and rethrows the first exception of a call (the others still run)
+    void parallelFor( std::size_t n, const boost::function< void ( std::size_t ) >& body ) {
+        if ( ! n ) return;
+        Loop loop( body, n );
+        boost::mutex::scoped_lock lock( mutex_ );
+        loops_.push_back( &loop );
+        lock.unlock();
+        work_available_.notify_all();
+
+        lock.lock();
+        while ( loop.next < loop.n ) runOne( loop, lock );
+        while ( loop.finished < loop.n ) loop_finished_.wait( lock );
+        lock.unlock();
+        if ( loop.error ) boost::rethrow_exception( loop.error );
+    }
+
+private:
+    struct Loop {
+        Loop( const boost::function< void ( std::size_t ) >& b, std::size_t size ) : body( b ), n( size ), next( 0 ), finished( 0 ) {};
+
+        const boost::function< void ( std::size_t ) >& body;
+        const std::size_t n;
+        std::size_t next;  // first index not started
+        std::size_t finished;
+        boost::exception_ptr error;
+    };
+
+    // runs the next index of loop, lock is held before and after
+    void runOne( Loop& loop, boost::mutex::scoped_lock& lock ) {
+        const std::size_t i = loop.next++;
+        if ( loop.next == loop.n ) loops_.erase( std::find( loops_.begin(), loops_.end(), &loop ) );  // fully started
+        lock.unlock();
+        boost::exception_ptr error;
+        try {
+            loop.body( i );
+        } catch ( ... ) {
+            error = boost::current_exception();
+        }
+        lock.lock();
+        if ( error && ! loop.error ) loop.error = error;
+        if ( ++loop.finished == loop.n ) loop_finished_.notify_all();
+    }
+
+    void work() {
+        PipelineProfiler::instance().nameThread( "pool" );
+        boost::mutex::scoped_lock lock( mutex_ );
+        while ( true ) {
+            while ( loops_.empty() && ! stop_ ) work_available_.wait( lock );
+            if ( stop_ ) return;
+            runOne( *loops_.front(), lock );
+        }
+    }
+
+    boost::mutex mutex_;
+    boost::condition_variable work_available_;
+    boost::condition_variable loop_finished_;
+    std::deque< Loop* > loops_;  // loops with indices not started
+    bool stop_;
+    boost::thread_group workers_;
+};
+
+#endif // threadpool_hh_
@@ -31,7 +31,12 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <list>
 #include <fstream>
 #include <limits>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
 #include <assert.h>
+#include <locale.h>
+#include <stdlib.h>
 
 
 
@@ -79,6 +84,50 @@ void tokenizeSingleCharDelim(const std::string& str, ContainerT& tokens, const s
 
 
 
+// allocation-free number conversion of the characters in [begin, end), return false if malformed
+inline bool convertNumber( const char* begin, const char* end, large_unsigned_int& value ) {
+  if ( begin != end && *begin == '+' ) ++begin;
+  if ( begin == end ) return false;
+  very_large_unsigned_int tmp = 0;
+  for ( ; begin != end; ++begin ) {
+    const unsigned int digit = static_cast< unsigned char >( *begin ) - '0';
+    if ( digit > 9 ) return false;
+    tmp = tmp*10 + digit;
+    if ( tmp > std::numeric_limits< large_unsigned_int >::max() ) return false;
+  }
+  value = static_cast< large_unsigned_int >( tmp );
+  return true;
+}
+
+// alignment files always use a decimal point, so floating point numbers are
+// converted by the C library in the "C" locale whatever the global locale is
+inline locale_t numericLocale() {
+  static const locale_t c_locale = newlocale( LC_ALL_MASK, "C", 0 );
+  return c_locale;
+}
+
+template< typename FloatT >
+inline bool convertFloatingPoint( const char* begin, const char* end, FloatT& value, FloatT (*convert)( const char*, char**, locale_t ) ) {
+  const std::size_t length = end - begin;
+  char buffer[64];  // strto*() needs a terminated string
+  if ( ! length || length >= sizeof( buffer ) || std::isspace( static_cast< unsigned char >( *begin ) ) ) return false;
+  std::memcpy( buffer, begin, length );
+  buffer[length] = '\0';
+  char* stop;
+  value = convert( buffer, &stop, numericLocale() );
+  return stop == buffer + length;
+}
+
+inline bool convertNumber( const char* begin, const char* end, float& value ) {
+  return convertFloatingPoint< float >( begin, end, value, &strtof_l );
+}
+
+inline bool convertNumber( const char* begin, const char* end, double& value ) {
+  return convertFloatingPoint< double >( begin, end, value, &strtod_l );
+}
+
+
+
 template < class ContainerT >
 void tokenizeMultiCharDelim(const std::string& str, ContainerT& tokens, const std::string& delimiters = " ", int fieldnum = 0, const bool trimempty = false) {
   const unsigned int stringlength = str.size();
@@ -0,0 +1,211 @@
+/*
+taxator-tk predicts the taxon for DNA sequences based on sequence alignment.
+
+Copyright (C) 2010 Johannes Dröge
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef workscheduler_hh_
+#define workscheduler_hh_
+
+#include <deque>
+#include <vector>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_array.hpp>
+#include <boost/thread.hpp>
+
+// Hands items from one producer to a fixed number of workers. Items are grouped
+// into batches of similar estimated cost (given by CostFunction) so that many
+// cheap items are passed with a single lock. Each worker has its own deque of
+// batches: new batches go to the deque with the lowest queued cost, a worker takes
+// the oldest batch of its deque and, if that is empty, steals the newest batch of
+// the deque with the highest queued cost. Batches are numbered in input order and
+// the items within a batch keep the input order. The producer blocks while
+// capacity batches are waiting. Items can carry an increasing mark, like their
+// position in the input; a batch keeps the last mark and the number of items up to
+// the marked one.
+template< typename T, typename CostFunction >
+class WorkStealingScheduler : boost::noncopyable {
+public:
+    struct Batch {
+        Batch() : sequence( 0 ), cost( 0. ), mark( 0 ), marked_items( 0 ) {};
+
+        std::size_t sequence;
+        std::vector< T > items;
+        double cost;
+        std::size_t mark;  // 0 if no item is marked
+        std::size_t marked_items;
+    };
+
+    WorkStealingScheduler( std::size_t number_workers, double batch_cost, std::size_t batch_items, std::size_t capacity, const CostFunction& cost_function = CostFunction() ) :
+        cost_function_( cost_function ),
+        number_workers_( number_workers ),
+        batch_cost_( batch_cost ),
+        batch_items_( batch_items ),
+        capacity_( capacity ),
+        deques_( new WorkerDeque[ number_workers ] ),
+        queued_( 0 ),
+        idle_( 0 ),
+        next_sequence_( 0 ),
+        closed_( false )
+    {}
+
+    // producer side
+    void push( const T& item, std::size_t mark = 0 ) {
+        open_.cost += cost_function_( item );
+        open_.items.push_back( item );
+        if ( mark ) {
+            open_.mark = mark;
+            open_.marked_items = open_.items.size();
+        }
+
+        bool idle;
+        {
+            boost::mutex::scoped_lock lock( mutex_ );
+            idle = idle_ && ! queued_;
+        }
+        if ( open_.cost >= batch_cost_ || open_.items.size() >= batch_items_ || idle ) dispatch();  // do not let workers wait for a full batch
+    }
+
+    // hands out the last batch, workers finish when all batches are done
+    void close() {
+        if ( ! open_.items.empty() ) dispatch();
+        boost::mutex::scoped_lock lock( mutex_ );
+        closed_ = true;
+        work_available_.notify_all();
+    }
+
+    // worker side, false if there is no more work after close()
+    bool pop( std::size_t worker, Batch& batch ) {
+        while ( true ) {
+            if ( takeOwn( worker, batch ) || steal( worker, batch ) ) {
+                boost::mutex::scoped_lock lock( mutex_ );
+                --queued_;
+                space_available_.notify_one();
+                return true;
+            }
+
+            boost::mutex::scoped_lock lock( mutex_ );
+            ++idle_;
+            while ( ! queued_ && ! closed_ ) work_available_.wait( lock );
+            --idle_;
+            if ( ! queued_ && closed_ ) return false;
+        }
+    }
+
+private:
+    struct WorkerDeque {
+        WorkerDeque() : cost( 0. ) {};
+
+        boost::mutex mutex;
+        std::deque< Batch > batches;
+        double cost;
+    };
+
+    // holds mutex_ until queued_ is incremented, so a worker which takes the batch
+    // right away only decrements the counter after that
+    void dispatch() {
+        boost::mutex::scoped_lock queue_lock( mutex_ );
+        while ( queued_ >= capacity_ ) space_available_.wait( queue_lock );
+
+        std::size_t target = 0;
+        double target_cost = 0.;
+        for ( std::size_t i = 0; i < number_workers_; ++i ) {
+            boost::mutex::scoped_lock lock( deques_[i].mutex );
+            if ( ! i || deques_[i].cost < target_cost ) {
+                target = i;
+                target_cost = deques_[i].cost;
+            }
+        }
+
+        open_.sequence = next_sequence_++;
+        {
+            WorkerDeque& deque = deques_[ target ];
+            boost::mutex::scoped_lock lock( deque.mutex );
+            deque.cost += open_.cost;
+            deque.batches.push_back( Batch() );
+            deque.batches.back().sequence = open_.sequence;
+            deque.batches.back().cost = open_.cost;
+            deque.batches.back().mark = open_.mark;
+            deque.batches.back().marked_items = open_.marked_items;
+            deque.batches.back().items.swap( open_.items );
+        }
+        open_ = Batch();
+
+        ++queued_;
+        work_available_.notify_one();
+    }
+
+    bool takeOwn( std::size_t worker, Batch& batch ) {
+        WorkerDeque& deque = deques_[ worker ];
+        boost::mutex::scoped_lock lock( deque.mutex );
+        if ( deque.batches.empty() ) return false;
+        take( deque, deque.batches.begin(), batch );
+        return true;
+    }
+
+    bool steal( std::size_t worker, Batch& batch ) {
+        while ( true ) {
+            std::size_t victim = worker;
+            double victim_cost = 0.;
+            for ( std::size_t i = 0; i < number_workers_; ++i ) {
+                if ( i == worker ) continue;
+                boost::mutex::scoped_lock lock( deques_[i].mutex );
+                if ( ! deques_[i].batches.empty() && ( victim == worker || deques_[i].cost > victim_cost ) ) {
+                    victim = i;
+                    victim_cost = deques_[i].cost;
+                }
+            }
+            if ( victim == worker ) return false;
+
+            WorkerDeque& deque = deques_[ victim ];
+            boost::mutex::scoped_lock lock( deque.mutex );
+            if ( deque.batches.empty() ) continue;  // taken in the meantime
+            take( deque, --deque.batches.end(), batch );
+            return true;
+        }
+    }
+
+    // deque must be locked
+    void take( WorkerDeque& deque, typename std::deque< Batch >::iterator it, Batch& batch ) {
+        deque.cost -= it->cost;
+        batch.sequence = it->sequence;
+        batch.cost = it->cost;
+        batch.mark = it->mark;
+        batch.marked_items = it->marked_items;
+        batch.items.swap( it->items );
+        deque.batches.erase( it );
+        if ( deque.batches.empty() ) deque.cost = 0.;  // no rounding drift
+    }
+
+    const CostFunction cost_function_;
+    const std::size_t number_workers_;
+    const double batch_cost_;
+    const std::size_t batch_items_;
+    const std::size_t capacity_;
+    boost::scoped_array< WorkerDeque > deques_;
+    Batch open_;  // filled by the producer
+
+    boost::mutex mutex_;
+    boost::condition_variable work_available_;
+    boost::condition_variable space_available_;
+    std::size_t queued_;  // batches in all deques
+    std::size_t idle_;  // waiting workers
+    std::size_t next_sequence_;
+    bool closed_;
+};
+
+#endif // workscheduler_hh_
@@ -26,6 +26,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <boost/program_options/parsers.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/exception/diagnostic_information.hpp>
+#include <boost/filesystem.hpp>
 #include <iostream>
 #include <sstream>
 #include <fstream>
@@ -39,48 +40,108 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "src/sequencestorage.hh"
 #include "src/predictionrecord.hh"
 #include "src/profiling.hh"
-#include "src/boundedbuffer.hh"
+#include "src/workscheduler.hh"
 #include "src/concurrentoutstream.hh"
+#include "src/outputwriter.hh"
+#include "src/checkpoint.hh"
+#include "src/compression.hh"
+#include "src/queryblockindex.hh"
+#include "src/parallelparser.hh"
+#include "src/mappedfile.hh"
 #include "src/exception.hh"
+#include "src/alignmentscorecache.hh"
+#include "src/threadpool.hh"
+#include "src/decisionlog.hh"
 
 using namespace std;
 
 typedef list< AlignmentRecordTaxonomy* > RecordSetType;
-
-void doPredictionsSerial( TaxonPredictionModel< RecordSetType >* predictor, StrIDConverter& seqid2taxid, const Taxonomy* tax, bool split_alignments,bool alignments_sorted, std::ostream& logsink ) {
-    AlignmentRecordFactory< AlignmentRecordTaxonomy > fac( seqid2taxid, tax );
-    FileParser< AlignmentRecordFactory< AlignmentRecordTaxonomy > > parser( cin, fac );
-    RecordSetGenerator<AlignmentRecordTaxonomy, RecordSetType>* recgen = NULL; // TODO: boost smpt??
-    
-    if (alignments_sorted) { // stupid nesting because template parameters must be const
-        if (split_alignments) recgen = new RecordSetGeneratorSorted<AlignmentRecordTaxonomy, RecordSetType, true>( parser );
-        else recgen = new RecordSetGeneratorSorted<AlignmentRecordTaxonomy, RecordSetType, false>( parser );
-    }
-    else {
-        if (split_alignments) recgen = new RecordSetGeneratorUnsorted<AlignmentRecordTaxonomy, RecordSetType, true>( parser );
-        else recgen = new RecordSetGeneratorUnsorted<AlignmentRecordTaxonomy, RecordSetType, false>( parser );
+typedef AlignmentRecordFactory< AlignmentRecordTaxonomy > FactoryType;
+
+// estimated work for a record set: number of alignments times the query span
+struct RecordSetCost {
+    double operator()( const RecordSetType& rset ) const {
+        if ( rset.empty() ) return 1.;
+        large_unsigned_int start = rset.front()->getQueryStart();
+        large_unsigned_int stop = rset.front()->getQueryStop();
+        for ( RecordSetType::const_iterator it = rset.begin(); it != rset.end(); ++it ) {
+            start = std::min( start, (*it)->getQueryStart() );
+            stop = std::max( stop, (*it)->getQueryStop() );
+        }
+        return static_cast< double >( rset.size() )*( stop - start + 1 );
     }
+};
+
+typedef WorkStealingScheduler< RecordSetType, RecordSetCost > SchedulerType;
+
+template< typename InputType >
+void doPredictionsSerial( TaxonPredictionModel< RecordSetType >* predictor, StrIDConverter& seqid2taxid, const Taxonomy* tax, InputType& input, bool split_alignments,bool alignments_sorted, std::ostream& logsink, std::ostream& output, Checkpoint* checkpoint, SequentialSeqStoreInterface* query_sequences ) {
+    FactoryType fac( seqid2taxid, tax );
+    typename ParserSelector< InputType, FactoryType >::type parser( input, fac );
+    RecordSetGenerator<AlignmentRecordTaxonomy, RecordSetType>* recgen = newRecordSetGenerator< AlignmentRecordTaxonomy, RecordSetType >( parser, split_alignments, alignments_sorted ); // TODO: boost smpt??
 
     RecordSetType rset;
     
     PredictionRecord prec( tax );
 
-    std::cout << GFF3Header();
     while( recgen->notEmpty() ) {
-        recgen->getNext( rset );
-        predictor->predict( rset, prec, logsink );
-        deleteRecords( rset );
-        std::cout << prec;
+        {
+            ScopedStage measure_parse( stage_parse );
+            recgen->getNext( rset );
+            measure_parse.addItems( 1 );
+        }
+        {
+            ScopedRecords< RecordSetType > owned( rset );  // also if the query sequence is missing
+            if( query_sequences && ! rset.empty() ) query_sequences->acquire( rset.front()->getQueryIdentifier() );
+            predictor->predict( rset, prec, logsink );
+            if( query_sequences && ! rset.empty() ) query_sequences->release( rset.front()->getQueryIdentifier() );
+        }
+        ScopedStage measure_output( stage_output );
+        measure_output.addItems( 1 );
+        output << prec;
+        measure_output.stop();
+
+        if( checkpoint && recgen->queryEndOffset() && checkpoint->due() ) {
+            output.flush();
+            checkpoint->save( recgen->queryEndOffset() );
+        }
     }
 
+    if( checkpoint ) {
+        output.flush();
+        checkpoint->finish();
+    }
 //     delete recgen;
 }
 
+// the scheduler as seen by the producers, the sequences of streamed queries are read
+// when their record sets are handed over in input order
+class RecordSetBuffer {
+public:
+    RecordSetBuffer( SchedulerType& scheduler, SequentialSeqStoreInterface* query_sequences ) :
+        scheduler_( scheduler ),
+        query_sequences_( query_sequences )
+    {}
+
+    void push( const RecordSetType& rset, std::size_t mark = 0 ) {
+        if( query_sequences_ && ! rset.empty() ) query_sequences_->acquire( rset.front()->getQueryIdentifier() );
+        scheduler_.push( rset, mark );
+    }
+
+private:
+    SchedulerType& scheduler_;
+    SequentialSeqStoreInterface* query_sequences_;
+};
+
+
+
+template< typename InputType >
 class BoostProducer {
 public:
-    BoostProducer( BoundedBuffer< RecordSetType >& buffer, AlignmentRecordFactory< AlignmentRecordTaxonomy >& fac, bool split_alignments, bool alignments_sorted ) :
+    BoostProducer( RecordSetBuffer& buffer, FactoryType& fac, InputType& input, bool split_alignments, bool alignments_sorted ) :
         buffer_( buffer ),
         fac_( fac ),
+        input_( input ),
         split_alignments_( split_alignments ),
         alignments_sorted_( alignments_sorted )
     {}
@@ -91,29 +152,28 @@ public:
 
 private:
 
-    BoundedBuffer< RecordSetType >& buffer_;
-    AlignmentRecordFactory< AlignmentRecordTaxonomy >& fac_;
+    RecordSetBuffer& buffer_;
+    FactoryType& fac_;
+    InputType& input_;
     bool split_alignments_;
     bool alignments_sorted_;
 
     void produce() {  //TODO: use boost smart pointers for factory
-        FileParser< AlignmentRecordFactory< AlignmentRecordTaxonomy > > parser( cin, fac_ );
-        RecordSetGenerator<AlignmentRecordTaxonomy, RecordSetType>* recgen = NULL;
-
-        if (alignments_sorted_) { // stupid nesting because template parameters must be const
-            if (split_alignments_) recgen = new RecordSetGeneratorSorted<AlignmentRecordTaxonomy, RecordSetType, true>( parser );
-            else recgen = new RecordSetGeneratorSorted<AlignmentRecordTaxonomy, RecordSetType, false>( parser );
-        }
-        else {
-            if (split_alignments_) recgen = new RecordSetGeneratorUnsorted<AlignmentRecordTaxonomy, RecordSetType, true>( parser );
-            else recgen = new RecordSetGeneratorUnsorted<AlignmentRecordTaxonomy, RecordSetType, false>( parser );
-        }
+        typename ParserSelector< InputType, FactoryType >::type parser( input_, fac_ );
+        RecordSetGenerator<AlignmentRecordTaxonomy, RecordSetType>* recgen = newRecordSetGenerator< AlignmentRecordTaxonomy, RecordSetType >( parser, split_alignments_, alignments_sorted_ );
         
         RecordSetType tmprset;
 
         while( recgen->notEmpty() ) {
-            recgen->getNext( tmprset );
-            buffer_.push( tmprset );
+            {
+                ScopedStage measure_parse( stage_parse );
+                recgen->getNext( tmprset );
+                measure_parse.addItems( 1 );
+            }
+            ScopedStage measure_wait( stage_queue_wait );
+            ScopedRecords< RecordSetType > owned( tmprset );  // until handed over, acquiring a streamed query can throw
+            buffer_.push( tmprset, recgen->queryEndOffset() );
+            owned.release();
             tmprset.clear();  // ownership transferred, clear for next cycle
         }
 
@@ -126,12 +186,13 @@ private:
 
 class BoostConsumer {
 public:
-    BoostConsumer( BoundedBuffer< RecordSetType >& buffer, TaxonPredictionModel< RecordSetType >* predictor, const Taxonomy* tax, ConcurrentOutStream& log, ConcurrentOutStream& output ) :
+    BoostConsumer( SchedulerType& buffer, TaxonPredictionModel< RecordSetType >* predictor, const Taxonomy* tax, ConcurrentOutStream& log, OrderedOutputWriter& output, SequentialSeqStoreInterface* query_sequences ) :
         buffer_( buffer ),
         predictor_( *predictor ),
         tax_( tax ),
         output_( output ),
         log_( log ),
+        query_sequences_( query_sequences ),
         thread_count_( 0 )
     {}
 
@@ -140,82 +201,129 @@ public:
     }
 
 private:
-    BoundedBuffer< RecordSetType >& buffer_;
+    SchedulerType& buffer_;
     TaxonPredictionModel< RecordSetType >& predictor_;
     const Taxonomy* tax_;
-    ConcurrentOutStream& output_;
+    OrderedOutputWriter& output_;
     ConcurrentOutStream& log_;
+    SequentialSeqStoreInterface* query_sequences_;
     boost::mutex count_mutex_; //needed for concurrent thread count
     uint thread_count_;
 
     void consume() {
+        PipelineProfiler::instance().nameThread( "processor" );
         PredictionRecord prec( tax_ );
+        StringOutputStream output;
 
         // determine count of this thread to index concurrent stream
         boost::mutex::scoped_lock count_lock( count_mutex_ );
         const uint this_thread = thread_count_++;
         count_lock.unlock();
 
+        SchedulerType::Batch batch;
         while ( true ) {
-            RecordSetType rset;
-            try {
-                rset = buffer_.pop();
-            } catch ( boost::thread_interrupted ) {
-                break;
+            {
+                ScopedStage measure_wait( stage_queue_wait );
+                if ( ! buffer_.pop( this_thread, batch ) ) break;
+            }
+            std::size_t marked_length = 0;  // output up to the marked query
+            for ( std::vector< RecordSetType >::iterator rset = batch.items.begin(); rset != batch.items.end(); ++rset ) {
+                // run prediction
+                predictor_.predict( *rset, prec, log_( this_thread ) );
+                if ( query_sequences_ && ! rset->empty() ) query_sequences_->release( rset->front()->getQueryIdentifier() );
+                {
+                    ScopedStage measure_flush( stage_flush );
+                    log_.flush( this_thread );
+                }
+
+                ScopedStage measure_output( stage_output );
+                measure_output.addItems( 1 );
+                output << prec;
+                measure_output.stop();
+                deleteRecords( *rset );
+                if ( std::size_t( rset - batch.items.begin() ) + 1 == batch.marked_items ) marked_length = output.str().size();
             }
 
-            // run prediction
-            predictor_.predict( rset, prec, log_( this_thread ) );
-            log_.flush( this_thread );
-
-            // output to stdout
-            output_( this_thread ) << prec;
-            output_.flush( this_thread );
-
-            deleteRecords( rset );
+            // output of the whole batch to stdout
+            ScopedStage measure_flush( stage_flush );
+            const std::size_t pending_bytes = batch.mark ? output.str().size() - marked_length : 0;
+            output_.submit( batch.sequence, output.str(), batch.mark, pending_bytes );
         }
     }
 };
 
 
 
-void doPredictionsParallel( TaxonPredictionModel< RecordSetType >* predictor, StrIDConverter& seqid2taxid, const Taxonomy* tax, bool split_alignments, bool alignments_sorted , std::ostream& logsink, uint number_threads  ) {
-    AlignmentRecordFactory< AlignmentRecordTaxonomy > fac( seqid2taxid, tax );
-
-    //print GFF3Header
-    std::cout << GFF3Header();
+template< typename InputType >
+void doPredictionsParallel( TaxonPredictionModel< RecordSetType >* predictor, StrIDConverter& seqid2taxid, const Taxonomy* tax, InputType& input, bool split_alignments, bool alignments_sorted , std::ostream& logsink, uint number_threads, uint number_parse_threads, uint output_window, std::ostream* compressed_output, Checkpoint* checkpoint, SequentialSeqStoreInterface* query_sequences ) {
+    FactoryType fac( seqid2taxid, tax );
 
     //adjust thread number
     uint procs = boost::thread::hardware_concurrency();
     if ( ! number_threads ) number_threads = procs;  // set number of threads to available (producer thread is really lightweight)
     else if ( procs ) number_threads = std::min( number_threads, procs );
 
-    BoundedBuffer< RecordSetType > buffer( 10*number_threads );  // hold ten data chunks per consumer TODO: make option
-    ConcurrentOutStream output( std::cout, number_threads, 1000 );  // TODO: analyse number and increase buffer size
+    // batches of at least 100 alignments of 1000 positions (or 64 record sets), four per consumer
+    SchedulerType buffer( number_threads, 1e5, 64, 4*number_threads );
+    RecordSetBuffer producer_buffer( buffer, query_sequences );
+    OrderedOutputWriter output( STDOUT_FILENO, output_window, checkpoint, compressed_output );
     ConcurrentOutStream log( logsink, number_threads, 20000 );
 
-    BoostProducer producer( buffer, fac, split_alignments, alignments_sorted );
-    BoostConsumer consumer( buffer, predictor, tax, log, output );
+    BoostConsumer consumer( buffer, predictor, tax, log, output, query_sequences );
 
     // start the consumers that wait for data in buffer
     boost::thread_group t_consumers;
     for( uint i = 0; i < number_threads; ++i ) t_consumers.create_thread( boost::ref( consumer ) );
 
-    producer();  // main thread is the producer that fills the buffer (not counted separately)
+    try {
+        if ( number_parse_threads > 1 ) {  // main thread splits the input for the parser threads which fill the buffer
+            ParallelRecordSetProducer< AlignmentRecordTaxonomy, RecordSetType, RecordSetBuffer > producer( producer_buffer, fac, split_alignments, alignments_sorted, number_parse_threads );
+            producer.produce( input );
+        } else {
+            BoostProducer< InputType > producer( producer_buffer, fac, input, split_alignments, alignments_sorted );
+            producer();  // main thread is the producer that fills the buffer (not counted separately)
+        }
+    } catch ( ... ) {  // consumers must not outlive the buffers on input errors
+        buffer.close();
+        t_consumers.join_all();
+        throw;
+    }
 
-    buffer.waitUntilEmpty();
-    t_consumers.interrupt_all();  // tell waiting consumers to quit, there will be no more data coming
+    buffer.close();  // consumers quit when all batches are done
     t_consumers.join_all();
+    output.close();
+    if ( checkpoint ) checkpoint->finish();
+}
+
 
-    assert( buffer.empty() );  // TODO: remove
+
+// shard i of n given as "i/n" with 1 <= i <= n
+bool parseShard( const std::string& spec, std::size_t& i, std::size_t& n ) {
+    const std::size_t pos = spec.find( '/' );
+    if ( pos == std::string::npos ) return false;
+    try {
+        i = boost::lexical_cast< std::size_t >( spec.substr( 0, pos ) );
+        n = boost::lexical_cast< std::size_t >( spec.substr( pos + 1 ) );
+    } catch ( boost::bad_lexical_cast& ) {
+        return false;
+    }
+    return i && i <= n;
 }
 
 
 
-// TODO: use function template?
-void doPredictions( TaxonPredictionModel< RecordSetType >* predictor, StrIDConverter& seqid2taxid, const Taxonomy* tax, bool split_alignments, bool alignments_sorted, std::ostream& logsink, uint number_threads ) {
-    if ( number_threads > 1 ) return doPredictionsParallel( predictor, seqid2taxid, tax, split_alignments, alignments_sorted, logsink, number_threads );
-    doPredictionsSerial( predictor, seqid2taxid, tax, split_alignments, alignments_sorted, logsink );
+// reads from the memory-mapped alignments file if given, otherwise from the stream;
+// checkpoints are only possible for the mapped file. The output goes to standard
+// output unless a compressed output stream is given. Streamed query sequences are
+// read along with the record sets.
+void doPredictions( TaxonPredictionModel< RecordSetType >* predictor, StrIDConverter& seqid2taxid, const Taxonomy* tax, std::istream& input, const MappedFile* mapped_input, bool split_alignments, bool alignments_sorted, std::ostream& logsink, uint number_threads, uint number_parse_threads, uint output_window, std::ostream* compressed_output, Checkpoint* checkpoint, SequentialSeqStoreInterface* query_sequences = NULL ) {
+    std::ostream& output = compressed_output ? *compressed_output : std::cout;
+    if ( mapped_input ) {
+        if ( number_threads > 1 ) return doPredictionsParallel( predictor, seqid2taxid, tax, *mapped_input, split_alignments, alignments_sorted, logsink, number_threads, number_parse_threads, output_window, compressed_output, checkpoint, query_sequences );
+        return doPredictionsSerial( predictor, seqid2taxid, tax, *mapped_input, split_alignments, alignments_sorted, logsink, output, checkpoint, query_sequences );
+    }
+    if ( number_threads > 1 ) return doPredictionsParallel( predictor, seqid2taxid, tax, input, split_alignments, alignments_sorted, logsink, number_threads, number_parse_threads, output_window, compressed_output, checkpoint, query_sequences );
+    doPredictionsSerial( predictor, seqid2taxid, tax, input, split_alignments, alignments_sorted, logsink, output, checkpoint, query_sequences );
 }
 
 
@@ -223,9 +331,9 @@ void doPredictions( TaxonPredictionModel< RecordSetType >* predictor, StrIDConve
 int main( int argc, char** argv ) {
 
     vector< string > ranks;
-    string accessconverter_filename, algorithm, query_filename, query_index_filename, db_filename, db_index_filename, whitelist_filename, log_filename;
+    string accessconverter_filename, algorithm, query_filename, query_index_filename, db_filename, db_index_filename, whitelist_filename, log_filename, log_format, alignments_filename, score_cache_filename, profile_filename, checkpoint_filename, shard_spec, shard_index_filename, output_compression_name;
     bool delete_unmarked, split_alignments, alignments_sorted;
-    uint nbest, minsupport, number_threads;
+    uint nbest, minsupport, number_threads, number_parse_threads, output_window, score_cache_size, parallel_threshold, log_level, checkpoint_interval, compression_threads;
     float toppercent, minscore, filterout;
     double maxevalue;
 
@@ -236,17 +344,31 @@ int main( int argc, char** argv ) {
     ( "citation", "show citation info" )
     ( "advanced-options", "show advanced program options" )
     ( "algorithm,a", po::value< string >( &algorithm )->default_value( "rpa" ), "set the algorithm that is used to predict taxonomic ids from alignments" )
+    ( "alignments-file", po::value< string >( &alignments_filename ), "read alignments from this file instead of standard input, gzip, BGZF and zstd compressed input is detected" )
     ( "seqid-taxid-mapping,g", po::value< string >( &accessconverter_filename ), "filename of seqid->taxid mapping for reference" )
-    ( "query-sequences,q", po::value< string >( &query_filename ), "query sequences FASTA" )
+    ( "query-sequences,q", po::value< string >( &query_filename ), "query sequences FASTA or packed file built with refpack-index" )
     ( "query-sequences-index,v", po::value< string >( &query_index_filename ), "query sequences FASTA index, for out-of-memory operation; is created if not existing" )
-    ( "ref-sequences,f", po::value< string >( &db_filename ), "reference sequences FASTA" )
+    ( "stream-query-sequences", "read the query sequences FASTA in one pass along with the alignments, which must be in the same query order (keeps only the queries in progress in memory)" )
+    ( "ref-sequences,f", po::value< string >( &db_filename ), "reference sequences FASTA or packed file built with refpack-index" )
     ( "ref-sequences-index,i", po::value< string >( &db_index_filename ), "FASTA file index, for out-of-memory operation; is created if not existing" )
     ( "processors,p", po::value< uint >( &number_threads )->default_value( 1 ), "sets number of threads, number > 2 will heavily profit from multi-core architectures, set to 0 for max. performance" )
-    ( "logfile,l", po::value< std::string >( &log_filename )->default_value( "/dev/null" ), "specify name of file for logging (appending lines)" );
+    ( "logfile,l", po::value< std::string >( &log_filename )->default_value( "/dev/null" ), "specify name of file for logging (appending lines)" )
+    ( "log-level", po::value< uint >( &log_level ), "amount of logging from 0 (off) over 1 (summary per query) and 2 (passes) to 3 (every alignment), 3 if a log file is given" )
+    ( "log-format", po::value< std::string >( &log_format )->default_value( "text" ), "write the log as text or binary (decode with taxator-log-decode)" )
+    ( "profile", po::value< std::string >( &profile_filename ), "write wall and CPU times of the pipeline stages per thread to this JSON file" )
+    ( "checkpoint", po::value< std::string >( &checkpoint_filename ), "save the progress of the run regularly in this file (with --alignments-file and the output redirected to a file)" )
+    ( "resume", "continue the run of the checkpoint file and append to its output file (>>)" )
+    ( "shard", po::value< std::string >( &shard_spec ), "process only part i/N of the alignments file, split between queries with about the same number of alignments (merge the outputs with taxator-merge-shards)" )
+    ( "output-compression", po::value< std::string >( &output_compression_name )->default_value( "none" ), "compress the output with gzip, bgzf or zstd" )
+    ( "compression-threads", po::value< uint >( &compression_threads )->default_value( 1 ), "number of threads which decompress the input and compress BGZF and zstd output" );
 
     po::options_description hidden_options("Hidden options");
     hidden_options.add_options()
     ( "ranks,r", po::value< vector< string > >( &ranks )->multitoken(), "set node ranks at which to do predictions" )
+    ( "parse-threads", po::value< uint >( &number_parse_threads )->default_value( 1 ), "number of threads that parse the alignments input (only with more than one processor)" )
+    ( "output-window", po::value< uint >( &output_window )->default_value( 1024 ), "number of batches of queries which may finish ahead of the next one in input order (with more than one processor), 0 writes in order of completion" )
+    ( "checkpoint-interval", po::value< uint >( &checkpoint_interval )->default_value( 60 ), "minimum number of seconds between two checkpoints" )
+    ( "shard-index", po::value< std::string >( &shard_index_filename ), "query block index of the alignments file for --shard, built if missing (default: alignments file name with suffix .qidx)" )
     ( "split-alignments,s", po::value< bool >( &split_alignments )->default_value( true ), "decompose alignments into disjunct segments and treat them separately (for algorithms where applicable)" )
     ( "alignments-sorted,o", po::value< bool>( &alignments_sorted )->default_value( false ), "avoid sorting if alignments are sorted")
     ( "delete-notranks,d", po::value< bool >( &delete_unmarked )->default_value( true ), "delete all nodes that don't have any of the given ranks" )
@@ -257,7 +379,10 @@ int main( int argc, char** argv ) {
     ( "minscore,m", po::value< float >( &minscore )->default_value( 0.0 ), "min score parameter for MEGAN classification" )
     ( "nbest,n", po::value< uint >( &nbest )->default_value( 1 ), "n-best LCA classification parameter" )
     ( "ignore-unclassified,u", "alignments for partly unclassified taxa will be ignored" )
-    ( "db-whitelist,w", po::value< string >( &whitelist_filename ), "specifiy list of sequence identifiers in reference to be used to reduce memory footprint (RPA algorithm)" );
+    ( "db-whitelist,w", po::value< string >( &whitelist_filename ), "specifiy list of sequence identifiers in reference to be used to reduce memory footprint (RPA algorithm)" )
+    ( "score-cache-size", po::value< uint >( &score_cache_size )->default_value( 100000 ), "number of reference segment pair alignment scores kept for all queries (RPA algorithm), 0 disables" )
+    ( "score-cache-file", po::value< string >( &score_cache_filename ), "load and save the alignment score cache in this SQLite database between runs (RPA algorithm)" )
+    ( "parallel-alignments", po::value< uint >( &parallel_threshold )->default_value( 500 ), "number of alignments for a query segment from which RPA distributes its realignments to all processors (with more than one processor)" );
 
     po::options_description all_options;
     all_options.add( visible_options ).add( hidden_options );
@@ -292,43 +417,178 @@ int main( int argc, char** argv ) {
         return EXIT_FAILURE;
     }
 
+    if( ! checkpoint_filename.empty() && ( alignments_filename.empty() || ( number_threads > 1 && ! output_window ) ) ) {
+        cout << "Checkpoints need an alignments file and, with more than one processor, an output window" << endl;
+        return EXIT_FAILURE;
+    }
+
+    if( vm.count( "resume" ) && checkpoint_filename.empty() ) {
+        cout << "Specify the checkpoint file to resume from" << endl;
+        return EXIT_FAILURE;
+    }
+
+    std::size_t shard = 0, number_shards = 0;
+    if( ! shard_spec.empty() && ( alignments_filename.empty() || ! parseShard( shard_spec, shard, number_shards ) ) ) {
+        cout << "A shard is given as i/N with 1 <= i <= N and needs an alignments file" << endl;
+        return EXIT_FAILURE;
+    }
+
+    if( vm.count( "stream-query-sequences" ) && algorithm != "rpa" ) {
+        cout << "Streamed query sequences are only read by the rpa algorithm" << endl;
+        return EXIT_FAILURE;
+    }
+
+    if( vm.count( "stream-query-sequences" ) && ( ! query_index_filename.empty() || PackedSequenceFile::detect( query_filename ) ) ) {
+        cout << "Streamed query sequences need a FASTA file without index" << endl;
+        return EXIT_FAILURE;
+    }
+
+    CompressionFormat output_compression;
+    if( ! parseCompressionFormat( output_compression_name, output_compression ) ) {
+        cout << "The output compression must be none, gzip, bgzf or zstd (if supported by this build)" << endl;
+        return EXIT_FAILURE;
+    }
+
+    if( ! checkpoint_filename.empty() && output_compression != uncompressed ) {
+        cout << "Checkpoints need uncompressed output" << endl;
+        return EXIT_FAILURE;
+    }
+
     bool ignore_unclassified = vm.count( "ignore-unclassified" );
 
-    boost::scoped_ptr< Taxonomy > tax( loadTaxonomyFromEnvironment( &ranks ) );  // create taxonomy
+    if( ! profile_filename.empty() ) {  // before any thread is started
+        PipelineProfiler::instance().enable();
+        PipelineProfiler::instance().nameThread( "main" );
+    }
+
+    boost::scoped_ptr< Taxonomy > tax( loadTaxonomyFromEnvironment( &ranks, delete_unmarked ) );  // create taxonomy, if requested only with the major NCBI ranks given by "ranks"
     if( ! tax ) return EXIT_FAILURE;
     
-    if( delete_unmarked ) tax->deleteUnmarkedNodes();  // do everything only with the major NCBI ranks given by "ranks"
-    boost::scoped_ptr< StrIDConverter > seqid2taxid( loadStrIDConverterFromFile( accessconverter_filename, 1000 ) );
-    std::ofstream logsink( log_filename.c_str(), std::ios_base::app );
+    boost::scoped_ptr< StrIDConverter > seqid2taxid;
+    try {
+        seqid2taxid.reset( loadStrIDConverterFromFile( accessconverter_filename, 1000 ) );
+    } catch( Exception& e ) {
+        cerr << "Could not load the taxonomic mapping \"" << accessconverter_filename << "\"" << endl;
+        cerr << endl << "Here is some debugging information to locate the problem:" << endl << boost::diagnostic_information( e ) << endl;
+        return EXIT_FAILURE;
+    }
+    if( ! vm.count( "log-level" ) ) log_level = vm[ "logfile" ].defaulted() ? DecisionLog::off : DecisionLog::alignments;  // nothing is formatted for /dev/null
+    if( log_level > DecisionLog::alignments || ( log_format != "text" && log_format != "binary" ) ) {
+        cout << "The log level must be between 0 and 3 and the log format text or binary" << endl;
+        return EXIT_FAILURE;
+    }
+    const DecisionLog::Format decision_log_format = log_format == "binary" ? DecisionLog::binary : DecisionLog::text;
+    std::ofstream logsink( log_filename.c_str(), std::ios_base::app | std::ios_base::binary );
+    DecisionLog run_log( logsink, DecisionLog::Level( log_level ), decision_log_format );
+    run_log.writeHeader();
+
+    boost::scoped_ptr< MappedFile > alignments_file;  // files are mapped into memory and parsed in place
+    boost::scoped_ptr< CompressedInputStream > input_stream;  // unless they are compressed
+    if( ! alignments_filename.empty() ) {
+        try {
+            input_stream.reset( new CompressedInputStream( alignments_filename, compression_threads ) );
+            if( input_stream->format() == uncompressed ) {
+                input_stream.reset();
+                alignments_file.reset( new MappedFile( alignments_filename ) );
+            }
+        } catch( Exception& e ) {
+            const std::string* reason = boost::get_error_info< general_info >( e );
+            cerr << "Could not open alignments file \"" << alignments_filename << "\"" << ( reason ? ": " + *reason : "" ) << endl;
+            return EXIT_FAILURE;
+        }
+        if( input_stream && ( number_shards || ! checkpoint_filename.empty() ) ) {
+            cerr << "Shards and checkpoints need an uncompressed alignments file" << endl;
+            return EXIT_FAILURE;
+        }
+    }
 
     try {
+      // contiguous part of the alignments file, the index is built once for all shards
+      std::size_t input_first = 0, input_last = alignments_file ? alignments_file->fileSize() : 0;
+      if( number_shards ) {
+          if( shard_index_filename.empty() ) shard_index_filename = alignments_filename + ".qidx";
+          boost::scoped_ptr< QueryBlockIndex > query_blocks;
+          if( boost::filesystem::exists( shard_index_filename ) ) query_blocks.reset( new QueryBlockIndex( shard_index_filename ) );
+          if( ! query_blocks || ! query_blocks->indexes( *alignments_file ) ) {
+              query_blocks.reset();
+              buildQueryBlockIndex( *alignments_file, shard_index_filename );
+              query_blocks.reset( new QueryBlockIndex( shard_index_filename ) );
+          }
+          query_blocks->shard( shard - 1, number_shards, input_first, input_last );
+          alignments_file->select( input_first, input_last );
+      }
+
+      // continue behind the last completely written query
+      boost::scoped_ptr< Checkpoint > checkpoint;
+      if( ! checkpoint_filename.empty() ) {
+          checkpoint.reset( new Checkpoint( checkpoint_filename, *alignments_file, checkpoint_interval ) );
+          if( vm.count( "resume" ) ) alignments_file->select( checkpoint->resume(), input_last );
+      }
+
+      // the merge of shards puts them in order by their position in the alignments file
+      boost::scoped_ptr< CompressedOutputStream > compressed_output;
+      if( output_compression != uncompressed ) compressed_output.reset( new CompressedOutputStream( STDOUT_FILENO, output_compression, compression_threads ) );
+      std::ostream& output = compressed_output ? *compressed_output : cout;
+      if( ! checkpoint || ! checkpoint->resumed() ) {
+          output << GFF3Header();
+          if( number_shards ) output << "#taxator-shard\t" << shard << '/' << number_shards << '\t' << input_first << '\t' << input_last << '\t' << alignments_file->fileSize() << '\n';
+          output << flush;  // parallel output is written to the file descriptor
+      }
+
+      // standard input is only read from here on, detecting its format waits for the first bytes
+      if( alignments_filename.empty() ) input_stream.reset( new CompressedInputStream( cin, compression_threads ) );
+      std::istream& input = input_stream ? *input_stream : cin;
+
       // choose appropriate prediction model from command line parameters
       //TODO: "address of temporary warning" is annoying but life-time is guaranteed until function returns
-      if( algorithm == "dummy" ) doPredictions( &DummyPredictionModel< RecordSetType >( tax.get() ), *seqid2taxid, tax.get(), split_alignments, alignments_sorted, logsink, number_threads );
-      else if( algorithm == "simple-lca" ) doPredictions( &LCASimplePredictionModel< RecordSetType >( tax.get() ), *seqid2taxid, tax.get(), split_alignments, alignments_sorted, logsink, number_threads );
-      else if( algorithm == "megan-lca" ) doPredictions( &MeganLCAPredictionModel< RecordSetType >( tax.get(), ignore_unclassified, toppercent, minscore, minsupport, maxevalue ), *seqid2taxid, tax.get(), split_alignments, alignments_sorted, logsink, number_threads );
-      else if( algorithm == "ic-megan-lca" ) doPredictions( &MeganLCAPredictionModel< RecordSetType >( tax.get(), ignore_unclassified, toppercent, minscore, minsupport, maxevalue ), *seqid2taxid, tax.get(), split_alignments, alignments_sorted, logsink, number_threads );
-      else if( algorithm == "n-best-lca" ) doPredictions( &NBestLCAPredictionModel< RecordSetType >( tax.get(), nbest ), *seqid2taxid, tax.get(), split_alignments, alignments_sorted, logsink, number_threads );
+      if( algorithm == "dummy" ) doPredictions( &DummyPredictionModel< RecordSetType >( tax.get() ), *seqid2taxid, tax.get(), input, alignments_file.get(), split_alignments, alignments_sorted, logsink, number_threads, number_parse_threads, output_window, compressed_output.get(), checkpoint.get() );
+      else if( algorithm == "simple-lca" ) doPredictions( &LCASimplePredictionModel< RecordSetType >( tax.get() ), *seqid2taxid, tax.get(), input, alignments_file.get(), split_alignments, alignments_sorted, logsink, number_threads, number_parse_threads, output_window, compressed_output.get(), checkpoint.get() );
+      else if( algorithm == "megan-lca" ) doPredictions( &MeganLCAPredictionModel< RecordSetType >( tax.get(), ignore_unclassified, toppercent, minscore, minsupport, maxevalue ), *seqid2taxid, tax.get(), input, alignments_file.get(), split_alignments, alignments_sorted, logsink, number_threads, number_parse_threads, output_window, compressed_output.get(), checkpoint.get() );
+      else if( algorithm == "ic-megan-lca" ) doPredictions( &MeganLCAPredictionModel< RecordSetType >( tax.get(), ignore_unclassified, toppercent, minscore, minsupport, maxevalue ), *seqid2taxid, tax.get(), input, alignments_file.get(), split_alignments, alignments_sorted, logsink, number_threads, number_parse_threads, output_window, compressed_output.get(), checkpoint.get() );
+      else if( algorithm == "n-best-lca" ) doPredictions( &NBestLCAPredictionModel< RecordSetType >( tax.get(), nbest ), *seqid2taxid, tax.get(), input, alignments_file.get(), split_alignments, alignments_sorted, logsink, number_threads, number_parse_threads, output_window, compressed_output.get(), checkpoint.get() );
       else if( algorithm == "rpa" ) {
           typedef seqan::String< seqan::Dna5 > StringType;
           // load query sequences
           boost::scoped_ptr< RandomSeqStoreROInterface< StringType > > query_storage;
-          if( query_index_filename.empty() ) query_storage.reset( new RandomInmemorySeqStoreRO< StringType >( query_filename ) );
+          SequentialSeqStoreRO< StringType >* streamed_queries = NULL;  // read along with the alignments
+          if( vm.count( "stream-query-sequences" ) ) query_storage.reset( streamed_queries = new SequentialSeqStoreRO< StringType >( query_filename ) );
+          else if( PackedSequenceFile::detect( query_filename ) ) query_storage.reset( new RandomMappedPackedSeqStoreRO< StringType >( query_filename ) );
+          else if( query_index_filename.empty() ) query_storage.reset( new RandomInmemorySeqStoreRO< StringType >( query_filename ) );
           else query_storage.reset( new RandomIndexedSeqstoreRO< StringType >( query_filename, query_index_filename ) );
 
           // reference query sequences
           boost::scoped_ptr< RandomSeqStoreROInterface< StringType > > db_storage;
           StopWatchCPUTime measure_db_loading( "loading reference db" );
           measure_db_loading.start();
-          if( db_index_filename.empty() ) db_storage.reset( new RandomInmemorySeqStoreRO< StringType >( db_filename ) );
+          if( PackedSequenceFile::detect( db_filename ) ) db_storage.reset( new RandomMappedPackedSeqStoreRO< StringType >( db_filename ) );
+          else if( db_index_filename.empty() ) db_storage.reset( new RandomInmemorySeqStoreRO< StringType >( db_filename ) );
           else db_storage.reset( new RandomIndexedSeqstoreRO< StringType >( db_filename, db_index_filename ) );
           measure_db_loading.stop();
 
-          doPredictions( &RPAPredictionModel< RecordSetType, RandomSeqStoreROInterface< StringType >, RandomSeqStoreROInterface< StringType > >( tax.get(), *query_storage, *db_storage, filterout, toppercent ), *seqid2taxid, tax.get(), split_alignments, alignments_sorted, logsink, number_threads );  // TODO: reuse toppercent param?
+          // scores are only valid for the same reference sequences
+          AlignmentScoreCache score_cache( score_cache_size );
+          const std::string score_cache_reference = boost::filesystem::absolute( db_filename ).string() + '\t' + boost::lexical_cast< std::string >( boost::filesystem::file_size( db_filename ) ) + '\t' + boost::lexical_cast< std::string >( boost::filesystem::last_write_time( db_filename ) );
+          if( ! score_cache_filename.empty() && score_cache_size ) score_cache.load( score_cache_filename, score_cache_reference );
+
+          // processors without record sets help with large ones, mostly at the end of the input
+          const uint pool_threads = number_threads ? number_threads : boost::thread::hardware_concurrency();
+          ThreadPool pool( pool_threads > 1 ? pool_threads - 1 : 0 );
+
+          doPredictions( &RPAPredictionModel< RecordSetType, RandomSeqStoreROInterface< StringType >, RandomSeqStoreROInterface< StringType > >( tax.get(), *query_storage, *db_storage, filterout, toppercent, &score_cache, &pool, parallel_threshold, DecisionLog::Level( log_level ), decision_log_format ), *seqid2taxid, tax.get(), input, alignments_file.get(), split_alignments, alignments_sorted, logsink, number_threads, number_parse_threads, output_window, compressed_output.get(), checkpoint.get(), streamed_queries );  // TODO: reuse toppercent param?
+
+          if( run_log.enabled( DecisionLog::summary ) ) run_log.event( DecisionLog::scorecache ) << score_cache.lookups() << score_cache.hits() << score_cache.size();
+          if( ! score_cache_filename.empty() && score_cache_size ) score_cache.save( score_cache_filename, score_cache_reference );
       } else {
           cout << "classification algorithm can either be: rpa (default), simple-lca, megan-lca, ic-megan-lca, n-best-lca" << endl;
           return EXIT_FAILURE;
       }
+      if( compressed_output ) compressed_output->close();
+
+      if( ! profile_filename.empty() ) {
+          std::ofstream profile( profile_filename.c_str() );
+          PipelineProfiler::instance().report( profile );
+          if( ! profile ) BOOST_THROW_EXCEPTION( FileError {} << general_info {"could not write profile"} << file_info { profile_filename } );
+      }
       return EXIT_SUCCESS;
     } catch(Exception &e) {
        cerr << "An unrecoverable error occurred: " << e.what() << endl;
@@ -27,6 +27,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <boost/program_options/options_description.hpp>
 #include <boost/program_options/variables_map.hpp>
 #include <boost/program_options/parsers.hpp>
+#include <boost/filesystem.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <assert.h>
 #include "src/taxonomyinterface.hh"
@@ -35,14 +36,16 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "src/constants.hh"
 #include "src/taxonfilter.hh"
 #include "src/exception.hh"
+#include "src/taxonomysnapshot.hh"
 
 using namespace std;
 
 int main( int argc, char** argv ) {
-  string show_what, invalid_replace_value_traverse, invalid_replace_value_annotate, tree_outfile, operation;
-  vector< string > rank_names;
+  string show_what, invalid_replace_value_traverse, invalid_replace_value_annotate, tree_outfile, snapshot_outfile, operation;
+  vector< string > rank_names, snapshot_ranks;
   unsigned int field_pos;
   bool allnodes = false;
+  bool snapshot_delete_unmarked;
 
   namespace po = boost::program_options;
 
@@ -55,7 +58,8 @@ int main( int argc, char** argv ) {
   ( "mode,m", po::value< std::string >( &operation)->default_value( "annotate" ), "choose mode:\n"
                                           "\"traverse\": follow nodes upwards in taxonomy\n\n"
                                           "\"annotate\": looks up metainformation attached to nodes (e.g. names)\n\n"
-                                          "\"tree\": writes a (sub)tree\n\n")
+                                          "\"tree\": writes a (sub)tree\n\n"
+                                          "\"snapshot\": compiles the taxonomy dump files into a binary snapshot which is loaded instead by all programs\n\n")
   ( "field,f", po::value< unsigned int >( &field_pos )->default_value( 1 ), "input column\n" );
 
 
@@ -85,7 +89,14 @@ int main( int argc, char** argv ) {
   ( "fill-intermediate,i", "fill in dummy intermediate nodes if ranks are missing")
   ( "names,v", "show scientific names in tree (no character restrictions)");
 
-    desc.add(traverse_opts).add(annotate_opts).add(tree_opts);  //TODO: handle options separately
+  // TODO: put option parsing in separate objects which can be chained
+  po::options_description snapshot_opts("snapshot mode");
+  snapshot_opts.add_options()
+  ( "snapshot-file", po::value< string >( &snapshot_outfile ), "name of snapshot file to be written (default: taxonomy folder)")
+  ( "snapshot-ranks", po::value< vector <string> >( &snapshot_ranks)->multitoken(),"ranks the programs will be run with; if not set, default ranks will be used")
+  ( "snapshot-delete-notranks", po::value< bool >( &snapshot_delete_unmarked )->default_value( true ), "store only nodes with the given ranks (the programs must then be run with --delete-notranks)");
+
+    desc.add(traverse_opts).add(annotate_opts).add(tree_opts).add(snapshot_opts);  //TODO: handle options separately
 
     po::variables_map vm;
     po::store(po::command_line_parser( argc, argv ).options( desc ).positional(mode).run(), vm);
@@ -123,7 +134,7 @@ int main( int argc, char** argv ) {
           stringstream buffer;
           list< string > fields;
           list< string >::iterator field_it;
-          TaxonID taxid;
+          TaxonID taxid = TaxonID();
           const TaxonNode* rootnode = interface.getRoot();
           const TaxonNode* node;
 
@@ -190,7 +201,7 @@ int main( int argc, char** argv ) {
           string line;
           list< string > fields;
           list< string >::iterator field_it;
-          TaxonID taxid;
+          TaxonID taxid = TaxonID();
           const TaxonNode* node;
           stringstream buffer;
 
@@ -445,6 +456,22 @@ int main( int argc, char** argv ) {
           buffer.str("");
           buffer.clear();
         }
+      } else if( operation == "snapshot" ) {
+        if( snapshot_ranks.empty() ) snapshot_ranks = default_ranks;
+        if( snapshot_outfile.empty() ) {
+            char* env = getenv( ENVVAR_TAXONOMY_NCBI.c_str() );
+            if( env == NULL ) { cerr << "Specify --snapshot-file or the " << ENVVAR_TAXONOMY_NCBI << " environment variable" << endl; return EXIT_FAILURE; }
+            snapshot_outfile = string( env ) + "/" + taxonomy_snapshot_filename;
+        }
+
+        // build taxonomy from the dump files only, the full tree is also written if pruned
+        boost::scoped_ptr< Taxonomy > tax(loadTaxonomyFromEnvironment(&snapshot_ranks, false, false));
+        if(!tax) return EXIT_FAILURE;
+        if(snapshot_delete_unmarked) {
+            writeTaxonomySnapshot(*tax, taxonomyFullSnapshotFilename(snapshot_outfile), snapshot_ranks, false);
+            tax->deleteUnmarkedNodes();
+        } else boost::filesystem::remove(taxonomyFullSnapshotFilename(snapshot_outfile));  // would be outdated
+        writeTaxonomySnapshot(*tax, snapshot_outfile, snapshot_ranks, snapshot_delete_unmarked);
       } else {
           cerr << "unknown operation mode '" << operation << "' for --mode / -m" << endl;
       }
@@ -1,5 +1,9 @@
+#include <boost/filesystem.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/cstdint.hpp>
 #include <iostream>
+#include <fstream>
 #include <cstdlib>
 #include <ctime>
 #include <assert.h>
@@ -7,6 +11,7 @@
 #include "src/accessconv.hh"
 #include "src/taxonomyinterface.hh"
 #include "src/constants.hh"
+#include "src/taxonomysnapshot.hh"
 
 
 
@@ -38,7 +43,7 @@ int main( int argc, char** argv ) {
 
 
     {   //basic tests on unmodified taxonomy
-        boost::scoped_ptr< Taxonomy > tax(loadTaxonomyFromEnvironment( &default_ranks ));
+        boost::scoped_ptr< Taxonomy > tax(loadTaxonomyFromEnvironment( &default_ranks, false, false ));
         TaxonomyInterface taxinter( tax.get() );
         const TaxonNode* root_node = taxinter.getRoot();
         cerr << "taxonomy size: " << tax->size() << " nodes" << endl;
@@ -106,26 +111,26 @@ int main( int argc, char** argv ) {
             }
         }
 
-        const TaxonNode* node = taxinter.getNode("166532");
+        const TaxonNode* node = taxinter.getNode(boost::lexical_cast<TaxonID>("166532"));
         if( node ) {
             alltests = alltests && unittest_assert( node->data->is_unclassified, "UNCLASSIFIED_MARKED (unclassified Potamonautes)" );
         }
-        node = taxinter.getNode("713063");
+        node = taxinter.getNode(boost::lexical_cast<TaxonID>("713063"));
         if( node ) {
             alltests = alltests && unittest_assert( node->data->is_unclassified, "UNCLASSIFIED_MARKED (unclassified Tenericutes)" );
         }
-        node = taxinter.getNode("39945");
+        node = taxinter.getNode(boost::lexical_cast<TaxonID>("39945"));
         if( node ) {
             alltests = alltests && unittest_assert( node->data->is_unclassified, "UNCLASSIFIED_MARKED (unclassified Mollicutes)" );
         }
-        node = taxinter.getNode("575771");
+        node = taxinter.getNode(boost::lexical_cast<TaxonID>("575771"));
         if( node ) {
             alltests = alltests && unittest_assert( node->data->is_unclassified, "UNCLASSIFIED_MARKED (Candidatus Lumbricincola sp. Ef-1)" );
         }
     }
 
     {
-        boost::scoped_ptr< Taxonomy > tax(loadTaxonomyFromEnvironment( &default_ranks ));
+        boost::scoped_ptr< Taxonomy > tax(loadTaxonomyFromEnvironment( &default_ranks, false, false ));
         int number_nodes = tax->size();
         tax->deleteUnmarkedNodes();
         tax->setRankDistances( default_ranks );
@@ -164,7 +169,7 @@ int main( int argc, char** argv ) {
 
     {
         // randomly choose tree nodes and check whether PathIterators return the same path up and downwards
-        boost::scoped_ptr< Taxonomy > tax(loadTaxonomyFromEnvironment(&default_ranks));
+        boost::scoped_ptr< Taxonomy > tax(loadTaxonomyFromEnvironment(&default_ranks, false, false));
         TaxonomyInterface taxinter( tax.get() );
         const TaxonNode* root = taxinter.getRoot();
 
@@ -218,12 +223,81 @@ int main( int argc, char** argv ) {
 // 		}
 // 	}
 
+    { // compare indexed LCA queries with walking up the tree, before and after deleting nodes
+        boost::scoped_ptr< Taxonomy > tax(loadTaxonomyFromEnvironment(&default_ranks, false, false));
+        TaxonomyInterface taxinter( tax.get() );
+
+        for( int round = 0; round < 2; ++round ) {
+            if( round ) tax->deleteUnmarkedNodes();
+            std::vector< const TaxonNode* > nodes;
+            for( node_it = tax->begin(); node_it != tax->end(); ++node_it ) nodes.push_back( node_it.node );
+
+            std::vector< std::pair< const TaxonNode*, const TaxonNode* > > pairs;
+            for( int i = 0; i < 10000; ++i ) pairs.push_back( std::make_pair( nodes[ rand() % nodes.size() ], nodes[ rand() % nodes.size() ] ) );
+            pairs.push_back( std::make_pair( nodes.front(), nodes.back() ) );
+            pairs.push_back( std::make_pair( nodes.back(), nodes.back() ) );
+
+            std::vector< const TaxonNode* > indexed;
+            for( unsigned int i = 0; i < pairs.size(); ++i ) indexed.push_back( taxinter.getLCA( pairs[i].first, pairs[i].second ) );
+            tax->clearLCAIndex();
+            for( unsigned int i = 0; i < pairs.size(); ++i ) alltests = alltests && unittest_assert( indexed[i] == taxinter.getLCA( pairs[i].first, pairs[i].second ), "LCA_INDEX" );
+            tax->recreateLCAIndex();
+        }
+    }
+
+    { // write a snapshot of the full and the pruned tree and compare the reloaded nodes
+        const std::string snapshot_filename = ( boost::filesystem::temp_directory_path() / boost::filesystem::unique_path() ).string();
+        for( int round = 0; round < 2; ++round ) {
+            const bool pruned = round;
+            boost::scoped_ptr< Taxonomy > tax(loadTaxonomyFromEnvironment(&default_ranks, pruned, false));
+            writeTaxonomySnapshot( *tax, snapshot_filename, default_ranks, pruned );
+            boost::scoped_ptr< Taxonomy > loaded(loadTaxonomySnapshot( snapshot_filename, &default_ranks, pruned ));
+            boost::filesystem::remove( snapshot_filename );
+            alltests = alltests && unittest_assert( loaded && loaded->size() == tax->size(), "SNAPSHOT_SIZE" );
+            if( ! loaded ) continue;
+            TaxonomyInterface taxinter( loaded.get() );
+
+            Taxonomy::iterator loaded_it = loaded->begin();
+            for( node_it = tax->begin(); node_it != tax->end() && loaded_it != loaded->end(); ++node_it, ++loaded_it ) {
+                const Taxon& expected = **node_it;
+                const Taxon& actual = **loaded_it;
+                const TaxonNode* expected_parent = node_it.node->parent;
+                const TaxonNode* actual_parent = loaded_it.node->parent;
+                const std::string testname = "SNAPSHOT_NODE (" + boost::lexical_cast< std::string >( expected.taxid ) + ")";
+                alltests = alltests && unittest_assert( actual.taxid == expected.taxid, testname );
+                alltests = alltests && unittest_assert( ( ! actual_parent && ! expected_parent ) || ( actual_parent && expected_parent && actual_parent->data->taxid == expected_parent->data->taxid ), testname );
+                alltests = alltests && unittest_assert( ( ! actual.annotation && ! expected.annotation ) || ( actual.annotation && expected.annotation && actual.annotation->rank == expected.annotation->rank && actual.annotation->name == expected.annotation->name ), testname );
+                alltests = alltests && unittest_assert( actual.leftvalue == expected.leftvalue && actual.rightvalue == expected.rightvalue, testname );
+                alltests = alltests && unittest_assert( actual.root_pathlength == expected.root_pathlength, testname );
+                alltests = alltests && unittest_assert( taxinter.getNode( expected.taxid ) == loaded_it.node, testname );
+            }
+        }
+
+        // node counts which point past the file or overflow the size computation must be rejected
+        boost::scoped_ptr< Taxonomy > tax(loadTaxonomyFromEnvironment(&default_ranks, false, false));
+        writeTaxonomySnapshot( *tax, snapshot_filename, default_ranks, false );
+        const boost::uint64_t file_size = boost::filesystem::file_size( snapshot_filename );
+        const boost::uint64_t bad_counts[] = { file_size/sizeof( boost::uint32_t ), ~boost::uint64_t( 0 ) };
+        for( unsigned int i = 0; i < 2; ++i ) {
+            {
+                std::fstream patch( snapshot_filename.c_str(), std::ios::in | std::ios::out | std::ios::binary );
+                patch.seekp( 16 );  // number_nodes follows magic, format version and pruned flag
+                patch.write( reinterpret_cast< const char* >( &bad_counts[i] ), sizeof( bad_counts[i] ) );
+            }
+            try {
+                boost::scoped_ptr< Taxonomy > loaded(loadTaxonomySnapshot( snapshot_filename, &default_ranks, false ));
+                alltests = alltests && unittest_assert( false, "SNAPSHOT_CORRUPT_HEADER" );
+            } catch(Exception& e) {}  // just pass
+        }
+        boost::filesystem::remove( snapshot_filename );
+    }
+
     { // check exception handling
-        boost::scoped_ptr< Taxonomy > tax(loadTaxonomyFromEnvironment(&default_ranks));
+        boost::scoped_ptr< Taxonomy > tax(loadTaxonomyFromEnvironment(&default_ranks, false, false));
         TaxonomyInterface taxinter( tax.get() );
         
         try {
-            taxinter.getNode("-1");
+            taxinter.getNode(boost::lexical_cast<TaxonID>("-1"));
             alltests = alltests && unittest_assert(false, "Taxonomy does not throw exception for taxid=-1");
         } catch(Exception& e) {
             cout << "Correctly thrown exception: " << e.what() << endl;